@@ -0,0 +1,321 @@
+
+#include <assert.h>
+#include <stdlib.h>
+#include "kernel_aio.h"
+#include "kernel_cc.h"
+#include "kernel_sched.h"
+#include "kernel_streams.h"
+#include "kernel_poll.h"
+#include "kernel_sys.h"
+
+
+/* The number of ready streams handled by the worker per wait */
+#define AIO_BATCH 16
+
+
+/* A request that would block, waiting for its stream */
+typedef struct aio_request {
+    aio_sqe sqe;            // a copy of the submission
+    FCB* fcb;               // the stream, held while the request is pending
+    rlnode node;            // in the pending list
+} aio_req;
+
+
+typedef struct aio_context {
+    aio_ring* ring;         // the process rings, NULL once the process exits
+    unsigned int inflight;  // consumed requests that are not completed
+    rlnode pending;         // requests that would block, in submission order
+    eventset_cb* set;       // the streams of the pending requests
+    CondVar completed;      // broadcast on each completion
+    int running;            // the worker has started, and not finished
+} aio_context;
+
+
+/* The readiness needed by an operation, or 0 if it is illegal */
+static unsigned int aio_events(aio_opcode op)
+{
+    switch (op) {
+    case AIO_READ:
+    case AIO_ACCEPT:
+        return EVENT_READ;
+    case AIO_WRITE:
+    case AIO_CONNECT:
+        return EVENT_WRITE;
+    default:
+        return 0;
+    }
+}
+
+
+static void aio_complete(aio_context* ctx, void* data, int result)
+{
+    aio_ring* ring = ctx->ring;
+
+    ctx->inflight--;
+    if (ring == NULL)
+        return;
+
+    /* AioSubmit has made sure that there is room */
+    unsigned int tail = ring->cq_tail;
+    aio_cqe* cqe = &ring->cq[tail & (ring->entries - 1)];
+    cqe->data = data;
+    cqe->result = result;
+    __atomic_store_n(&ring->cq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    kernel_broadcast(&ctx->completed);
+}
+
+
+/* Attempt a request, forcing non-blocking mode */
+static int aio_attempt(aio_sqe* sqe, FCB* fcb)
+{
+    TCB* tcb = cur_thread();
+    int saved_flags = tcb->io_flags;
+    int rc = -1;
+
+    tcb->io_flags = FID_NONBLOCK;
+    switch (sqe->op) {
+    case AIO_READ:
+        if (fcb->streamfunc->Read)
+            rc = fcb->streamfunc->Read(fcb->streamobj, sqe->buf, sqe->len);
+        break;
+    case AIO_WRITE:
+        if (fcb->streamfunc->Write)
+            rc = fcb->streamfunc->Write(fcb->streamobj, sqe->buf, sqe->len);
+        break;
+
+    /* These work on file ids, which must still refer to the stream */
+    case AIO_ACCEPT:
+        if (get_fcb(sqe->fid) == fcb)
+            rc = sys_Accept(sqe->fid);
+        break;
+    case AIO_CONNECT:
+        if (get_fcb(sqe->fid) == fcb)
+            rc = sys_Connect(sqe->fid, sqe->port, 0);
+        break;
+    }
+    tcb->io_flags = saved_flags;
+
+    return rc;
+}
+
+
+/* The events needed by the pending requests of a stream */
+static unsigned int aio_pending_events(aio_context* ctx, FCB* fcb)
+{
+    unsigned int events = 0;
+    for (rlnode* n = ctx->pending.next; n != &ctx->pending; n = n->next) {
+        aio_req* req = n->obj;
+        if (req->fcb == fcb)
+            events |= aio_events(req->sqe.op);
+    }
+    return events;
+}
+
+
+/* Bring the registration of a stream in line with its pending requests */
+static void aio_watch(aio_context* ctx, FCB* fcb, Fid_t fid)
+{
+    unsigned int events = aio_pending_events(ctx, fcb);
+
+    if (events == 0)
+        eventset_ctl(ctx->set, EVENTSET_DEL, fcb, fid, 0);
+    else if (eventset_ctl(ctx->set, EVENTSET_MOD, fcb, fid, events) == -1)
+        eventset_ctl(ctx->set, EVENTSET_ADD, fcb, fid, events);
+}
+
+
+static void aio_start(aio_context* ctx, aio_sqe* sqe)
+{
+    FCB* fcb = get_fcb(sqe->fid);
+    unsigned int dir = aio_events(sqe->op);
+
+    if (fcb == NULL || dir == 0) {
+        aio_complete(ctx, sqe->data, -1);
+        return;
+    }
+
+    /* Try at once, unless this would overtake a pending request */
+    if (!(aio_pending_events(ctx, fcb) & dir)) {
+        int rc = aio_attempt(sqe, fcb);
+        if (rc != WOULDBLOCK) {
+            aio_complete(ctx, sqe->data, rc);
+            return;
+        }
+    }
+
+    aio_req* req = (aio_req*)xmalloc(sizeof(aio_req));
+    req->sqe = *sqe;
+    req->fcb = fcb;
+    FCB_incref(fcb);
+    rlnode_init(&req->node, req);
+    rlist_push_back(&ctx->pending, &req->node);
+
+    aio_watch(ctx, fcb, sqe->fid);
+}
+
+
+/*
+    Retry the pending requests of a ready stream, in order. Once a request
+    would block, later requests in the same direction are not attempted.
+ */
+static void aio_retry(aio_context* ctx, FCB* fcb)
+{
+    unsigned int blocked = 0;
+    unsigned int done = 0;
+    Fid_t fid = NOFILE;
+
+    rlnode* n = ctx->pending.next;
+    while (n != &ctx->pending) {
+        aio_req* req = n->obj;
+        n = n->next;
+
+        if (req->fcb != fcb)
+            continue;
+        fid = req->sqe.fid;
+
+        unsigned int dir = aio_events(req->sqe.op);
+        if (blocked & dir)
+            continue;
+
+        int rc = aio_attempt(&req->sqe, fcb);
+        if (rc == WOULDBLOCK) {
+            blocked |= dir;
+            continue;
+        }
+
+        rlist_remove(&req->node);
+        aio_complete(ctx, req->sqe.data, rc);
+        free(req);
+        done++;
+    }
+
+    aio_watch(ctx, fcb, fid);
+
+    /* Drop the references last, as this may close the stream */
+    while (done--)
+        FCB_decref(fcb);
+}
+
+
+static void aio_worker()
+{
+    kernel_lock();
+
+    aio_context* ctx = CURPROC->aio;
+    ctx->running = 1;
+    kernel_broadcast(&ctx->completed);
+
+    fid_event events[AIO_BATCH];
+    FCB* fcbs[AIO_BATCH];
+    int n;
+
+    /* This returns -1 when the event set is destroyed by aio_release */
+    while ((n = eventset_wait(ctx->set, events, fcbs, AIO_BATCH, TIMEOUT_INFINITE)) >= 0)
+        for (int i = 0; i < n; i++)
+            aio_retry(ctx, fcbs[i]);
+
+    while (!is_rlist_empty(&ctx->pending)) {
+        aio_req* req = rlist_pop_front(&ctx->pending)->obj;
+        FCB_decref(req->fcb);
+        free(req);
+    }
+
+    /* 
+        aio_release is waiting for us. It cannot proceed until we have 
+        released the kernel lock, i.e., until we have exited.
+     */
+    ctx->running = 0;
+    kernel_broadcast(&ctx->completed);
+    kernel_sleep(EXITED, SCHED_USER);
+}
+
+
+/*
+    Stop the worker and wait for it to exit. The worker uses the process
+    (its file ids and its resource usage), so this must be done before 
+    the process becomes a zombie.
+ */
+void aio_release(PCB* pcb)
+{
+    aio_context* ctx = pcb->aio;
+    if (ctx == NULL)
+        return;
+
+    pcb->aio = NULL;
+    ctx->ring = NULL;
+    eventset_destroy(ctx->set);
+
+    while (ctx->running)
+        kernel_wait(&ctx->completed, SCHED_USER);
+    free(ctx);
+}
+
+
+int sys_AioSetup(aio_ring* ring)
+{
+    if (ring == NULL || ring->sq == NULL || ring->cq == NULL)
+        return -1;
+
+    unsigned int n = ring->entries;
+    if (n == 0 || n > AIO_MAX_ENTRIES || (n & (n - 1)))
+        return -1;
+
+    if (CURPROC->aio != NULL)
+        return -1;
+
+    aio_context* ctx = (aio_context*)xmalloc(sizeof(aio_context));
+    ctx->ring = ring;
+    ctx->inflight = 0;
+    rlnode_init(&ctx->pending, NULL);
+    ctx->set = eventset_create();
+    ctx->completed = COND_INIT;
+    ctx->running = 0;
+
+    ring->sq_head = ring->sq_tail = 0;
+    ring->cq_head = ring->cq_tail = 0;
+    CURPROC->aio = ctx;
+
+    /* The worker is not a user thread, it does not keep the process alive */
+    TCB* worker = spawn_thread(CURPROC, aio_worker);
+    worker->ptcb = NULL;
+    wakeup(worker);
+
+    while (!ctx->running)
+        kernel_wait(&ctx->completed, SCHED_USER);
+
+    return 0;
+}
+
+
+int sys_AioSubmit(unsigned int min_complete)
+{
+    aio_context* ctx = CURPROC->aio;
+    if (ctx == NULL)
+        return -1;
+
+    aio_ring* ring = ctx->ring;
+    unsigned int mask = ring->entries - 1;
+    int submitted = 0;
+
+    unsigned int tail = __atomic_load_n(&ring->sq_tail, __ATOMIC_ACQUIRE);
+    while (ring->sq_head != tail) {
+        /* Every consumed request must find room for its completion */
+        unsigned int unreaped = ring->cq_tail - __atomic_load_n(&ring->cq_head, __ATOMIC_ACQUIRE);
+        if (ctx->inflight + unreaped >= ring->entries)
+            break;
+
+        aio_sqe sqe = ring->sq[ring->sq_head & mask];
+        __atomic_store_n(&ring->sq_head, ring->sq_head + 1, __ATOMIC_RELEASE);
+
+        ctx->inflight++;
+        aio_start(ctx, &sqe);
+        submitted++;
+    }
+
+    while (min_complete > 0 && ctx->inflight > 0
+            && ring->cq_tail - __atomic_load_n(&ring->cq_head, __ATOMIC_ACQUIRE) < min_complete)
+        kernel_wait(&ctx->completed, SCHED_IO);
+
+    return submitted;
+}
@@ -0,0 +1,40 @@
+#ifndef __KERNEL_AIO_H
+#define __KERNEL_AIO_H
+
+#include "tinyos.h"
+#include "kernel_proc.h"
+
+/**
+	@file kernel_aio.h
+	@brief Asynchronous I/O rings.
+
+	@defgroup aio Asynchronous I/O.
+	@ingroup kernel
+	@brief Asynchronous I/O rings.
+
+	A process may register a pair of submission/completion queues
+	(see @ref AioSetup). Requests are first attempted inline, in non-blocking
+	mode. A request that would block is queued in the process's
+	_asynchronous I/O context_, and its stream is registered in a kernel event
+	set (see @ref poll). A kernel thread of the process, the _worker_, waits on
+	the event set and retries the queued requests of each stream that becomes
+	ready, posting their completions to the completion queue.
+
+	Therefore, a single worker can keep any number of requests in flight.
+
+	@{
+*/
+
+/** @brief Release the asynchronous I/O context of a process.
+
+	This is called when the last thread of a process exits, before the
+	process's streams are closed. Pending requests are dropped, and this 
+	returns after the worker thread has exited.
+
+	@param pcb the exiting process
+ */
+void aio_release(PCB* pcb);
+
+/** @} */
+
+#endif
@@ -70,6 +70,8 @@ void Mutex_Unlock(Mutex* lock)
 typedef struct __cv_waiter {
 	rlnode node;				/* become part of a ring */
 	TCB* thread;				/* thread to wait */
+	Mutex* mutex;				/* the mutex released while waiting */
+	TimerDuration timeout;		/* the timeout of the wait */
 	sig_atomic_t signalled;		/* this is set if the thread is signalled */
 	sig_atomic_t removed;		/* this is set if the waiter is removed 
 								   from the ring */
@@ -109,6 +111,7 @@ static inline void remove_from_ring(CondVar* cv, __cv_waiter* w)
   it first re-locks the mutex and then returns.  
 
   @param mx The mutex to be unlocked as the thread sleeps.
+  @param released Another mutex to be unlocked (but not re-locked), or NULL.
   @param cv The condition variable to sleep on.
   @param cause A cause provided to the kernel scheduler.
   @param timeout The time to sleep, or @c NO_TIMEOUT to sleep for ever.
@@ -118,10 +121,11 @@ static inline void remove_from_ring(CondVar* cv, __cv_waiter* w)
   @see Cond_Signal
   @see Cond_Broadcast
   */
-static int cv_wait(Mutex* mutex, CondVar* cv, 
+static int cv_wait_releasing(Mutex* mutex, Mutex* released, CondVar* cv, 
 		enum SCHED_CAUSE cause, TimerDuration timeout)
 {
-	__cv_waiter waiter = { .thread=cur_thread(), .signalled = 0, .removed=0 };
+	__cv_waiter waiter = { .thread=cur_thread(), .mutex=mutex, .timeout=timeout, 
+		.signalled = 0, .removed=0 };
 	rlnode_init(& waiter.node, &waiter);
 
 	Mutex_Lock(&(cv->waitset_lock));
@@ -135,6 +139,7 @@ static int cv_wait(Mutex* mutex, CondVar* cv,
 
 	/* Now atomically release mutex and sleep */
 	Mutex_Unlock(mutex);
+	if(released) Mutex_Unlock(released);
 	sleep_releasing(STOPPED, &(cv->waitset_lock), cause, timeout);
 
 	/* Woke up, we must check wether we were signaled, and tidy up */
@@ -151,6 +156,12 @@ static int cv_wait(Mutex* mutex, CondVar* cv,
 	return waiter.signalled;
 }
 
+static inline int cv_wait(Mutex* mutex, CondVar* cv, 
+		enum SCHED_CAUSE cause, TimerDuration timeout)
+{
+	return cv_wait_releasing(mutex, NULL, cv, cause, timeout);
+}
+
 
 /**
   @internal
@@ -252,12 +263,18 @@ void kernel_unlock()
 int kernel_wait_wchan(CondVar* cv, enum SCHED_CAUSE cause, 
 	const char* wchan_name, TimerDuration timeout)
 {
-	/* Atomically release kernel semaphore */
+	return kernel_wait_releasing(cv, NULL, cause, timeout);
+}
+
+int kernel_wait_releasing(CondVar* cv, Mutex* mx, enum SCHED_CAUSE cause, 
+	TimerDuration timeout)
+{
+	/* Atomically release kernel semaphore (and mx) */
 	Mutex_Lock(& kernel_mutex);
 	kernel_sem++;
 	Cond_Signal(&kernel_sem_cv);	
 
-	int ret = cv_wait(&kernel_mutex, cv, cause, timeout);
+	int ret = cv_wait_releasing(&kernel_mutex, mx, cv, cause, timeout);
 
 	/* Reacquire kernel semaphore */
 	while(kernel_sem<=0)
@@ -273,9 +290,65 @@ void kernel_signal(CondVar* cv)
 	Cond_Signal(cv); 
 }
 
+/*
+	Wait morphing.
+
+	A thread woken up by kernel_broadcast() must take the kernel lock before
+	it can proceed. Making all the waiters of a broadcast runnable would only 
+	have them contend for the kernel lock (a thundering herd). Instead, the 
+	waiters are moved to the queue of the kernel semaphore, @c kernel_sem_cv, 
+	as if they had already been woken up and found the kernel locked. 
+	They will then be woken up one at a time, as the kernel is unlocked.
+
+	Since the broadcaster holds the kernel lock, it will signal 
+	@c kernel_sem_cv when it unlocks it.
+
+	Only waiters that sleep without a timeout are moved, since a timeout 
+	wakes up a thread without removing it from its ring. The rest are woken 
+	up in batches.
+ */
+#define BROADCAST_BATCH 64
+
+static inline int cv_morphable(CondVar* cv, __cv_waiter* w)
+{
+	return cv != &kernel_sem_cv && w->mutex == &kernel_mutex && w->timeout == NO_TIMEOUT;
+}
+
 void kernel_broadcast(CondVar* cv) 
 { 
-	Cond_Broadcast(cv); 
+	TCB* batch[BROADCAST_BATCH];
+	__cv_waiter* waiters[BROADCAST_BATCH];
+
+	Mutex_Lock(&(cv->waitset_lock));
+	while(cv->waitset) {
+		unsigned int n = 0;
+		while(cv->waitset && n < BROADCAST_BATCH) {
+			__cv_waiter* w = cv->waitset;
+			remove_from_ring(cv, w);
+
+			if(cv_morphable(cv, w)) {
+				/* The waiter remains 'not removed', in its new ring */
+				Mutex_Lock(&kernel_sem_cv.waitset_lock);
+				if(kernel_sem_cv.waitset) {
+					__cv_waiter* wset = kernel_sem_cv.waitset;
+					rlist_push_back(& wset->node, & w->node);
+				} else {
+					kernel_sem_cv.waitset = w;
+				}
+				Mutex_Unlock(&kernel_sem_cv.waitset_lock);
+				continue;
+			}
+
+			w->removed = 1;
+			waiters[n] = w;
+			batch[n++] = w->thread;
+		}
+
+		wakeup_batch(batch, n);
+		for(unsigned int i=0; i<n; i++)
+			if(batch[i]) waiters[i]->signalled = 1;
+	}
+	Mutex_Unlock(&(cv->waitset_lock));
 }
 
 void kernel_sleep(Thread_state newstate, enum SCHED_CAUSE cause)
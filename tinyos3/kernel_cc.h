@@ -54,6 +54,19 @@ void kernel_unlock();
 int kernel_wait_wchan(CondVar* cv, enum SCHED_CAUSE cause, 
 	const char* wchan, TimerDuration timeout);
 
+/**
+	@brief Wait on a condition variable using the kernel lock, releasing a mutex.
+
+	The mutex @c mx is unlocked only after the thread has been queued on @c cv,
+	so that a signal sent while holding @c mx cannot be missed. This is for
+	conditions which are changed without the kernel lock (e.g., by interrupt 
+	handlers), under @c mx. On return, @c mx is not locked.
+
+	@returns 1 if signalled, 0 if not
+  */
+int kernel_wait_releasing(CondVar* cv, Mutex* mx, enum SCHED_CAUSE cause, 
+	TimerDuration timeout);
+
 #define kernel_wait(cv, cause) \
 	kernel_wait_wchan((cv),(cause),__FUNCTION__, NO_TIMEOUT)
 #define kernel_timedwait(cv, cause, timeout) \
@@ -68,6 +81,10 @@ void kernel_signal(CondVar* cv);
 
 /**
 	@brief Signal a kernel condition to all waiters.
+
+	This call must be made with the kernel locked. Waiters that do not have
+	a timeout are not made ready; instead, they are queued to take the kernel
+	lock, and are woken up one by one, as the kernel is unlocked.
   */
 void kernel_broadcast(CondVar* cv);
 
@@ -5,6 +5,7 @@
 #include "kernel_sched.h"
 #include "kernel_streams.h"
 #include "kernel_proc.h"
+#include "kernel_poll.h"
 
 /*************************************
 
@@ -51,7 +52,8 @@ static file_ops nulldev_fops = {
   .Open = nulldev_open,
   .Read = nulldev_read,
   .Write = nulldev_write,
-  .Close = nulldev_close
+  .Close = nulldev_close,
+  .kind = STREAM_NULL
 };
 
 
@@ -70,6 +72,8 @@ typedef struct serial_device_control_block {
   uint devno;
   Mutex spinlock;
   CondVar rx_ready;
+  int lookahead;        /* a byte read by serial_poll, or -1 */
+  rlnode watchers;      /* event sets watching the terminal */
 } serial_dcb_t;
 
 serial_dcb_t serial_dcb[MAX_TERMINALS];
@@ -91,6 +95,7 @@ void serial_rx_handler()
   for(int i=0;i<bios_serial_ports();i++) {
     serial_dcb_t* dcb = &serial_dcb[i];
     Cond_Broadcast(&dcb->rx_ready);
+    poll_notify(&dcb->watchers, EVENT_READ);
   }
   if(pre) preempt_on;
 }
@@ -105,6 +110,13 @@ int serial_read(void* dev, char *buf, unsigned int size)
   preempt_off;            /* Stop preemption */
 
   uint count =  0;
+  int wouldblock = 0;
+
+  /* First return the byte consumed by a poll */
+  if(size>0 && dcb->lookahead>=0) {
+    buf[count++] = (char) dcb->lookahead;
+    dcb->lookahead = -1;
+  }
 
   while(count<size) {
     int valid = bios_read_serial(dcb->devno, &buf[count]);
@@ -113,6 +125,10 @@ int serial_read(void* dev, char *buf, unsigned int size)
       count++;
     }
     else if(count==0) {
+      if(stream_nonblocking()) {
+        wouldblock = 1;
+        break;
+      }
       kernel_wait(&dcb->rx_ready, SCHED_IO);
     }
     else
@@ -121,7 +137,7 @@ int serial_read(void* dev, char *buf, unsigned int size)
 
   preempt_on;           /* Restart preemption */
 
-  return count;
+  return wouldblock ? WOULDBLOCK : count;
 }
 
 
@@ -152,6 +168,8 @@ int serial_write(void* dev, const char* buf, unsigned int size)
     } 
     else if(count==0)
     {
+      if(stream_nonblocking())
+        return WOULDBLOCK;
       yield(SCHED_IO);
     }
     else
@@ -162,6 +180,31 @@ int serial_write(void* dev, const char* buf, unsigned int size)
 }
 
 
+/*
+  The bios does not tell us if a byte is available without reading it,
+  so a poll reads one byte ahead and keeps it for the next read.
+ */
+unsigned int serial_poll(void* dev, rlnode** wq)
+{
+  serial_dcb_t* dcb = (serial_dcb_t*)dev;
+  if(wq) *wq = &dcb->watchers;
+
+  unsigned int events = EVENT_WRITE;
+
+  int pre = preempt_off;
+  if(dcb->lookahead < 0) {
+    char c;
+    if(bios_read_serial(dcb->devno, &c))
+      dcb->lookahead = (unsigned char) c;
+  }
+  if(dcb->lookahead >= 0)
+    events |= EVENT_READ;
+  if(pre) preempt_on;
+
+  return events;
+}
+
+
 int serial_close(void* dev) 
 {
   return 0;
@@ -180,7 +223,9 @@ file_ops serial_fops = {
   .Open = serial_open,
   .Read = serial_read,
   .Write = serial_write,
-  .Close = serial_close
+  .Close = serial_close,
+  .Poll = serial_poll,
+  .kind = STREAM_TERMINAL
 };
 
 
@@ -211,6 +256,8 @@ void initialize_devices()
     serial_dcb[i].devno = i;
     serial_dcb[i].rx_ready = COND_INIT;
     serial_dcb[i].spinlock = MUTEX_INIT;
+    serial_dcb[i].lookahead = -1;
+    rlnode_init(&serial_dcb[i].watchers, NULL);
   }
 
   cpu_interrupt_handler(SERIAL_RX_READY, serial_rx_handler);
@@ -8,6 +8,7 @@
  *****************************/ 
 
 #include "util.h"
+#include "tinyos.h"
 #include "bios.h"
 
 /**
@@ -92,6 +93,22 @@ typedef struct file_operations {
     - There was a I/O runtime problem.
      */
     int (*Close)(void* this);
+
+    /** @brief Readiness operation.
+
+      Return the events (@c EVENT_READ, @c EVENT_WRITE, @c EVENT_HANGUP) that 
+      are currently ready on stream 'this', i.e., the operations that would 
+      not block. If 'wq' is not NULL, it receives the watch list of the
+      stream, on which readiness changes are posted by @c poll_notify,
+      or NULL if the stream does not post them.
+
+      This method may be NULL, for streams that never block.
+      @see kernel_poll.h
+     */
+    unsigned int (*Poll)(void* this, rlnode** wq);
+
+    /** @brief The kind of stream, used for accounting. */
+    stream_kind kind;
 } file_ops;
 
 
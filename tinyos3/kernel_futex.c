@@ -0,0 +1,123 @@
+
+#include <stdint.h>
+#include "tinyos.h"
+#include "kernel_cc.h"
+#include "kernel_sched.h"
+
+
+/*
+    Futexes. Threads wait on the address of an int, in a hashed table of
+    wait queues. Each bucket keeps its waiters in arrival order.
+
+    The table is protected by the kernel lock. Since FutexWait checks the
+    value of the int with the kernel locked, a FutexWake that follows a
+    change of the value (in user space) cannot be missed.
+ */
+#define FUTEX_HASH_SIZE 256
+
+typedef struct futex_waiter {
+    int* addr;
+    int woken;
+    CondVar cv;
+    struct futex_waiter* next;      // in the bucket
+} futex_waiter;
+
+typedef struct futex_bucket {
+    futex_waiter* head;
+    futex_waiter* tail;
+} futex_bucket;
+
+static futex_bucket FUTEX_TABLE[FUTEX_HASH_SIZE];
+
+
+static inline futex_bucket* futex_bucket_of(int* addr)
+{
+    uintptr_t key = (uintptr_t)addr >> 2;
+    return &FUTEX_TABLE[(key * 2654435761u) % FUTEX_HASH_SIZE];
+}
+
+static void futex_enqueue(futex_bucket* b, futex_waiter* w)
+{
+    w->next = NULL;
+    if (b->tail)
+        b->tail->next = w;
+    else
+        b->head = w;
+    b->tail = w;
+}
+
+/* Unlink the waiter after prev (or the head, if prev is NULL) */
+static void futex_unlink(futex_bucket* b, futex_waiter* prev, futex_waiter* w)
+{
+    if (prev)
+        prev->next = w->next;
+    else
+        b->head = w->next;
+    if (b->tail == w)
+        b->tail = prev;
+}
+
+static void futex_remove(futex_bucket* b, futex_waiter* w)
+{
+    futex_waiter* prev = NULL;
+    for (futex_waiter* p = b->head; p != NULL; prev = p, p = p->next)
+        if (p == w) {
+            futex_unlink(b, prev, w);
+            return;
+        }
+}
+
+
+int sys_FutexWait(int* addr, int expected, timeout_t timeout)
+{
+    if (addr == NULL || ((uintptr_t)addr & (sizeof(int) - 1)))
+        return -1;
+
+    if (__atomic_load_n(addr, __ATOMIC_SEQ_CST) != expected)
+        return 0;
+
+    futex_bucket* b = futex_bucket_of(addr);
+    futex_waiter w = { .addr = addr, .woken = 0, .cv = COND_INIT };
+    futex_enqueue(b, &w);
+
+    if (timeout == TIMEOUT_INFINITE) {
+        while (!w.woken)
+            kernel_wait(&w.cv, SCHED_USER);
+    } else {
+        TimerDuration deadline = bios_clock() + timeout*1000ul;
+        TimerDuration now;
+        while (!w.woken && (now = bios_clock()) < deadline)
+            kernel_timedwait(&w.cv, SCHED_USER, deadline - now);
+        if (!w.woken)
+            futex_remove(b, &w);
+    }
+
+    return w.woken;
+}
+
+
+int sys_FutexWake(int* addr, unsigned int n)
+{
+    if (addr == NULL)
+        return -1;
+
+    futex_bucket* b = futex_bucket_of(addr);
+    futex_waiter* prev = NULL;
+    futex_waiter* w = b->head;
+    int count = 0;
+
+    while (w != NULL && count < n) {
+        futex_waiter* next = w->next;
+        if (w->addr == addr) {
+            futex_unlink(b, prev, w);
+            w->woken = 1;
+            kernel_signal(&w->cv);
+            count++;
+        } else {
+            prev = w;
+        }
+        w = next;
+    }
+
+    return count;
+}
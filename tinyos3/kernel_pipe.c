@@ -4,17 +4,44 @@
 #include "kernel_cc.h"
 #include "kernel_proc.h"
 #include "kernel_pipe.h"
+#include "kernel_poll.h"
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 
 
+/*
+    Pipes are large, because of their buffer. Released pipes are kept in a
+    pool, up to PIPE_POOL_MAX, to be reused by pipe_alloc. The pool is
+    protected by the kernel lock.
+ */
+#define PIPE_POOL_MAX 64
+
+static pipe_cb* pipe_pool[PIPE_POOL_MAX];
+static unsigned int pipe_pool_size = 0;
+
+pipe_cb* pipe_alloc()
+{
+    return (pipe_pool_size > 0) ? pipe_pool[--pipe_pool_size]
+                                : (pipe_cb*)xmalloc(sizeof(pipe_cb));
+}
+
+void pipe_free(pipe_cb* pipe)
+{
+    if (pipe_pool_size < PIPE_POOL_MAX)
+        pipe_pool[pipe_pool_size++] = pipe;
+    else
+        free(pipe);
+}
+
+
 pipe_cb* pipe_create() //Sockets
 {
-    pipe_cb* pipe = (pipe_cb*)xmalloc(sizeof(pipe_cb));
-    if (pipe == NULL) return NULL;
+    return pipe_init(pipe_alloc());
+}
 
-    memset(pipe, 0, sizeof(pipe_cb));
+pipe_cb* pipe_init(pipe_cb* pipe)
+{
     pipe->w_position = 0;
     pipe->r_position = 0;
     pipe->count = 0;
@@ -23,24 +50,126 @@ pipe_cb* pipe_create() //Sockets
     
     
     pipe->refcount = 0; 
+    pipe->message_mode = 0;
     
     pipe->has_data = COND_INIT;
     pipe->has_space = COND_INIT;
+
+    rlnode_init(&pipe->watchers, NULL);
+    pipe->reader_watchers = &pipe->watchers;
+    pipe->writer_watchers = &pipe->watchers;
+
+    memset(&pipe->stats, 0, sizeof(pipe_stats));
     
     return pipe;
 }
 
 
+/*
+    Message mode. Each message is stored in the buffer as an unsigned int
+    length, followed by the message bytes.
+ */
+
+typedef unsigned int msg_header;
+
+/* Copy bytes in and out of the circular buffer. A NULL buf skips bytes. */
+static void pipe_put(pipe_cb* pipe, const char* buf, unsigned int n)
+{
+    unsigned int first = PIPE_BUFFER_SIZE - pipe->w_position;
+    if (first > n) first = n;
+    memcpy(pipe->buffer + pipe->w_position, buf, first);
+    memcpy(pipe->buffer, buf + first, n - first);
+    pipe->w_position = (pipe->w_position + n) % PIPE_BUFFER_SIZE;
+    pipe->count += n;
+    if (pipe->count > pipe->stats.peak_count)
+        pipe->stats.peak_count = pipe->count;
+}
+
+static void pipe_get(pipe_cb* pipe, char* buf, unsigned int n)
+{
+    unsigned int first = PIPE_BUFFER_SIZE - pipe->r_position;
+    if (first > n) first = n;
+    if (buf) {
+        memcpy(buf, pipe->buffer + pipe->r_position, first);
+        memcpy(buf + first, pipe->buffer, n - first);
+    }
+    pipe->r_position = (pipe->r_position + n) % PIPE_BUFFER_SIZE;
+    pipe->count -= n;
+}
+
+
+static int pipe_read_message(pipe_cb* pipe, char* buf, unsigned int size)
+{
+    while (pipe->count == 0) {
+        if (pipe->write_closed)
+            return 0;
+        if (stream_nonblocking())
+            return WOULDBLOCK;
+        pipe->stats.read_waits++;
+        kernel_wait(&pipe->has_data, SCHED_PIPE);
+    }
+
+    msg_header len;
+    pipe_get(pipe, (char*)&len, sizeof(len));
+
+    /* Truncate the message to the buffer */
+    unsigned int n = (len < size) ? len : size;
+    pipe_get(pipe, buf, n);
+    pipe_get(pipe, NULL, len - n);
+    pipe->stats.bytes_read += n;
+
+    kernel_broadcast(&pipe->has_space);
+    poll_notify(pipe->writer_watchers, EVENT_WRITE);
+    return n;
+}
+
+
+static int pipe_write_message(pipe_cb* pipe, const char* buf, unsigned int size)
+{
+    if (size > MAX_MESSAGE_SIZE)
+        return -1;
+    if (size == 0)
+        return 0;
+
+    /* The message is written as a whole */
+    msg_header len = size;
+    while (PIPE_BUFFER_SIZE - pipe->count < sizeof(len) + size) {
+        if (pipe->read_closed)
+            return -1;
+        if (stream_nonblocking())
+            return WOULDBLOCK;
+        pipe->stats.write_waits++;
+        kernel_wait(&pipe->has_space, SCHED_PIPE);
+    }
+    if (pipe->read_closed)
+        return -1;
+
+    pipe_put(pipe, (const char*)&len, sizeof(len));
+    pipe_put(pipe, buf, size);
+    pipe->stats.bytes_written += size;
+
+    kernel_broadcast(&pipe->has_data);
+    poll_notify(pipe->reader_watchers, EVENT_READ);
+    return size;
+}
+
+
 int pipe_read (pipe_cb* pipe, char* buf, unsigned int size)
 {
     unsigned int bytes_read = 0;
 
+    if (pipe->message_mode)
+        return pipe_read_message(pipe, buf, size);
     
     while (pipe->count == 0) {
         if (pipe->write_closed) {
             return 0; //EOF
         }
+        if (stream_nonblocking()) {
+            return WOULDBLOCK;
+        }
        
+        pipe->stats.read_waits++;
         kernel_wait(&pipe->has_data, SCHED_PIPE);
     }
 
@@ -50,9 +179,11 @@ int pipe_read (pipe_cb* pipe, char* buf, unsigned int size)
         pipe->r_position = (pipe->r_position + 1) % PIPE_BUFFER_SIZE;// otan %  0 gurizei sthn arxh 
         pipe->count--;
     }
+    pipe->stats.bytes_read += bytes_read;
 
     // jipname ta pcb 
     kernel_broadcast(&pipe->has_space);
+    poll_notify(pipe->writer_watchers, EVENT_WRITE);
 
     return bytes_read;
 }
@@ -62,6 +193,8 @@ int pipe_write(pipe_cb* pipe, const char* buf, unsigned int size)
 {
     unsigned int bytes_written = 0;
 
+    if (pipe->message_mode)
+        return pipe_write_message(pipe, buf, size);
     
     if (pipe->read_closed) {
         return -1; 
@@ -73,17 +206,26 @@ int pipe_write(pipe_cb* pipe, const char* buf, unsigned int size)
             if (pipe->read_closed) {
                 return -1;
             }
+            if (stream_nonblocking()) {
+                return (bytes_written > 0) ? (int)bytes_written : WOULDBLOCK;
+            }
+            poll_notify(pipe->reader_watchers, EVENT_READ);
+            pipe->stats.write_waits++;
             kernel_wait(&pipe->has_space, SCHED_PIPE);
         }
 
         pipe->buffer[pipe->w_position] = buf[bytes_written++];
         pipe->w_position = (pipe->w_position + 1) % PIPE_BUFFER_SIZE;
         pipe->count++;
+        pipe->stats.bytes_written++;
+        if (pipe->count > pipe->stats.peak_count)
+            pipe->stats.peak_count = pipe->count;
 
         
         kernel_broadcast(&pipe->has_data);
     }
 
+    poll_notify(pipe->reader_watchers, EVENT_READ);
     return bytes_written;
 }
 
@@ -94,22 +236,54 @@ int pipe_close (pipe_cb* pipe, int is_writer) // instead of 2 pipe close writer/
         pipe->write_closed = 1;
         
         kernel_broadcast(&pipe->has_data);
+        poll_notify(pipe->reader_watchers, EVENT_READ | EVENT_HANGUP);
+        pipe->writer_watchers = NULL;
     } else {
         pipe->read_closed = 1;
         
         kernel_broadcast(&pipe->has_space);
+        poll_notify(pipe->writer_watchers, EVENT_WRITE | EVENT_HANGUP);
+        pipe->reader_watchers = NULL;
     }
 
     pipe->refcount--;
     
     if (pipe->refcount == 0) {
-        free(pipe);
+        pipe_free(pipe);
     }
     return 0;
 }
 
 
 
+unsigned int pipe_poll_read(pipe_cb* pipe)
+{
+    if (pipe->write_closed)
+        return EVENT_READ | EVENT_HANGUP;   // EOF does not block
+    return (pipe->count > 0) ? EVENT_READ : 0;
+}
+
+unsigned int pipe_poll_write(pipe_cb* pipe)
+{
+    if (pipe->read_closed)
+        return EVENT_WRITE | EVENT_HANGUP;  // the error does not block
+    if (pipe->message_mode)             // any message must fit
+        return (PIPE_BUFFER_SIZE - pipe->count >= sizeof(msg_header) + MAX_MESSAGE_SIZE) ? EVENT_WRITE : 0;
+    return (pipe->count < PIPE_BUFFER_SIZE) ? EVENT_WRITE : 0;
+}
+
+
+static unsigned int pipe_reader_poll(void* fd, rlnode** wq) {
+    pipe_cb* pipe = (pipe_cb*)fd;
+    if (wq) *wq = pipe->reader_watchers;
+    return pipe_poll_read(pipe);
+}
+
+static unsigned int pipe_writer_poll(void* fd, rlnode** wq) {
+    pipe_cb* pipe = (pipe_cb*)fd;
+    if (wq) *wq = pipe->writer_watchers;
+    return pipe_poll_write(pipe);
+}
 
 static int pipe_reader_close(void* fd) {
     return pipe_close((pipe_cb*)fd, 0); // 0 = reader
@@ -123,23 +297,35 @@ static file_ops pipe_read_ops = {
     .Read = pipe_read,
     .Write = NULL,
     .Close = pipe_reader_close,
-    .Open = NULL
+    .Open = NULL,
+    .Poll = pipe_reader_poll,
+    .kind = STREAM_PIPE
 };
 
 static file_ops pipe_write_ops = {
     .Read = NULL,
     .Write = pipe_write,
     .Close = pipe_writer_close,
-    .Open = NULL
+    .Open = NULL,
+    .Poll = pipe_writer_poll,
+    .kind = STREAM_PIPE
 };
 
 
 int sys_Pipe(pipe_t* pipe)
+{
+    return sys_Pipe2(pipe, 0);
+}
+
+
+int sys_Pipe2(pipe_t* pipe, int flags)
 {
     Fid_t fids[2];
     FCB* fcbs[2];
     pipe_cb* new_pipe;
 
+    if (flags & ~FID_NONBLOCK)
+        return -1;
     
     if (FCB_reserve(2, fids, fcbs) == 0) {
         return -1;
@@ -157,10 +343,12 @@ int sys_Pipe(pipe_t* pipe)
     
     fcbs[0]->streamobj = new_pipe;
     fcbs[0]->streamfunc = &pipe_read_ops;
+    fcbs[0]->flags = flags;
 
     
     fcbs[1]->streamobj = new_pipe;
     fcbs[1]->streamfunc = &pipe_write_ops;
+    fcbs[1]->flags = flags;
 
     pipe->read = fids[0];
     pipe->write = fids[1];
@@ -6,6 +6,15 @@
 
 #define PIPE_BUFFER_SIZE 8192
 
+/* Counters of a pipe, for telemetry */
+typedef struct pipe_stats {
+    unsigned long bytes_written;
+    unsigned long bytes_read;
+    unsigned int write_waits;   // the writer blocked on a full buffer
+    unsigned int read_waits;    // the reader blocked on an empty buffer
+    unsigned int peak_count;    // the highest occupancy of the buffer
+} pipe_stats;
+
 typedef struct pipe_control_block {
     CondVar has_space;      // Block writer if no space  
     CondVar has_data;       // Block reader if no data 
@@ -20,14 +29,32 @@ typedef struct pipe_control_block {
     int read_closed;        //if = 1 reader is closed 
     
     int refcount;           
+    int message_mode;       // the buffer holds length-prefixed messages
+
+    rlnode watchers;            // event sets watching the ends of a plain pipe 
+    rlnode* reader_watchers;    // notified when data arrives, NULL if reader closed
+    rlnode* writer_watchers;    // notified when space frees, NULL if writer closed
+
+    pipe_stats stats;
 } pipe_cb;
 
 
 pipe_cb* pipe_create();
 
+/* Allocate (pipe_alloc) and initialize (pipe_init) a pipe separately, 
+   e.g., to set memory aside for pipes created later. Memory that was 
+   never initialized, or a pipe that was never used, goes to pipe_free. */
+pipe_cb* pipe_alloc();
+pipe_cb* pipe_init(pipe_cb* pipe);
+void pipe_free(pipe_cb* pipe);
+
 
 int pipe_read(pipe_cb* pipe, char* buf, unsigned int size);
 int pipe_write(pipe_cb* pipe, const char* buf, unsigned int size);
 int pipe_close(pipe_cb* pipe, int is_writer);
 
+/* Readiness of the two ends, for Poll methods */
+unsigned int pipe_poll_read(pipe_cb* pipe);
+unsigned int pipe_poll_write(pipe_cb* pipe);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,349 @@
+
+#include "tinyos.h"
+#include "kernel_cc.h"
+#include "kernel_streams.h"
+#include "kernel_poll.h"
+#include <stdlib.h>
+#include <assert.h>
+
+
+/*
+	Event sets
+	----------
+
+	An event set is a stream, much like the info stream, on which the
+	EventSetCtl and EventSetWait system calls operate.
+
+	Each (event set, stream) pair is a registration, which is linked into
+	four lists:
+	- the list of registrations of its event set (set_node)
+	- the list of registrations of its stream FCB (fcb_node)
+	- the watch list of the stream object, if any (watch_node)
+	- the ready list of its event set, while it has pending events (ready_node)
+ */
+
+typedef struct event_registration {
+    eventset_cb* set;
+    FCB* fcb;
+    Fid_t fid;
+    unsigned int events;
+
+    rlnode set_node;
+    rlnode fcb_node;
+    rlnode watch_node;
+    rlnode ready_node;
+} event_reg;
+
+
+struct event_set_control_block {
+    rlnode regs;            // all registrations
+    rlnode ready;           // registrations with (possibly) pending events
+    CondVar ready_cv;       // waiters of EventSetWait
+    int closed;
+    int refcount;           // the owner plus the threads in EventSetWait
+};
+
+
+/* Protects watch lists and ready lists. Always taken with preemption off. */
+static Mutex poll_lock = MUTEX_INIT;
+
+
+unsigned int stream_poll(FCB* fcb, rlnode** wq)
+{
+    if (fcb->streamfunc->Poll)
+        return fcb->streamfunc->Poll(fcb->streamobj, wq);
+
+    if (wq) *wq = NULL;
+    return EVENT_READ | EVENT_WRITE;
+}
+
+
+/* Queue a registration on its ready list. Called with poll_lock held. */
+static void reg_queue(event_reg* reg)
+{
+    if (is_rlist_empty(&reg->ready_node)) {
+        rlist_push_back(&reg->set->ready, &reg->ready_node);
+        Cond_Signal(&reg->set->ready_cv);
+    }
+}
+
+/* Unlink a registration from all lists. Called with poll_lock held. */
+static void reg_unlink(event_reg* reg)
+{
+    rlist_remove(&reg->set_node);
+    rlist_remove(&reg->fcb_node);
+    rlist_remove(&reg->watch_node);
+    rlist_remove(&reg->ready_node);
+}
+
+
+void poll_notify(rlnode* wq, unsigned int events)
+{
+    if (wq == NULL || is_rlist_empty(wq))
+        return;
+
+    int preempt = preempt_off;
+    Mutex_Lock(&poll_lock);
+
+    for (rlnode* n = wq->next; n != wq; n = n->next) {
+        event_reg* reg = n->obj;
+        if ((reg->events & events) || (events & EVENT_HANGUP))
+            reg_queue(reg);
+    }
+
+    Mutex_Unlock(&poll_lock);
+    if (preempt) preempt_on;
+}
+
+
+void poll_detach(FCB* fcb)
+{
+    if (is_rlist_empty(&fcb->event_regs))
+        return;
+
+    int preempt = preempt_off;
+    Mutex_Lock(&poll_lock);
+
+    while (!is_rlist_empty(&fcb->event_regs)) {
+        event_reg* reg = fcb->event_regs.next->obj;
+        reg_unlink(reg);
+        free(reg);
+    }
+
+    Mutex_Unlock(&poll_lock);
+    if (preempt) preempt_on;
+}
+
+
+
+eventset_cb* eventset_create()
+{
+    eventset_cb* set = (eventset_cb*)xmalloc(sizeof(eventset_cb));
+    rlnode_init(&set->regs, NULL);
+    rlnode_init(&set->ready, NULL);
+    set->ready_cv = COND_INIT;
+    set->closed = 0;
+    set->refcount = 1;
+    return set;
+}
+
+
+void eventset_destroy(eventset_cb* set)
+{
+    int preempt = preempt_off;
+    Mutex_Lock(&poll_lock);
+
+    while (!is_rlist_empty(&set->regs)) {
+        event_reg* reg = set->regs.next->obj;
+        reg_unlink(reg);
+        free(reg);
+    }
+
+    Mutex_Unlock(&poll_lock);
+    if (preempt) preempt_on;
+
+    /* Release the waiters */
+    set->closed = 1;
+    kernel_broadcast(&set->ready_cv);
+
+    set->refcount--;
+    if (set->refcount == 0)
+        free(set);
+}
+
+
+static int eventset_close(void* obj)
+{
+    eventset_destroy((eventset_cb*)obj);
+    return 0;
+}
+
+static file_ops eventset_ops = {
+    .Open = NULL,
+    .Read = NULL,
+    .Write = NULL,
+    .Close = eventset_close,
+    .kind = STREAM_EVENTSET
+};
+
+
+Fid_t sys_OpenEventSet()
+{
+    Fid_t fid;
+    FCB* fcb;
+
+    if (FCB_reserve(1, &fid, &fcb) == 0)
+        return NOFILE;
+
+    fcb->streamobj = eventset_create();
+    fcb->streamfunc = &eventset_ops;
+    return fid;
+}
+
+
+static eventset_cb* get_eventset(Fid_t efd)
+{
+    FCB* fcb = get_fcb(efd);
+    if (fcb == NULL || fcb->streamfunc != &eventset_ops)
+        return NULL;
+    return (eventset_cb*)fcb->streamobj;
+}
+
+static event_reg* find_reg(eventset_cb* set, FCB* fcb)
+{
+    for (rlnode* n = set->regs.next; n != &set->regs; n = n->next) {
+        event_reg* reg = n->obj;
+        if (reg->fcb == fcb)
+            return reg;
+    }
+    return NULL;
+}
+
+
+int eventset_ctl(eventset_cb* set, eventset_op op, FCB* fcb, Fid_t fid, unsigned int events)
+{
+    event_reg* reg = find_reg(set, fcb);
+    int ret = 0;
+
+    int preempt = preempt_off;
+    Mutex_Lock(&poll_lock);
+
+    switch (op) {
+    case EVENTSET_ADD:
+        if (reg != NULL) { ret = -1; break; }
+
+        reg = (event_reg*)xmalloc(sizeof(event_reg));
+        reg->set = set;
+        reg->fcb = fcb;
+        reg->fid = fid;
+        reg->events = events;
+        rlnode_init(&reg->set_node, reg);
+        rlnode_init(&reg->fcb_node, reg);
+        rlnode_init(&reg->watch_node, reg);
+        rlnode_init(&reg->ready_node, reg);
+
+        rlnode* wq;
+        unsigned int ready = stream_poll(fcb, &wq);
+        rlist_push_back(&set->regs, &reg->set_node);
+        rlist_push_back(&fcb->event_regs, &reg->fcb_node);
+        if (wq) rlist_push_back(wq, &reg->watch_node);
+
+        if (ready & (events | EVENT_HANGUP))
+            reg_queue(reg);
+        break;
+
+    case EVENTSET_MOD:
+        if (reg == NULL) { ret = -1; break; }
+        reg->events = events;
+        if (stream_poll(fcb, NULL) & (events | EVENT_HANGUP))
+            reg_queue(reg);
+        break;
+
+    case EVENTSET_DEL:
+        if (reg == NULL) { ret = -1; break; }
+        reg_unlink(reg);
+        free(reg);
+        break;
+
+    default:
+        ret = -1;
+    }
+
+    Mutex_Unlock(&poll_lock);
+    if (preempt) preempt_on;
+
+    return ret;
+}
+
+
+int sys_EventSetCtl(Fid_t efd, eventset_op op, Fid_t fid, unsigned int events)
+{
+    eventset_cb* set = get_eventset(efd);
+    FCB* fcb = get_fcb(fid);
+
+    if (set == NULL || fcb == NULL || fcb->streamfunc == &eventset_ops)
+        return -1;
+    if (events & ~(EVENT_READ | EVENT_WRITE | EVENT_EDGE))
+        return -1;
+
+    return eventset_ctl(set, op, fcb, fid, events);
+}
+
+
+/*
+    Report up to n ready registrations. Each one is polled again, since
+    its readiness may have been consumed since it was queued. Level-triggered
+    registrations that are still ready are kept on the ready list, behind
+    those that were not examined. Called with poll_lock held.
+ */
+static int eventset_collect(eventset_cb* set, fid_event* events, FCB** fcbs, unsigned int n)
+{
+    unsigned int count = 0;
+    rlnode again;
+    rlnode_init(&again, NULL);
+
+    while (count < n && !is_rlist_empty(&set->ready)) {
+        event_reg* reg = rlist_pop_front(&set->ready)->obj;
+        unsigned int mask = stream_poll(reg->fcb, NULL)
+            & (reg->events | EVENT_HANGUP) & ~EVENT_EDGE;
+        if (mask) {
+            events[count].fid = reg->fid;
+            events[count].events = mask;
+            if (fcbs) fcbs[count] = reg->fcb;
+            count++;
+            if (!(reg->events & EVENT_EDGE))
+                rlist_push_back(&again, &reg->ready_node);
+        }
+    }
+    rlist_append(&set->ready, &again);
+    return count;
+}
+
+
+int eventset_wait(eventset_cb* set, fid_event* events, FCB** fcbs, unsigned int n, timeout_t timeout)
+{
+    TimerDuration deadline = bios_clock() + timeout*1000ul;
+    int count;
+
+    set->refcount++;
+
+    /* 
+        Registrations are queued by poll_notify, possibly from an interrupt
+        handler, without the kernel lock. Hence, the ready list is checked
+        and we sleep on ready_cv without releasing poll_lock in between.
+     */
+    int preempt = preempt_off;
+    Mutex_Lock(&poll_lock);
+    while ((count = eventset_collect(set, events, fcbs, n)) == 0) {
+        if (set->closed) {
+            count = -1;
+            break;
+        }
+        TimerDuration wait = NO_TIMEOUT;
+        if (timeout != TIMEOUT_INFINITE) {
+            TimerDuration now = bios_clock();
+            if (now >= deadline) break;
+            wait = deadline - now;
+        }
+        kernel_wait_releasing(&set->ready_cv, &poll_lock, SCHED_PIPE, wait);
+        Mutex_Lock(&poll_lock);
+    }
+    Mutex_Unlock(&poll_lock);
+    if (preempt) preempt_on;
+
+    set->refcount--;
+
+    if (set->refcount == 0)
+        free(set);
+    return count;
+}
+
+
+int sys_EventSetWait(Fid_t efd, fid_event* events, unsigned int n, timeout_t timeout)
+{
+    eventset_cb* set = get_eventset(efd);
+    if (set == NULL || events == NULL || n == 0)
+        return -1;
+
+    return eventset_wait(set, events, NULL, n, timeout);
+}
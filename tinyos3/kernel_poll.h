@@ -0,0 +1,101 @@
+#ifndef __KERNEL_POLL_H
+#define __KERNEL_POLL_H
+
+#include "tinyos.h"
+#include "kernel_streams.h"
+
+/**
+	@file kernel_poll.h
+	@brief Readiness notification and event sets.
+
+	@defgroup poll Readiness.
+	@ingroup kernel
+	@brief Readiness notification and event sets.
+
+	A stream that can block exports a @c Poll method in its @c file_ops
+	(see @ref file_ops). The method returns the events that are currently
+	ready on the stream and the stream's _watch list_.
+
+	Event sets link a registration into the watch list of each stream they
+	monitor. When the state of a stream changes (e.g., data arrives at a pipe),
+	the driver posts the change by calling @ref poll_notify on its watch list.
+	Each interested registration is then queued on the ready list of its
+	event set, in O(1), and waiters of the event set are woken up.
+
+	Watch lists and ready lists are protected by a spinlock, which is taken
+	with preemption off, so that interrupt handlers (e.g., the serial driver)
+	can post readiness as well.
+
+	@{
+*/
+
+
+/** @brief Query the readiness of a stream.
+
+	A stream without a @c Poll method never blocks, so it is always
+	ready for reading and writing.
+
+	@param fcb the stream
+	@param wq if not NULL, receives the watch list of the stream, or NULL if
+	   the stream does not post readiness changes
+	@returns the mask of ready events
+ */
+unsigned int stream_poll(FCB* fcb, rlnode** wq);
+
+
+/** @brief Post a readiness edge to the watchers of a stream.
+
+	Every event set registration in the watch list @c wq that is interested
+	in some of the @c events, is queued on its event set's ready list.
+	It is legal to pass a NULL watch list.
+
+	@param wq the watch list of the stream
+	@param events the events that (may) have become ready
+ */
+void poll_notify(rlnode* wq, unsigned int events);
+
+
+/** @brief Remove a stream from all event sets.
+
+	This is called when the last reference to an FCB is dropped, just before
+	the stream is closed.
+
+	@param fcb the stream being closed
+ */
+void poll_detach(FCB* fcb);
+
+
+/** @brief An event set. 
+
+	Besides being the stream object behind @ref OpenEventSet, event sets 
+	are used inside the kernel to wait for streams, e.g., by asynchronous I/O.
+*/
+typedef struct event_set_control_block eventset_cb;
+
+/** @brief Create a new, empty event set. */
+eventset_cb* eventset_create();
+
+/** @brief Release an event set.
+
+	All registrations are removed and all waiters return -1. 
+	The set is freed when the last waiter leaves.
+*/
+void eventset_destroy(eventset_cb* set);
+
+/** @brief Add, modify or delete the registration of a stream.
+
+	This is @ref EventSetCtl on the stream's FCB. The @c fid is only
+	reported back by @ref eventset_wait; it need not be valid. 
+*/
+int eventset_ctl(eventset_cb* set, eventset_op op, FCB* fcb, Fid_t fid, unsigned int events);
+
+/** @brief Wait for ready streams.
+
+	This is @ref EventSetWait. If @c fcbs is not NULL, it receives the 
+	FCB of each reported event.
+*/
+int eventset_wait(eventset_cb* set, fid_event* events, FCB** fcbs, unsigned int n, timeout_t timeout);
+
+/** @} */
+
+#endif
@@ -5,6 +5,7 @@
 #include "kernel_streams.h"
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 
 void thread_terminate(int exitval);
 
@@ -19,18 +20,38 @@ void sys_ThreadExit(int exitval);
 
  */
 
-/* The process table */
-PCB PT[MAX_PROC];
+/* 
+  The process table.
+
+  The table is allocated lazily, in chunks of PT_CHUNK_SIZE PCBs, as
+  processes are created. PIDs are handed out in order until a PID is
+  released; released PCBs are reused first. 
+ */
+#define PT_CHUNK_SIZE 256
+#define PT_CHUNKS (MAX_PROC / PT_CHUNK_SIZE)
+
+static PCB* PT[PT_CHUNKS];
+static Pid_t pt_next;           /* The lowest PID never used */
+
+/* A bitmap of the used (alive or zombie) PIDs */
+static uint64_t pt_live[MAX_PROC / 64];
 unsigned int process_count;
 
+static inline PCB* pt_entry(Pid_t pid)
+{
+  return &PT[pid / PT_CHUNK_SIZE][pid % PT_CHUNK_SIZE];
+}
+
 PCB* get_pcb(Pid_t pid)
 {
-  return PT[pid].pstate==FREE ? NULL : &PT[pid];
+  if(pid < 0 || pid >= pt_next) return NULL;
+  PCB* pcb = pt_entry(pid);
+  return pcb->pstate==FREE ? NULL : pcb;
 }
 
 Pid_t get_pid(PCB* pcb)
 {
-  return pcb==NULL ? NOPROC : pcb-PT;
+  return pcb==NULL ? NOPROC : pcb->pid;
 }
 
 /* Initialize a PCB */
@@ -40,39 +61,53 @@ static inline void initialize_PCB(PCB* pcb)
   pcb->argl = 0;
   pcb->args = NULL;
 
-  for(int i=0;i<MAX_FILEID;i++)
-    pcb->FIDT[i] = NULL;
+  fidt_init(pcb);
 
   rlnode_init(& pcb->children_list, NULL);
   rlnode_init(& pcb->exited_list, NULL);
   rlnode_init(& pcb->children_node, pcb);
   rlnode_init(& pcb->exited_node, pcb);
   pcb->child_exit = COND_INIT;
+  pcb->wait_chan = COND_INIT;
 
 
   //
   rlnode_init(&pcb->ptcb_list , NULL);
   pcb->thread_count= 0 ; 
+  pcb->handles = NULL;
+  pcb->handles_size = 0;
+  pcb->handles_free = -1;
+  pcb->aio = NULL;
 }
 
 
+/*
+  Free PCBs.
+
+  Each core keeps a small cache of released PCBs, so that a core which 
+  creates and reaps processes reuses the same (cache-warm) PCBs. The rest
+  are kept in a global free list, linked by their parent field. Both are
+  protected by the kernel lock.
+ */
+#define PID_CACHE_SIZE 16
+
 static PCB* pcb_freelist;
+static PCB* pid_cache[MAX_CORES][PID_CACHE_SIZE];
+static unsigned int pid_cache_size[MAX_CORES];
 
 void initialize_processes()
 {
-  /* initialize the PCBs */
-  for(Pid_t p=0; p<MAX_PROC; p++) {
-    initialize_PCB(&PT[p]);
+  /* Drop the table of a previous boot */
+  for(unsigned int c=0; c<PT_CHUNKS; c++) {
+    free(PT[c]);
+    PT[c] = NULL;
   }
+  pt_next = 0;
+  memset(pt_live, 0, sizeof(pt_live));
 
-  /* use the parent field to build a free list */
-  PCB* pcbiter;
   pcb_freelist = NULL;
-  for(pcbiter = PT+MAX_PROC; pcbiter!=PT; ) {
-    --pcbiter;
-    pcbiter->parent = pcb_freelist;
-    pcb_freelist = pcbiter;
-  }
+  for(unsigned int c=0; c<MAX_CORES; c++)
+    pid_cache_size[c] = 0;
 
   process_count = 0;
 
@@ -82,32 +117,75 @@ void initialize_processes()
 }
 
 
+/* Return an unused PCB, growing the table if needed */
+static PCB* new_PCB()
+{
+  if(pt_next >= MAX_PROC) return NULL;
+
+  PCB** chunk = &PT[pt_next / PT_CHUNK_SIZE];
+  if(*chunk == NULL) {
+    *chunk = (PCB*)xmalloc(PT_CHUNK_SIZE * sizeof(PCB));
+    for(unsigned int i=0; i<PT_CHUNK_SIZE; i++) {
+      initialize_PCB(*chunk + i);
+      (*chunk)[i].pid = pt_next + i;
+    }
+  }
+
+  return pt_entry(pt_next++);
+}
+
+
 /*
   Must be called with kernel_mutex held
 */
 PCB* acquire_PCB()
 {
-  PCB* pcb = NULL;
+  PCB* pcb;
+  unsigned int core = cpu_core_id;
 
-  if(pcb_freelist != NULL) {
+  if(pid_cache_size[core] > 0) {
+    pcb = pid_cache[core][--pid_cache_size[core]];
+  }
+  else if(pcb_freelist != NULL) {
     pcb = pcb_freelist;
-    pcb->pstate = ALIVE;
     pcb_freelist = pcb_freelist->parent;
-    process_count++;
+  }
+  else {
+    pcb = new_PCB();
+    if(pcb == NULL) return NULL;
   }
 
+  pcb->pstate = ALIVE;
+  pt_live[pcb->pid / 64] |= (uint64_t)1 << (pcb->pid % 64);
+  process_count++;
   return pcb;
 }
 
 /*
-  Must be called with kernel_mutex held
+  Must be called with kernel_mutex held.
+
+  The PCB is left ready for reuse, so that acquire_PCB need not 
+  initialize it: the PTCBs of threads that were never joined return
+  to the PTCB cache.
 */
 void release_PCB(PCB* pcb)
 {
+  while(! is_rlist_empty(& pcb->ptcb_list))
+    release_PTCB(rlist_pop_front(& pcb->ptcb_list)->ptcb);
+  pcb->thread_count = 0;
+
   pcb->pstate = FREE;
-  pcb->parent = pcb_freelist;
-  pcb_freelist = pcb;
+  pt_live[pcb->pid / 64] &= ~((uint64_t)1 << (pcb->pid % 64));
   process_count--;
+
+  unsigned int core = cpu_core_id;
+  if(pid_cache_size[core] < PID_CACHE_SIZE) {
+    pid_cache[core][pid_cache_size[core]++] = pcb;
+  }
+  else {
+    pcb->parent = pcb_freelist;
+    pcb_freelist = pcb;
+  }
 }
 
 
@@ -152,17 +230,15 @@ ThreadExit(exitval);
 
 
 /*
-  System call to create a new process.
+  Acquire and initialize a new PCB, as a child of the current process.
+  The new process has no file ids and no threads yet.
  */
-Pid_t sys_Exec(Task call, int argl, void* args)
+static PCB* new_process(Task call, int argl, void* args)
 {
-  PCB *curproc, *newproc;
-  PTCB *ptcbtemp;
- 
   /* The new process PCB */
-  newproc = acquire_PCB();
+  PCB* newproc = acquire_PCB();
 
-  if(newproc == NULL) goto finish;  /* We have run out of PIDs! */
+  if(newproc == NULL) return NULL;  /* We have run out of PIDs! */
 
   if(get_pid(newproc)<=1) {
     /* Processes with pid<=1 (the scheduler and the init process)
@@ -171,21 +247,15 @@ Pid_t sys_Exec(Task call, int argl, void* args)
   }
   else
   {
-    /* Inherit parent */
-    curproc = CURPROC;
-
     /* Add new process to the parent's child list */
-    newproc->parent = curproc;
-    rlist_push_front(& curproc->children_list, & newproc->children_node);
-
-    /* Inherit file streams from parent */
-    for(int i=0; i<MAX_FILEID; i++) {
-       newproc->FIDT[i] = curproc->FIDT[i];
-       if(newproc->FIDT[i])
-          FCB_incref(newproc->FIDT[i]);
-    }
+    newproc->parent = CURPROC;
+    rlist_push_front(& CURPROC->children_list, & newproc->children_node);
   }
 
+  /* Start accounting, and inherit the limits */
+  memset(& newproc->usage, 0, sizeof(procusage));
+  newproc->max_threads = newproc->parent ? newproc->parent->max_threads : 0;
+  newproc->max_fids = newproc->parent ? newproc->parent->max_fids : 0;
 
   /* Set the main thread's function */
   newproc->main_task = call;
@@ -199,49 +269,88 @@ Pid_t sys_Exec(Task call, int argl, void* args)
   else
     newproc->args=NULL;
 
-  /*
-    Create and wake up the thread for the main function. This must be the last thing
-    we do, because once we wakeup the new thread it may run! so we need to have finished
-    the initialization of the PCB.
-   */
-  if(call != NULL) {
+  return newproc;
+}
+
 
-    //rlnode_init(&newproc->ptcb_list, NULL);
+/*
+  Create and wake up the thread for the main function. This must be the last thing
+  we do, because once we wakeup the new thread it may run! so we need to have finished
+  the initialization of the PCB.
+ */
+static Pid_t start_process(PCB* newproc)
+{
+  if(newproc->main_task != NULL) {
     newproc->main_thread = spawn_thread(newproc, start_main_thread);
+    acquire_PTCB(newproc, newproc->main_thread, 
+      newproc->main_task, newproc->argl, newproc->args);
+    wakeup(newproc->main_thread);
+  }
 
-    ptcbtemp=(PTCB*)xmalloc(sizeof(PTCB)) ;
+  return get_pid(newproc);
+}
 
 
+/*
+  System call to create a new process.
+ */
+Pid_t sys_Exec(Task call, int argl, void* args)
+{
+  PCB* newproc = new_process(call, argl, args);
+  if(newproc == NULL) return NOPROC;
 
- // ptcb variables
+  /* Inherit file streams from parent, except the ones closed on exec */
+  if(newproc->parent != NULL)
+    fidt_inherit(newproc->parent, newproc);
 
-   ptcbtemp->argl=newproc->argl ;
-   ptcbtemp->args=newproc->args ;  
-   ptcbtemp->detached=0;
-   ptcbtemp->exit_cv=COND_INIT;
-   ptcbtemp->exited=0;
-   ptcbtemp->refcount=0;
-   ptcbtemp->task=newproc->main_task ;
-   ptcbtemp->tcb=newproc->main_thread ;
-   ptcbtemp->owner_pcb = newproc;
- 
-  //rlnode_init(&ptcbtemp->ptcb_list_node,ptcbtemp) ;
+  return start_process(newproc);
+}
 
-//  proc variables setup
-rlnode_init(&ptcbtemp->ptcb_list_node,ptcbtemp) ;
-rlist_push_back(&newproc->ptcb_list,&ptcbtemp->ptcb_list_node);
-newproc->thread_count = 1  ;
 
+/*
+  System call to create a new process with an explicit set of file ids.
+ */
+Pid_t sys_Spawn(Task call, int argl, void* args, const fid_map* fids, unsigned int nfids)
+{
+  if(nfids > 0 && fids == NULL) return NOPROC;
+
+  /* Check the mappings before creating anything. The child inherits our limits. */
+  for(unsigned int i=0; i<nfids; i++) {
+    Fid_t child = fids[i].child;
+    if(get_fcb(fids[i].parent) == NULL || child < 0 || child >= fid_limit(CURPROC))
+      return NOPROC;
+    for(unsigned int j=0; j<i; j++)
+      if(fids[j].child == child)
+        return NOPROC;
+  }
 
-// tcb variables
-newproc->main_thread->ptcb=ptcbtemp ;
+  PCB* newproc = new_process(call, argl, args);
+  if(newproc == NULL) return NOPROC;
 
-    wakeup(ptcbtemp->tcb);
+  for(unsigned int i=0; i<nfids; i++) {
+    FCB* fcb = get_fcb(fids[i].parent);
+    FCB_incref(fcb);
+    fidt_set(newproc, fids[i].child, fcb);
   }
 
+  return start_process(newproc);
+}
 
-finish:
-  return get_pid(newproc);
+
+int sys_SetLimit(proc_limit which, unsigned int value)
+{
+  unsigned int* limit;
+  switch(which) {
+    case LIMIT_THREADS: limit = & CURPROC->max_threads; break;
+    case LIMIT_FIDS: 
+      if(value > MAX_FILEID_LIMIT) return -1;
+      limit = & CURPROC->max_fids; 
+      break;
+    default: return -1;
+  }
+  int old = *limit;
+  *limit = value;
+  return old;
 }
 
 
@@ -266,6 +375,9 @@ static void cleanup_zombie(PCB* pcb, int* status)
   rlist_remove(& pcb->children_node);
   rlist_remove(& pcb->exited_node);
 
+  /* Other threads of the parent may be waiting for this child */
+  kernel_broadcast(& pcb->wait_chan);
+
   release_PCB(pcb);
 }
 
@@ -273,23 +385,22 @@ static void cleanup_zombie(PCB* pcb, int* status)
 static Pid_t wait_for_specific_child(Pid_t cpid, int* status)
 {
 
-  /* Legality checks */
-  if((cpid<0) || (cpid>=MAX_PROC)) {
-    cpid = NOPROC;
-    goto finish;
-  }
-
   PCB* parent = CURPROC;
   PCB* child = get_pcb(cpid);
-  if( child == NULL || child->parent != parent)
-  {
+
+  /* 
+    Wait on the child's own channel, so that the exit of a sibling does 
+    not wake us up. While we sleep, the child may be reaped by another 
+    thread, so we check again each time.
+   */
+  while(child != NULL && child->parent == parent && child->pstate == ALIVE)
+    kernel_wait(& child->wait_chan, SCHED_USER);
+
+  /* Legality checks */
+  if(child == NULL || child->parent != parent || child->pstate != ZOMBIE) {
     cpid = NOPROC;
     goto finish;
   }
-
-  /* Ok, child is a legal child of mine. Wait for it to exit. */
-  while(child->pstate == ALIVE)
-    kernel_wait(& parent->child_exit, SCHED_USER);
  
   cleanup_zombie(child, status);
  
@@ -369,12 +480,38 @@ void sys_Exit(int exitval)
 
 
 //System Info Implementation
- 
+
+/*
+  An information stream keeps a private copy of the PID bitmap, taken
+  when it is opened and restricted by the filter. Each read takes the 
+  next set bit, so that reading the whole stream costs O(processes) plus
+  one step per 64 pids of the range.
+ */
 typedef struct info_controll_block {
-    int current_index; 
+    procinfo_filter filter;
+    Pid_t base;             /* The pid of bit 0 of live[0] */
+    unsigned int nwords;
+    unsigned int current;   /* The word being read */
+    uint64_t live[];
 } InfoCB;
 
 
+/* Return the next pid of the snapshot, or NOPROC */
+static Pid_t info_next_pid(InfoCB* icb)
+{
+    while (icb->current < icb->nwords) {
+        uint64_t* w = &icb->live[icb->current];
+        if (*w) {
+            unsigned int bit = __builtin_ctzll(*w);
+            *w &= *w - 1;
+            return icb->base + 64 * icb->current + bit;
+        }
+        icb->current++;
+    }
+    return NOPROC;
+}
+
+
 static int info_read(void* obj, char* buf, unsigned int size) {
     InfoCB* procicb = (InfoCB*)obj;
     int bytes_written = 0;
@@ -383,18 +520,20 @@ static int info_read(void* obj, char* buf, unsigned int size) {
     
     while (bytes_written + entry_size <= size) {
 
-        
-        while (procicb->current_index < MAX_PROC && PT[procicb->current_index].pstate == FREE) {
-            procicb->current_index++;
-        }
-
-       
-        if (procicb->current_index >= MAX_PROC) {
+        Pid_t pid = info_next_pid(procicb);
+        if (pid == NOPROC) {
             break; 
         }
 
-      
-        PCB* pcb = &PT[procicb->current_index];
+        /* The process may have changed since the stream was opened */
+        PCB* pcb = get_pcb(pid);
+        if (pcb == NULL) 
+            continue;
+        if (procicb->filter.alive_only && pcb->pstate != ALIVE)
+            continue;
+        if (procicb->filter.ppid != NOPROC && get_pid(pcb->parent) != procicb->filter.ppid)
+            continue;
+
         procinfo info;
 
         info.pid = get_pid(pcb);
@@ -403,6 +542,10 @@ static int info_read(void* obj, char* buf, unsigned int size) {
         info.thread_count = pcb->thread_count;
         info.main_task = pcb->main_task;
         info.argl = pcb->argl;
+        info.usage = pcb->usage;
+        info.max_threads = pcb->max_threads;
+        info.max_fids = pcb->max_fids;
+        info.fid_count = pcb->fid_count;
 
         
         memset(info.args, 0, PROCINFO_MAX_ARGS_SIZE);
@@ -418,9 +561,6 @@ static int info_read(void* obj, char* buf, unsigned int size) {
         memcpy(buf + bytes_written, &info, entry_size);
 
         bytes_written += entry_size;
-        
-        
-        procicb->current_index++;
     }
 
     return bytes_written;
@@ -437,33 +577,67 @@ static file_ops info_ops = {
     .Read = info_read,
     .Write = NULL,       
     .Close = info_close,
-    .Open = NULL
+    .Open = NULL,
+    .kind = STREAM_INFO
 };
 
 
 Fid_t sys_OpenInfo() {
+    return sys_OpenProcInfo(NULL);
+}
+
+
+Fid_t sys_OpenProcInfo(const procinfo_filter* filter) {
     Fid_t fid;
     FCB* fcb;
     InfoCB* cb;
 
-    
+    procinfo_filter f = PROCINFO_ALL;
+    if (filter != NULL) 
+        f = *filter;
+
+    /* Clip the pid range to the used part of the table, [0, pt_next) */
+    Pid_t lo = (f.pid_min < 0) ? 0 : (f.pid_min > pt_next ? pt_next : f.pid_min);
+    Pid_t hi = (f.pid_max > pt_next || f.pid_max < 0) ? pt_next : f.pid_max;
+
     if (FCB_reserve(1, &fid, &fcb) == 0) {
         return NOFILE;
     }
 
-    
-    cb = (InfoCB*)xmalloc(sizeof(InfoCB)); 
-    if (cb == NULL) {
-        FCB_unreserve(1, &fid, &fcb);
-        return NOFILE;
+    /* An empty range gives an empty stream */
+    Pid_t base = lo & ~63;
+    unsigned int nwords = (lo < hi) ? (hi - base + 63) / 64 : 0;
+    cb = (InfoCB*)xmalloc(sizeof(InfoCB) + nwords * sizeof(uint64_t)); 
+    cb->filter = f;
+    cb->base = base;
+    cb->nwords = nwords;
+    cb->current = 0;
+
+    PCB* parent = (f.ppid == NOPROC) ? NULL : get_pcb(f.ppid);
+    if (f.ppid != NOPROC) {
+        /* Only the children of the parent */
+        memset(cb->live, 0, nwords * sizeof(uint64_t));
+        if (parent != NULL) {
+            for (rlnode* n = parent->children_list.next; n != &parent->children_list; n = n->next) {
+                Pid_t pid = get_pid(n->pcb);
+                if (pid >= lo && pid < hi)
+                    cb->live[(pid - base) / 64] |= (uint64_t)1 << ((pid - base) % 64);
+            }
+        }
+    } else {
+        memcpy(cb->live, pt_live + base / 64, nwords * sizeof(uint64_t));
+        /* Mask out the pids outside the range */
+        if (nwords > 0) {
+            if (lo % 64)
+                cb->live[0] &= ~(uint64_t)0 << (lo % 64);
+            if (hi % 64)
+                cb->live[nwords - 1] &= ~(~(uint64_t)0 << (hi % 64));
+        }
     }
 
- 
-    cb->current_index = 0;
-
     // Σύνδεση
     fcb->streamobj = cb;
     fcb->streamfunc = &info_ops; 
 
     return fid;
-}
\ No newline at end of file
+}
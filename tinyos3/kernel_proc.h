@@ -54,14 +54,34 @@ typedef struct process_thread_control_block
   CondVar exit_cv;
   int refcount;
 
+  Tid_t tid;      /**< @brief The handle of this thread in the owner's handle table */
+
   rlnode ptcb_list_node ; 
 }PTCB ;
 
 
+/**
+  @brief A slot of the thread handle table.
+
+  A @c Tid_t encodes the index of a slot (plus one, so that @c NOTHREAD is never
+  a valid handle) in its low @c TID_INDEX_BITS bits, and the generation of the
+  slot in the rest. The generation is incremented each time the slot is released,
+  so that stale handles are detected.
+ */
+typedef struct ptcb_handle {
+  PTCB* ptcb;           /**< @brief The thread, or NULL if the slot is free */
+  unsigned int gen;     /**< @brief The generation of the slot */
+  int next_free;        /**< @brief The next free slot, or -1 */
+} ptcb_handle;
+
+#define TID_INDEX_BITS 24
+
+
 
 
 
 typedef struct process_control_block {
+  Pid_t pid;              /**< @brief The pid of this PCB */
   pid_state  pstate;      /**< @brief The pid state for this PCB */
 
   PCB* parent;            /**< @brief Parent's pcb. */
@@ -84,11 +104,39 @@ typedef struct process_control_block {
                              process terminates. It is used in the implementation of
                              @c WaitChild() */
 
-  FCB* FIDT[MAX_FILEID];  /**< @brief The fileid table of the process */
+  CondVar wait_chan;      /**< @brief Condition variable for @c WaitChild on this process.
+
+                             This condition variable is broadcast when this process 
+                             terminates, or is reaped. Unlike @c child_exit, it wakes up
+                             only the threads waiting for this specific process. */
+
+  FCB** FIDT;               /**< @brief The fileid table of the process.
+
+                               The table grows as needed, up to the file id limit
+                               of the process. @see kernel_streams.h */
+  unsigned int fidt_size;   /**< @brief The number of slots in @c FIDT */
+  uint64_t* fid_used;       /**< @brief Bitmap of the used slots of @c FIDT */
+  uint64_t* cloexec;        /**< @brief Bitmap of the file ids closed on @c Exec */
+  unsigned int fid_hint;    /**< @brief No word of @c fid_used before this one has a free bit */
+  unsigned int fid_count;   /**< @brief The number of used file ids */
+
+  FCB* fidt_inline[MAX_FILEID];   /**< @brief The initial storage of @c FIDT */
+  uint64_t fid_used_inline;       /**< @brief The initial storage of @c fid_used */
+  uint64_t cloexec_inline;        /**< @brief The initial storage of @c cloexec */
 
    rlnode ptcb_list;
   int thread_count;
 
+  ptcb_handle* handles;       /**< @brief The thread handle table */
+  unsigned int handles_size;  /**< @brief The number of slots in @c handles */
+  int handles_free;           /**< @brief The first free slot, or -1 */
+
+  struct aio_context* aio;  /**< @brief Asynchronous I/O context, or NULL */
+
+  procusage usage;            /**< @brief Resource usage, kept incrementally */
+  unsigned int max_threads;   /**< @brief The thread limit, or 0 */
+  unsigned int max_fids;      /**< @brief The file id limit, or 0 */
+
 
 } PCB;
 
@@ -126,6 +174,57 @@ PCB* get_pcb(Pid_t pid);
 */
 Pid_t get_pid(PCB* pcb);
 
+
+/**
+  @brief Allocate a handle for a thread of a process.
+
+  The table of handles grows as needed. The handle is also stored in
+  @c ptcb->tid.
+
+  @param pcb the process owning the thread
+  @param ptcb the thread
+  @returns the new handle
+*/
+Tid_t tid_acquire(PCB* pcb, PTCB* ptcb);
+
+/**
+  @brief Return the thread of a handle, in O(1).
+
+  @returns the thread, or NULL if the handle is invalid or stale.
+*/
+PTCB* tid_lookup(PCB* pcb, Tid_t tid);
+
+/**
+  @brief Release the handle of a thread. 
+
+  After this call, the handle is stale and @c tid_lookup() returns NULL for it.
+*/
+void tid_release(PCB* pcb, PTCB* ptcb);
+
+/**
+  @brief Free the handle table of a process.
+*/
+void tid_table_destroy(PCB* pcb);
+
+/**
+  @brief Create the PTCB of a new thread of a process.
+
+  The PTCB is taken from a cache of released PTCBs if possible. It is
+  added to the thread list of the process, given a handle, and attached 
+  to @c tcb. The thread count of the process is incremented.
+
+  @returns the new PTCB
+*/
+PTCB* acquire_PTCB(PCB* pcb, TCB* tcb, Task task, int argl, void* args);
+
+/**
+  @brief Return a PTCB to the cache.
+
+  The PTCB must have been removed from the thread list of its process, 
+  and its handle must have been released.
+*/
+void release_PTCB(PTCB* ptcb);
+
 /** @} */
 
 #endif
@@ -139,6 +139,37 @@ void* allocate_thread(size_t size)
 
 
 
+/*
+  The thread cache.
+
+  The memory of exited threads is kept in a small cache (linked by the
+  cache_next field), so that spawning a thread does not need to allocate
+  and fault in a new stack. The cache is protected by sched_spinlock, since
+  threads are released from inside the scheduler.
+ */
+#define TCB_CACHE_SIZE 32
+
+extern Mutex sched_spinlock; /* forward */
+
+static TCB* tcb_cache = NULL;
+static unsigned int tcb_cache_size = 0;
+
+static TCB* tcb_cache_get()
+{
+    int preempt = preempt_off;
+    Mutex_Lock(&sched_spinlock);
+    TCB* tcb = tcb_cache;
+    if (tcb != NULL) {
+        tcb_cache = tcb->cache_next;
+        tcb_cache_size--;
+    }
+    Mutex_Unlock(&sched_spinlock);
+    if (preempt)
+        preempt_on;
+    return tcb;
+}
+
+
 /*
   This is the function that is used to start normal threads.
 */
@@ -161,13 +192,18 @@ static void thread_start()
 TCB* spawn_thread(PCB* pcb, void (*func)())
 {
     /* The allocated thread size must be a multiple of page size */
-    TCB* tcb = (TCB*)allocate_thread(THREAD_SIZE);
+    TCB* tcb = tcb_cache_get();
+    if (tcb == NULL)
+        tcb = (TCB*)allocate_thread(THREAD_SIZE);
 
     /* Set the owner */
     tcb->owner_pcb = pcb;
+    __atomic_fetch_add(&pcb->usage.stack_memory, THREAD_SIZE, __ATOMIC_RELAXED);
 
 
     tcb->priority = Num_Prior / 2 ; //Initialize hte prioriy in a medium priority 
+    tcb->io_flags = 0;
+    tcb->cache_next = NULL;
 
     /* Initialize the other attributes */
     tcb->type = NORMAL_THREAD;
@@ -181,6 +217,9 @@ TCB* spawn_thread(PCB* pcb, void (*func)())
     tcb->rts = QUANTUM;
     tcb->last_cause = SCHED_IDLE;
     tcb->curr_cause = SCHED_IDLE;
+    tcb->cpu_time = 0;
+    tcb->slices = 0;
+    tcb->cause_history = 0;
 
     /* Compute the stack segment address and size */
     void* sp = ((void*)tcb) + THREAD_TCB_SIZE;
@@ -209,7 +248,13 @@ void release_TCB(TCB* tcb)
     VALGRIND_STACK_DEREGISTER(tcb->valgrind_stack_id);
 #endif
 
-    free_thread(tcb, THREAD_SIZE);
+    if (tcb_cache_size < TCB_CACHE_SIZE) {
+        tcb->cache_next = tcb_cache;
+        tcb_cache = tcb;
+        tcb_cache_size++;
+    } else {
+        free_thread(tcb, THREAD_SIZE);
+    }
 
     Mutex_Lock(&active_threads_spinlock);
     active_threads--;
@@ -278,11 +323,11 @@ static void sched_register_timeout(TCB* tcb, TimerDuration timeout)
 }
 
 /*
-  Add TCB to the end of the scheduler list.
+  Add TCB to the end of the scheduler list, without restarting any cores.
 
   *** MUST BE CALLED WITH sched_spinlock HELD ***
 */
-static void sched_queue_add(TCB* tcb)
+static void sched_queue_push(TCB* tcb)
 {
     if(tcb->priority < 0){
         tcb->priority = 0 ;
@@ -304,17 +349,42 @@ static void sched_queue_add(TCB* tcb)
 
     /* Insert at the end of the scheduling list */
     //rlist_push_back(&SCHED, &tcb->sched_node);
+}
+
+/*
+  Restart up to n halted cores, to run n newly queued threads. Each call
+  to cpu_core_restart_one() restarts a different core, so at most one 
+  restart is issued per halted core.
+ */
+static void sched_restart_cores(unsigned int n)
+{
+    if (n > cpu_cores())
+        n = cpu_cores();
+    for (unsigned int i = 0; i < n; i++)
+        cpu_core_restart_one();
+}
+
+/*
+  Add TCB to the end of the scheduler list.
+
+  *** MUST BE CALLED WITH sched_spinlock HELD ***
+*/
+static void sched_queue_add(TCB* tcb)
+{
+    sched_queue_push(tcb);
 
     /* Restart possibly halted cores */
     cpu_core_restart_one();
 }
 
 /*
-    Adjust the state of a thread to make it READY.
+    Adjust the state of a thread to make it READY. Return 1 if the thread
+    was added to the scheduler queue, in which case the caller should
+    restart a halted core.
 
     *** MUST BE CALLED WITH sched_spinlock HELD ***
  */
-static void sched_make_ready(TCB* tcb)
+static int sched_make_ready(TCB* tcb)
 {
     assert(tcb->state == STOPPED || tcb->state == INIT);
 
@@ -330,8 +400,11 @@ static void sched_make_ready(TCB* tcb)
     tcb->state = READY;
 
     /* Possibly add to the scheduler queue */
-    if (tcb->phase == CTX_CLEAN)
-        sched_queue_add(tcb);
+    if (tcb->phase == CTX_CLEAN) {
+        sched_queue_push(tcb);
+        return 1;
+    }
+    return 0;
 }
 
 /*
@@ -344,13 +417,16 @@ static void sched_wakeup_expired_timeouts()
 {
     /* Empty the timeout list up to the current time and wake up each thread */
     TimerDuration curtime = bios_clock();
+    unsigned int queued = 0;
 
     while (!is_rlist_empty(&TIMEOUT_LIST)) {
         TCB* tcb = TIMEOUT_LIST.next->tcb;
         if (tcb->wakeup_time > curtime)
             break;
-        sched_make_ready(tcb);
+        queued += sched_make_ready(tcb);
     }
+
+    sched_restart_cores(queued);
 }
 
 /*
@@ -400,7 +476,8 @@ int wakeup(TCB* tcb)
     Mutex_Lock(&sched_spinlock);
 
     if (tcb->state == STOPPED || tcb->state == INIT) {
-        sched_make_ready(tcb);
+        if (sched_make_ready(tcb))
+            cpu_core_restart_one();
         ret = 1;
     }
 
@@ -413,6 +490,37 @@ int wakeup(TCB* tcb)
     return ret;
 }
 
+/*
+  Make a number of threads ready, taking the scheduler lock once.
+ */
+unsigned int wakeup_batch(TCB** tcbs, unsigned int n)
+{
+    unsigned int count = 0;
+    unsigned int queued = 0;
+
+    int oldpre = preempt_off;
+    Mutex_Lock(&sched_spinlock);
+
+    for (unsigned int i = 0; i < n; i++) {
+        TCB* tcb = tcbs[i];
+        if (tcb->state == STOPPED || tcb->state == INIT) {
+            queued += sched_make_ready(tcb);
+            count++;
+        } else {
+            tcbs[i] = NULL;
+        }
+    }
+
+    Mutex_Unlock(&sched_spinlock);
+
+    /* The queues are shared by all cores, any halted core will do */
+    sched_restart_cores(queued);
+    if (oldpre)
+        preempt_on;
+
+    return count;
+}
+
 /*
   Atomically put the current process to sleep, after unlocking mx.
  */
@@ -429,6 +537,16 @@ void sleep_releasing(Thread_state state, Mutex* mx, enum SCHED_CAUSE cause,
     /* mark the thread as stopped or exited */
     tcb->state = state;
 
+    /* The stack of an exited thread no longer counts for its process.
+       Every thread of a process (including its aio worker) exits before 
+       the process can be reaped; but never charge a free PCB. */
+    if (state == EXITED && tcb->type == NORMAL_THREAD) {
+        PCB* pcb = tcb->owner_pcb;
+        assert(pcb->pstate != FREE);
+        if (pcb->pstate != FREE)
+            __atomic_fetch_sub(&pcb->usage.stack_memory, THREAD_SIZE, __ATOMIC_RELAXED);
+    }
+
     /* register the timeout (if any) for the sleeping thread */
     if (state != EXITED)
         sched_register_timeout(tcb, timeout);
@@ -524,6 +642,21 @@ void yield(enum SCHED_CAUSE cause)
         current->state = READY;
 
     /* Update CURTHREAD scheduler data */
+    TimerDuration used = (remaining < current->rts) ? current->rts - remaining : 0;
+    current->cpu_time += used;
+    current->slices++;
+    current->cause_history = (current->cause_history << 4) | cause;
+
+    /* 
+      Account the time-slice to the process. Threads of a process may run on
+      many cores, hence the atomics. An exited thread is skipped, since its 
+      process may already have been reaped.
+     */
+    if (current->type == NORMAL_THREAD && current->state != EXITED) {
+        procusage* u = &current->owner_pcb->usage;
+        __atomic_fetch_add(&u->cpu_time, used, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&u->yields[cause], 1, __ATOMIC_RELAXED);
+    }
     current->rts = remaining;
     current->last_cause = current->curr_cause;
     current->curr_cause = cause;
@@ -663,6 +796,7 @@ void run_scheduler()
     curcore->idle_thread.state = RUNNING;
     curcore->idle_thread.phase = CTX_DIRTY;
     curcore->idle_thread.wakeup_time = NO_TIMEOUT;
+    curcore->idle_thread.io_flags = 0;
     rlnode_init(&curcore->idle_thread.sched_node, &curcore->idle_thread);
 
     curcore->idle_thread.its = QUANTUM;
@@ -670,6 +804,9 @@ void run_scheduler()
 
     curcore->idle_thread.curr_cause = SCHED_IDLE;
     curcore->idle_thread.last_cause = SCHED_IDLE;
+    curcore->idle_thread.cpu_time = 0;
+    curcore->idle_thread.slices = 0;
+    curcore->idle_thread.cause_history = 0;
 
 
     //
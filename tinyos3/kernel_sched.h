@@ -125,11 +125,21 @@ typedef struct thread_control_block {
 
   int priority ; // Trexousa protereothta nimatos 
 
+  int io_flags; /**< @brief Flags of the stream operation in progress, or 
+                     of the thread (see @c SetThreadFlags) */
+
+  struct thread_control_block* cache_next; /**< @brief Next thread in the thread cache */
+
 
 
   enum SCHED_CAUSE curr_cause; /**< @brief The endcause for the current time-slice */
   enum SCHED_CAUSE last_cause; /**< @brief The endcause for the last time-slice */
 
+  TimerDuration cpu_time; /**< @brief The time spent running */
+  unsigned long slices; /**< @brief The number of time-slices that ended */
+  unsigned int cause_history; /**< @brief The endcauses of the last 8 time-slices, 
+                                  4 bits each, most recent in the low bits */
+
 #ifndef NVALGRIND
   unsigned valgrind_stack_id; /**< @brief Valgrind helper for stacks.
 
@@ -228,6 +238,21 @@ TCB* spawn_thread(PCB* pcb, void (*func)());
 */
 int wakeup(TCB* tcb);
 
+/**
+  @brief Wakeup a number of blocked threads.
+
+  This call is equivalent to calling @c wakeup() on each thread of the array,
+  but takes the scheduler lock only once, and restarts at most one halted 
+  core per thread made ready (and never the same core twice).
+
+  @param tcbs an array of threads to be made @c READY. On return, the 
+         threads whose state was not @c STOPPED or @c INIT are replaced by
+         @c NULL.
+  @param n the length of the array
+  @returns the number of threads made @c READY
+*/
+unsigned int wakeup_batch(TCB** tcbs, unsigned int n);
+
 /**
   @brief Block the current thread.
 
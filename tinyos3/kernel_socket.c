@@ -4,6 +4,7 @@
 #include "kernel_proc.h"
 #include "kernel_cc.h"
 #include "kernel_pipe.h" 
+#include "kernel_poll.h"
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
@@ -19,8 +20,10 @@ struct socket_control_block;
 
 
 typedef struct connection_request {
-    int admitted;                           
+    int admitted;                           // 0: queued, 1: accepted, -1: refused
     struct socket_control_block* peer;      
+    struct socket_control_block* listener;  // where the request is queued
+    TimerDuration start;                    // when Connect was called
     CondVar connected_cv;                   
     rlnode queue_node;                      
 } connection_request;
@@ -31,16 +34,65 @@ typedef struct unbound_socket {
 } unbound_socket;
 
 
+/* An Accept or AcceptMany call, waiting for a connection */
+typedef struct acceptor {
+    FCB* lfcb;                              // the listener's stream
+    FCB* fcb;                               // reserved for the new socket
+    int connected;                          // set on handoff by a connector
+    CondVar ready;
+    rlnode node;                            // in the listener's acceptors
+} acceptor;
+
+
 typedef struct listener_socket {
     rlnode queue;                           
-    CondVar req_available;                  
+    unsigned int queued;                    // the length of the queue
+    rlnode acceptors;                       // waiting acceptors
+    rlnode port_node;                       // in the listeners of the port
+    unsigned int peak_queued;               // the longest the queue has been
+    unsigned int accepted;                  // connections admitted so far
+    rlnode spares;                          // peer sockets reserved for the backlog
+    unsigned int nspares;                   // the length of spares
 } listener_socket;
 
 
+/*
+    A shared region carries the data of one direction of a connection in 
+    shared mode. The writer fills a reservation in place and sends a 
+    descriptor for it over the write pipe; the reader finds the data in
+    place. The region is a byte ring: space is handed out at the tail, and
+    returned in order, as credit, when the reader moves to its next message.
+
+    All processes share the address space of the kernel, so the region is 
+    mapped by both peers, at the same address.
+ */
+typedef struct shm_region {
+    char* base;
+    unsigned int size;
+    unsigned int head;          // start of the space not yet returned
+    unsigned int tail;          // end of the space sent by the writer
+    unsigned int reserved;      // the writer's reservation at tail, 0 if none
+    unsigned int received;      // end of the reader's current message
+    int reader_closed;
+    CondVar has_credit;         // the writer waits for space
+    rlnode* writer_watchers;    // notified on credit, NULL if writer closed
+    int refcount;               // by the two peers
+} shm_region;
+
+/* The descriptor of a message, as sent over the write pipe. Positions are 
+   free-running, modulo the size of the region. */
+typedef struct shm_desc {
+    unsigned int pos;
+    unsigned int len;
+} shm_desc;
+
+
 typedef struct peer_socket {
     struct socket_control_block* peer;      
     pipe_cb* write_pipe;                     
     pipe_cb* read_pipe;                      
+    shm_region* shm_send;                   // written by us, in shared mode
+    shm_region* shm_recv;                   // written by the peer
 } peer_socket;
 
 
@@ -49,6 +101,19 @@ typedef struct socket_control_block {
     FCB* fcb;
     socket_type type;
     port_t port;  
+    connection_request* pending;            // non-blocking Connect in progress
+    rlnode watchers;                        // event sets watching the socket
+    int message_mode;                       // SOCKOPT_MESSAGE
+    unsigned int backlog;                   // SOCKOPT_BACKLOG, 0 for no limit
+    int reuseport;                          // SOCKOPT_REUSEPORT
+    unsigned int shared_size;               // SOCKOPT_SHARED, 0 if not shared
+
+    /* Telemetry */
+    Pid_t owner;                            // the process that opened the socket
+    TimerDuration connect_latency;          // from Connect to admission, in usec
+    unsigned long bytes_in, bytes_out;
+    pipe_stats rx_stats, tx_stats;          // of the pipes, once shut down
+    rlnode all_node;                        // in the list of all sockets
 
     union {
         unbound_socket  unbound_s;  
@@ -58,25 +123,348 @@ typedef struct socket_control_block {
 } socket_cb;
 
 
-static socket_cb* PORT_MAP[MAX_PORT+1];
-static Mutex port_map_lock = MUTEX_INIT;
+/*
+    The port namespace. Ports with listeners have an entry in a hash table. 
+    Each entry holds the listeners of its port, more than one if they share
+    the port with SOCKOPT_REUSEPORT. Each bucket of the table has its own
+    lock, and a list of entries.
+ */
+#define PORT_HASH_SIZE 256
+
+typedef struct port_entry {
+    port_t port;
+    int reuseport;                  // the listeners share the port
+    int message_mode;               // the mode of the listeners
+    int shared;                     // the listeners are in shared mode
+    rlnode listeners;               // by listener_s.port_node
+    struct port_entry* next;        // in the bucket
+} port_entry;
+
+typedef struct port_bucket {
+    Mutex lock;
+    port_entry* entries;
+} port_bucket;
+
+static port_bucket PORT_HASH[PORT_HASH_SIZE];
+
+static inline port_bucket* port_bucket_of(port_t port)
+{
+    return &PORT_HASH[(unsigned int)port % PORT_HASH_SIZE];
+}
+
+/* Called with the bucket locked */
+static port_entry* port_lookup(port_bucket* b, port_t port)
+{
+    port_entry* e = b->entries;
+    while (e != NULL && e->port != port)
+        e = e->next;
+    return e;
+}
+
+
+/* Add a listener to its port. Returns -1 if the port is occupied. */
+static int port_bind(socket_cb* scb)
+{
+    port_bucket* b = port_bucket_of(scb->port);
+    int ret = 0;
+
+    Mutex_Lock(&b->lock);
+    port_entry* e = port_lookup(b, scb->port);
+    if (e == NULL) {
+        e = (port_entry*)xmalloc(sizeof(port_entry));
+        e->port = scb->port;
+        e->reuseport = scb->reuseport;
+        e->message_mode = scb->message_mode;
+        e->shared = (scb->shared_size != 0);
+        rlnode_init(&e->listeners, NULL);
+        e->next = b->entries;
+        b->entries = e;
+    } else if (!(e->reuseport && scb->reuseport) || e->message_mode != scb->message_mode
+            || e->shared != (scb->shared_size != 0)) {
+        ret = -1;   // Listener exists already
+    }
+
+    if (ret == 0) {
+        rlnode_init(&scb->listener_s.port_node, scb);
+        rlist_push_back(&e->listeners, &scb->listener_s.port_node);
+    }
+    Mutex_Unlock(&b->lock);
+
+    return ret;
+}
+
+
+/* Remove a listener from its port */
+static void port_unbind(socket_cb* scb)
+{
+    port_bucket* b = port_bucket_of(scb->port);
+
+    Mutex_Lock(&b->lock);
+    rlist_remove(&scb->listener_s.port_node);
+
+    for (port_entry** pe = &b->entries; *pe != NULL; pe = &(*pe)->next) {
+        port_entry* e = *pe;
+        if (e->port == scb->port) {
+            if (is_rlist_empty(&e->listeners)) {
+                *pe = e->next;
+                free(e);
+            }
+            break;
+        }
+    }
+    Mutex_Unlock(&b->lock);
+}
+
+
+/* 
+    Choose the listener of a port to queue a connection request. The chosen
+    listener moves to the back of the list, so that ties are broken 
+    round-robin.
+ */
+static socket_cb* port_pick_listener(port_t port)
+{
+    port_bucket* b = port_bucket_of(port);
+    socket_cb* best = NULL;
+
+    Mutex_Lock(&b->lock);
+    port_entry* e = port_lookup(b, port);
+    if (e != NULL) {
+        for (rlnode* n = e->listeners.next; n != &e->listeners; n = n->next) {
+            socket_cb* l = n->obj;
+            if (best == NULL || l->listener_s.queued < best->listener_s.queued)
+                best = l;
+        }
+        if (best != NULL) {
+            rlist_remove(&best->listener_s.port_node);
+            rlist_push_back(&e->listeners, &best->listener_s.port_node);
+        }
+    }
+    Mutex_Unlock(&b->lock);
+
+    return best;
+}
 
 
 static file_ops socket_ops;
 
 
+/*
+    Released sockets are kept in a pool, up to SOCKET_POOL_MAX, for reuse.
+    The pool is protected by the kernel lock.
+ */
+#define SOCKET_POOL_MAX 64
+
+static socket_cb* socket_pool[SOCKET_POOL_MAX];
+static unsigned int socket_pool_size = 0;
+
+static socket_cb* socket_mem_alloc()
+{
+    return (socket_pool_size > 0) ? socket_pool[--socket_pool_size]
+                                  : (socket_cb*)xmalloc(sizeof(socket_cb));
+}
+
+static void socket_mem_free(socket_cb* scb)
+{
+    if (socket_pool_size < SOCKET_POOL_MAX)
+        socket_pool[socket_pool_size++] = scb;
+    else
+        free(scb);
+}
+
+/* All sockets, for the socket information streams */
+static rlnode socket_list = { .obj = NULL, .prev = &socket_list, .next = &socket_list };
+static unsigned int socket_count = 0;
+
+/* Initialize a socket in memory from socket_mem_alloc */
+static socket_cb* socket_init(socket_cb* scb)
+{
+    memset(scb, 0, sizeof(socket_cb));
+    rlnode_init(&scb->watchers, NULL);
+    scb->owner = get_pid(CURPROC);
+    rlnode_init(&scb->all_node, scb);
+    rlist_push_back(&socket_list, &scb->all_node);
+    socket_count++;
+    return scb;
+}
+
+static socket_cb* socket_alloc()
+{
+    return socket_init(socket_mem_alloc());
+}
+
+static void socket_release(socket_cb* scb)
+{
+    rlist_remove(&scb->all_node);
+    socket_count--;
+    socket_mem_free(scb);
+}
+
+
+/*
+    A listener with a backlog reserves a peer socket and its two pipes for
+    each request of the backlog, so that admitting connections does not
+    allocate memory. The reservation belongs to the listener: other 
+    listeners and plain sockets cannot use it up. The memory of a reserved
+    peer is kept in the spares of the listener (linked by all_node), with 
+    its pipes in peer_s, uninitialized.
+
+    The reservation is made by Listen and by SOCKOPT_BACKLOG, and is topped
+    up by an acceptor that finds the queue empty, before it sleeps.
+ */
+static void listener_reserve(socket_cb* listener)
+{
+    listener_socket* ls = &listener->listener_s;
+
+    while (ls->nspares < listener->backlog) {
+        socket_cb* spare = socket_mem_alloc();
+        spare->peer_s.read_pipe = pipe_alloc();
+        spare->peer_s.write_pipe = pipe_alloc();
+        rlnode_init(&spare->all_node, spare);
+        rlist_push_back(&ls->spares, &spare->all_node);
+        ls->nspares++;
+    }
+
+    while (ls->nspares > listener->backlog) {
+        socket_cb* spare = rlist_pop_front(&ls->spares)->obj;
+        pipe_free(spare->peer_s.read_pipe);
+        pipe_free(spare->peer_s.write_pipe);
+        socket_mem_free(spare);
+        ls->nspares--;
+    }
+}
+
+/* Take a new peer socket with its pipes, from the reservation if possible */
+static socket_cb* listener_take_peer(socket_cb* listener, pipe_cb** p1, pipe_cb** p2)
+{
+    listener_socket* ls = &listener->listener_s;
+
+    if (ls->nspares == 0) {
+        *p1 = pipe_create();
+        *p2 = pipe_create();
+        return socket_alloc();
+    }
+
+    socket_cb* spare = rlist_pop_front(&ls->spares)->obj;
+    ls->nspares--;
+    *p1 = pipe_init(spare->peer_s.read_pipe);
+    *p2 = pipe_init(spare->peer_s.write_pipe);
+    return socket_init(spare);
+}
+
+
+/* The queue of connection requests of a listener */
+static void listener_enqueue(socket_cb* listener, connection_request* req)
+{
+    req->listener = listener;
+    rlist_push_back(&listener->listener_s.queue, &req->queue_node);
+    listener->listener_s.queued++;
+    if (listener->listener_s.queued > listener->listener_s.peak_queued)
+        listener->listener_s.peak_queued = listener->listener_s.queued;
+    poll_notify(&listener->watchers, EVENT_READ);
+}
+
+static connection_request* listener_dequeue(socket_cb* listener)
+{
+    listener->listener_s.queued--;
+    return rlist_pop_front(&listener->listener_s.queue)->obj;
+}
+
+static void listener_remove(connection_request* req)
+{
+    req->listener->listener_s.queued--;
+    rlist_remove(&req->queue_node);
+}
+
+
+static shm_region* shm_create(unsigned int size)
+{
+    shm_region* r = (shm_region*)xmalloc(sizeof(shm_region));
+    r->base = (char*)xmalloc(size);
+    r->size = size;
+    r->head = r->tail = r->received = 0;
+    r->reserved = 0;
+    r->reader_closed = 0;
+    r->has_credit = COND_INIT;
+    r->writer_watchers = NULL;
+    r->refcount = 2;
+    return r;
+}
+
+static void shm_decref(shm_region* r)
+{
+    if (--r->refcount == 0) {
+        free(r->base);
+        free(r);
+    }
+}
+
+static void shm_close(shm_region* r, int is_writer)
+{
+    if (is_writer) {
+        r->writer_watchers = NULL;
+    } else {
+        r->reader_closed = 1;
+        if (r->writer_watchers)
+            poll_notify(r->writer_watchers, EVENT_WRITE | EVENT_HANGUP);
+    }
+    kernel_broadcast(&r->has_credit);
+    shm_decref(r);
+}
+
+/* The padding needed to place n bytes contiguously at the tail */
+static inline unsigned int shm_padding(shm_region* r, unsigned int n)
+{
+    unsigned int pos = r->tail % r->size;
+    return (pos + n > r->size) ? r->size - pos : 0;
+}
+
+/* Is there room for a message of n bytes? */
+static inline int shm_has_room(shm_region* r, unsigned int n)
+{
+    return r->tail - r->head + shm_padding(r, n) + n <= r->size;
+}
+
+
 int socket_read(void* obj, char* buf, unsigned int size) {
     socket_cb* sock = (socket_cb*)obj;
-    if (sock->type != SOCKET_PEER || sock->peer_s.read_pipe == NULL) 
+    if (sock->type != SOCKET_PEER || sock->peer_s.read_pipe == NULL || sock->shared_size) 
         return -1;
-    return pipe_read(sock->peer_s.read_pipe, buf, size);
+    int n = pipe_read(sock->peer_s.read_pipe, buf, size);
+    if (n > 0) sock->bytes_in += n;
+    return n;
 }
 
 int socket_write(void* obj, const char* buf, unsigned int size) {
     socket_cb* sock = (socket_cb*)obj;
-    if (sock->type != SOCKET_PEER || sock->peer_s.write_pipe == NULL) 
+    if (sock->type != SOCKET_PEER || sock->peer_s.write_pipe == NULL || sock->shared_size) 
         return -1;
-    return pipe_write(sock->peer_s.write_pipe, buf, size);
+    int n = pipe_write(sock->peer_s.write_pipe, buf, size);
+    if (n > 0) sock->bytes_out += n;
+    return n;
+}
+
+/* Release a socket and its connection, after its last reference is dropped */
+static void socket_destroy(socket_cb* sock)
+{
+    if (sock->pending) {
+        if (sock->pending->admitted == 0)
+            listener_remove(sock->pending);
+        free(sock->pending);
+    }
+
+    
+    if (sock->type == SOCKET_PEER) {
+        if (sock->peer_s.write_pipe)
+            pipe_close(sock->peer_s.write_pipe, 1);
+        if (sock->peer_s.read_pipe)
+            pipe_close(sock->peer_s.read_pipe, 0);
+        if (sock->peer_s.shm_send)
+            shm_close(sock->peer_s.shm_send, 1);
+        if (sock->peer_s.shm_recv)
+            shm_close(sock->peer_s.shm_recv, 0);
+    }
+
+    socket_release(sock);
 }
 
 int socket_close(void* obj) {
@@ -84,58 +472,99 @@ int socket_close(void* obj) {
 
     
     if (sock->type == SOCKET_LISTENER) {
-        Mutex_Lock(&port_map_lock);
-        
-        if (sock->port != NOPORT && PORT_MAP[sock->port] == sock) { //remove the current socket from port_map
-            PORT_MAP[sock->port] = NULL;
+        port_unbind(sock);
+
+        /* Return the reservation */
+        sock->backlog = 0;
+        listener_reserve(sock);
+
+        /* Refuse the queued requests, their connectors must not wait for us */
+        while (!is_rlist_empty(&sock->listener_s.queue)) {
+            connection_request* req = listener_dequeue(sock);
+            req->admitted = -1;
+            kernel_signal(&req->connected_cv);
+            poll_notify(&req->peer->watchers, EVENT_WRITE | EVENT_HANGUP);
         }
-
         
         sock->type = SOCKET_UNBOUND;
        
         rlnode_init(&sock->unbound_s.unbound_socket, sock);
         
-        kernel_broadcast(&sock->listener_s.req_available);
-
-        Mutex_Unlock(&port_map_lock);
+        /* Release the waiting acceptors */
+        while (!is_rlist_empty(&sock->listener_s.acceptors)) {
+            acceptor* acc = rlist_pop_front(&sock->listener_s.acceptors)->obj;
+            kernel_signal(&acc->ready);
+        }
     }
 
     sock->refcount--; // -1 Socket 
-    if (sock->refcount > 0) 
-        return 0;
+    if (sock->refcount == 0)
+        socket_destroy(sock);
+    return 0;
+}
 
-    
-    if (sock->type == SOCKET_PEER) {
-        if (sock->peer_s.write_pipe)
-            pipe_close(sock->peer_s.write_pipe, 1);
-        if (sock->peer_s.read_pipe)
-            pipe_close(sock->peer_s.read_pipe, 0);
-    }
+unsigned int socket_poll(void* obj, rlnode** wq) {
+    socket_cb* sock = (socket_cb*)obj;
+    unsigned int events = 0;
 
-    free(sock);
-    return 0;
+    if (wq) *wq = &sock->watchers;
+
+    switch (sock->type) {
+        case SOCKET_LISTENER:
+            if (!is_rlist_empty(&sock->listener_s.queue))
+                events = EVENT_READ;
+            break;
+
+        case SOCKET_PEER:
+            /* A shut down direction fails at once, so it does not block */
+            events |= sock->peer_s.read_pipe ? pipe_poll_read(sock->peer_s.read_pipe) : EVENT_READ;
+            events |= sock->peer_s.write_pipe ? pipe_poll_write(sock->peer_s.write_pipe) : EVENT_WRITE;
+
+            /* In shared mode, writing also needs credit */
+            shm_region* r = sock->peer_s.shm_send;
+            if (r && !r->reader_closed && r->tail - r->head == r->size)
+                events &= ~EVENT_WRITE;
+            break;
+
+        case SOCKET_UNBOUND:
+            if (sock->pending && sock->pending->admitted < 0)
+                events = EVENT_WRITE | EVENT_HANGUP;
+            break;
+    }
+    return events;
 }
 
 static file_ops socket_ops = {
     .Open = NULL,
     .Read = socket_read,
     .Write = socket_write,
-    .Close = socket_close
+    .Close = socket_close,
+    .Poll = socket_poll,
+    .kind = STREAM_SOCKET
 };
 
 
 
-Fid_t sys_Socket(port_t port)
+Fid_t sys_Socket(int port)
+{
+    return sys_Socket2(port, 0);
+}
+
+
+Fid_t sys_Socket2(int port, int flags)
 {
     Fid_t fid;
     FCB* fcb;
     socket_cb* scb;
 
+    if (flags & ~FID_NONBLOCK)
+        return NOFILE;
    
     if (FCB_reserve(1, &fid, &fcb) == 0) 
         return NOFILE;
 
     
+    /* Check the range before the port is narrowed to a port_t */
     if (port != NOPORT && (port < 0 || port > MAX_PORT)) {
         FCB_unreserve(1, &fid, &fcb);
         return NOFILE;
@@ -143,13 +572,7 @@ Fid_t sys_Socket(port_t port)
 
    
 
-    scb = (socket_cb*)xmalloc(sizeof(socket_cb));
-    if (!scb) {
-        FCB_unreserve(1, &fid, &fcb);
-        return NOFILE;
-    }
-
-    memset(scb, 0, sizeof(socket_cb)); //
+    scb = socket_alloc();
     
     //create socket as unbound 
     scb->type = SOCKET_UNBOUND;
@@ -161,10 +584,25 @@ Fid_t sys_Socket(port_t port)
 
     fcb->streamobj = scb;
     fcb->streamfunc = &socket_ops;
+    fcb->flags = flags;
 
     return fid;
 }
 
+/* Report the state of a non-blocking Connect */
+static int connect_progress(socket_cb* scb)
+{
+    connection_request* req = scb->pending;
+
+    if (req->admitted == 0)
+        return WOULDBLOCK;
+
+    int ret = (req->admitted > 0) ? 0 : -1;
+    scb->pending = NULL;
+    free(req);
+    return ret;
+}
+
 int sys_Listen(Fid_t sock)
 {
     FCB* fcb = get_fcb(sock);
@@ -184,30 +622,103 @@ int sys_Listen(Fid_t sock)
     if (scb->port == NOPORT) 
         return -1;
 
-    
-    Mutex_Lock(&port_map_lock);
-    
-    if (PORT_MAP[scb->port] != NULL) {
-        Mutex_Unlock(&port_map_lock);
-        return -1; // Listener exists already 
-    }
+    rlnode_init(&scb->listener_s.queue, NULL);
+    scb->listener_s.queued = 0;
+    rlnode_init(&scb->listener_s.acceptors, NULL);
+    rlnode_init(&scb->listener_s.spares, NULL);
+    scb->listener_s.nspares = 0;
 
-    
-    PORT_MAP[scb->port] = scb;
+    if (port_bind(scb) == -1)
+        return -1;
     scb->type = SOCKET_LISTENER;
-    
-    Mutex_Unlock(&port_map_lock);
 
-    
-    rlnode_init(&scb->listener_s.queue, NULL);
-    scb->listener_s.req_available = COND_INIT;
+    listener_reserve(scb);
 
     return 0;
 }
 
 
 
-int sys_Connect(Fid_t sock, port_t port, timeout_t timeout)
+/* Set up a connection between a client and a new peer socket, in newfcb.
+   The client called Connect at time start. */
+static void connect_peers(socket_cb* listener, FCB* lfcb, FCB* newfcb, 
+    socket_cb* client_sock, TimerDuration start)
+{
+    pipe_cb *p1, *p2;
+    socket_cb* newsock = listener_take_peer(listener, &p1, &p2);
+    newsock->refcount = 1;
+    newsock->type = SOCKET_PEER;
+    newfcb->flags = lfcb->flags;
+    newsock->fcb = newfcb;
+    newsock->port = NOPORT; 
+    newsock->message_mode = listener->message_mode;
+    newsock->owner = listener->owner;
+    newsock->connect_latency = client_sock->connect_latency = bios_clock() - start;
+
+    p1->refcount = 2; 
+    p2->refcount = 2;
+    /* In shared mode, the pipes carry descriptors, as messages */
+    p1->message_mode = p2->message_mode = listener->message_mode || listener->shared_size;
+
+    //Server
+    newsock->peer_s.peer = client_sock;
+    newsock->peer_s.read_pipe = p1;    
+    newsock->peer_s.write_pipe = p2;   
+
+    //Client 
+    client_sock->type = SOCKET_PEER;
+    client_sock->peer_s.peer = newsock;
+    client_sock->peer_s.read_pipe = p2;   
+    client_sock->peer_s.write_pipe = p1; 
+
+    /* Readiness of each pipe end is posted to the socket owning it */
+    p1->reader_watchers = &newsock->watchers;
+    p1->writer_watchers = &client_sock->watchers;
+    p2->reader_watchers = &client_sock->watchers;
+    p2->writer_watchers = &newsock->watchers;
+
+    if (listener->shared_size) {
+        unsigned int size = client_sock->shared_size < listener->shared_size
+                            ? client_sock->shared_size : listener->shared_size;
+        newsock->shared_size = size;
+        client_sock->shared_size = size;
+
+        shm_region* r1 = shm_create(size);
+        shm_region* r2 = shm_create(size);
+        client_sock->peer_s.shm_send = newsock->peer_s.shm_recv = r1;
+        newsock->peer_s.shm_send = client_sock->peer_s.shm_recv = r2;
+        r1->writer_watchers = &client_sock->watchers;
+        r2->writer_watchers = &newsock->watchers;
+    }
+
+    newfcb->streamobj = newsock;
+    newfcb->streamfunc = &socket_ops;
+
+    poll_notify(&client_sock->watchers, EVENT_WRITE);
+}
+
+
+/*
+    Connect a client directly to an acceptor waiting on the listener, if
+    there is one. This saves the round-trip through the request queue: 
+    the connector does not sleep, and the acceptor wakes up once, with
+    its connection ready. Returns 1 on success.
+ */
+static int connect_handoff(socket_cb* listener, socket_cb* client_sock, TimerDuration start)
+{
+    if (is_rlist_empty(&listener->listener_s.acceptors))
+        return 0;
+
+    acceptor* acc = rlist_pop_front(&listener->listener_s.acceptors)->obj;
+    connect_peers(listener, acc->lfcb, acc->fcb, client_sock, start);
+    acc->connected = 1;
+    kernel_signal(&acc->ready);
+    listener->listener_s.accepted++;
+    return 1;
+}
+
+
+int sys_Connect(Fid_t sock, int port, timeout_t timeout)
 {
     FCB* fcb = get_fcb(sock);
     
@@ -221,142 +732,269 @@ int sys_Connect(Fid_t sock, port_t port, timeout_t timeout)
 
     socket_cb* client_scb = (socket_cb*)fcb->streamobj;
 
+    if (client_scb->pending)
+        return connect_progress(client_scb);
+
     if (client_scb->type != SOCKET_UNBOUND) 
         return -1;
     
+    /* Check the range before the port is narrowed to a port_t */
     if (port < 0 || port > MAX_PORT) 
         return -1;
 
     
-    Mutex_Lock(&port_map_lock);
-    socket_cb* listener = PORT_MAP[port];
+    socket_cb* listener = port_pick_listener(port);
     
-    if (listener == NULL || listener->type != SOCKET_LISTENER) {
-        Mutex_Unlock(&port_map_lock);
+    if (listener == NULL || listener->message_mode != client_scb->message_mode
+            || (listener->shared_size != 0) != (client_scb->shared_size != 0))
         return -1;
+
+    TimerDuration start = bios_clock();
+    if (connect_handoff(listener, client_scb, start))
+        return 0;
+
+    /* Refuse at once when the backlog is full */
+    if (listener->backlog && listener->listener_s.queued >= listener->backlog)
+        return -1;
+
+    if (fcb_nonblocking(fcb)) {
+        connection_request* preq = (connection_request*)xmalloc(sizeof(connection_request));
+        preq->admitted = 0;
+        preq->peer = client_scb;
+        preq->start = start;
+        preq->connected_cv = COND_INIT;
+        rlnode_init(&preq->queue_node, preq);
+        listener_enqueue(listener, preq);
+
+        client_scb->pending = preq;
+        return WOULDBLOCK;
     }
-    Mutex_Unlock(&port_map_lock);
 
     client_scb->refcount++; 
 
     connection_request req;
     req.admitted = 0;
     req.peer = client_scb;
+    req.start = start;
     req.connected_cv = COND_INIT;
     rlnode_init(&req.queue_node, &req);
-
-    rlist_push_back(&listener->listener_s.queue, &req.queue_node);
-    kernel_signal(&listener->listener_s.req_available);
+    listener_enqueue(listener, &req);
 
     int ret = 0;
-    while (!req.admitted) {
+    while (req.admitted == 0) {
         if (timeout == 0) {
              kernel_wait(&req.connected_cv, SCHED_PIPE);
         } else {
              int w = kernel_timedwait(&req.connected_cv, SCHED_PIPE, timeout);
-             if (w == 0 && !req.admitted) {
-                 rlist_remove(&req.queue_node);
+             if (w == 0 && req.admitted == 0) {
+                 listener_remove(&req);
                  ret = -1;
                  goto cleanup;
              }
         }
     }
-    
-    client_scb->type = SOCKET_PEER;
+
+    if (req.admitted < 0)
+        ret = -1;
 
 cleanup:
-    client_scb->refcount--;
+    /* The socket may have been closed while we waited */
+    if (--client_scb->refcount == 0) {
+        socket_destroy(client_scb);
+        ret = -1;
+    }
     return ret;
 }
 
-Fid_t sys_Accept(Fid_t lsock)
+/* Find the listener behind a file id, or NULL */
+static socket_cb* get_listener(Fid_t lsock, FCB** lfcb)
 {
-    FCB* lfcb = get_fcb(lsock);
-    
-    if (!lfcb) 
-        return NOFILE;
-    
+    FCB* fcb = get_fcb(lsock);
+    if (fcb == NULL || fcb->streamfunc != &socket_ops)
+        return NULL;
 
-    if (lfcb->streamfunc != &socket_ops) 
-        return NOFILE;
+    socket_cb* listener = (socket_cb*)fcb->streamobj;
+    if (listener->type != SOCKET_LISTENER)
+        return NULL;
 
-    socket_cb* listener = (socket_cb*)lfcb->streamobj;
-    
+    *lfcb = fcb;
+    return listener;
+}
 
-    if (listener->type != SOCKET_LISTENER) 
-        return NOFILE;
 
+/* Admit the first queued request in newfcb */
+static void accept_request(socket_cb* listener, FCB* lfcb, FCB* newfcb)
+{
+    connection_request* req = listener_dequeue(listener);
+
+    connect_peers(listener, lfcb, newfcb, req->peer, req->start);
+    listener->listener_s.accepted++;
+
+    req->admitted = 1;
+    kernel_signal(&req->connected_cv);
+}
+
+
+/*
+    While an acceptor waits, its reserved stream is visible to the other
+    threads of the process, which may even close it.
+ */
+static int accepting_close(void* obj) { return 0; }
+
+static file_ops accepting_ops = {
+    .Close = accepting_close,
+    .kind = STREAM_SOCKET
+};
+
+
+/*
+    Wait for a connection, with fid reserved for it. Returns 1 if a
+    connector handed a connection over in the reserved stream, 0 if there
+    are queued requests. On error, the fid is released and WOULDBLOCK is
+    returned, or NOFILE if the listener or the reserved fid were closed
+    while waiting.
+ */
+static int listener_wait(socket_cb* listener, FCB* lfcb, Fid_t fid, FCB* fcb)
+{
+    if (!is_rlist_empty(&listener->listener_s.queue))
+        return 0;
+    if (fcb_nonblocking(lfcb)) {
+        FCB_unreserve(1, &fid, &fcb);
+        return WOULDBLOCK;
+    }
+
+    /* The queue is empty, this is a good time to top up the reservation */
+    listener_reserve(listener);
+
+    acceptor acc = { .lfcb = lfcb, .fcb = fcb, .connected = 0, .ready = COND_INIT };
+    rlnode_init(&acc.node, &acc);
+    rlist_push_back(&listener->listener_s.acceptors, &acc.node);
+
+    fcb->streamobj = NULL;
+    fcb->streamfunc = &accepting_ops;
+    FCB_incref(fcb);
+
+    int ret;
     listener->refcount++;
+    while (1) {
+        kernel_wait(&acc.ready, SCHED_PIPE);
 
-    while (is_rlist_empty(&listener->listener_s.queue)) {
-        kernel_wait(&listener->listener_s.req_available, SCHED_PIPE);
-        
+        if (acc.connected) {
+            ret = 1;
+            break;
+        }
         if (listener->type != SOCKET_LISTENER) {
-            listener->refcount--;
-            return NOFILE;
+            ret = NOFILE;
+            break;
+        }
+        if (!is_rlist_empty(&listener->listener_s.queue)) {
+            ret = 0;
+            break;
         }
     }
+    rlist_remove(&acc.node);
+
+    /* The listener may have been closed while we waited */
+    if (--listener->refcount == 0)
+        socket_release(listener);
+
+    /* If the fid was closed, this closes the stream */
+    int closed = (get_fcb(fid) != fcb);
+    FCB_decref(fcb);
+    if (closed)
+        return NOFILE;
+
+    if (ret == NOFILE)
+        FCB_unreserve(1, &fid, &fcb);
+    return ret;
+}
 
-    rlnode* node = rlist_pop_front(&listener->listener_s.queue);//vrisko proto request sto queue
-    connection_request* req = (connection_request*)node->obj;
+
+Fid_t sys_Accept(Fid_t lsock)
+{
+    FCB* lfcb;
+    socket_cb* listener = get_listener(lsock, &lfcb);
+    if (listener == NULL)
+        return NOFILE;
 
     Fid_t newfid;
     FCB* newfcb;
-    if (FCB_reserve(1, &newfid, &newfcb) == 0) {
-        listener->refcount--;
+    if (FCB_reserve(1, &newfid, &newfcb) == 0)
         return NOFILE; 
-    }
 
-    socket_cb* newsock = (socket_cb*)xmalloc(sizeof(socket_cb));
-    if (!newsock) {
-        FCB_unreserve(1, &newfid, &newfcb);
-        listener->refcount--;
-        return NOFILE;
-    }
+    int ret = listener_wait(listener, lfcb, newfid, newfcb);
+    if (ret < 0)
+        return ret;
 
-    memset(newsock, 0, sizeof(socket_cb));
-    newsock->refcount = 1;
-    newsock->type = SOCKET_PEER;
-    newsock->fcb = newfcb;
-    newsock->port = NOPORT; 
+    if (ret == 0)
+        accept_request(listener, lfcb, newfcb);
+    return newfid;
+}
 
-    socket_cb* client_sock = req->peer;
 
-    pipe_cb* p1 = pipe_create();
-    pipe_cb* p2 = pipe_create();
-    
-    if (!p1 || !p2) {
-        if (p1) free(p1);
-        if (p2) free(p2);
-        free(newsock);
-        FCB_unreserve(1, &newfid, &newfcb);
-        listener->refcount--;
-        return NOFILE;
-    }
+int sys_AcceptMany(Fid_t lsock, Fid_t* fids, unsigned int n)
+{
+    FCB* lfcb;
+    socket_cb* listener = get_listener(lsock, &lfcb);
+    if (listener == NULL || fids == NULL || n == 0)
+        return -1;
 
-    p1->refcount = 2; 
-    p2->refcount = 2;
+    FCB* newfcb;
+    if (FCB_reserve(1, &fids[0], &newfcb) == 0)
+        return -1;
 
-    //Server
-    newsock->peer_s.peer = client_sock;
-    newsock->peer_s.read_pipe = p1;    
-    newsock->peer_s.write_pipe = p2;   
+    int ret = listener_wait(listener, lfcb, fids[0], newfcb);
+    if (ret < 0)
+        return ret;
+
+    /* The first connection may have been handed over */
+    unsigned int count = 0;
+    if (ret == 1) {
+        count = 1;
+        if (count == n || listener->listener_s.queued == 0
+                || FCB_reserve(1, &fids[count], &newfcb) == 0)
+            return count;
+    }
 
-    //Client 
-    client_sock->peer_s.peer = newsock;
-    client_sock->peer_s.read_pipe = p2;   
-    client_sock->peer_s.write_pipe = p1; 
+    /* Here, newfcb is reserved for fids[count] and there is a request */
+    while (1) {
+        accept_request(listener, lfcb, newfcb);
+        count++;
+        if (count == n || listener->listener_s.queued == 0
+                || FCB_reserve(1, &fids[count], &newfcb) == 0)
+            break;
+    }
 
-    newfcb->streamobj = newsock;
-    newfcb->streamfunc = &socket_ops;
+    return count;
+}
 
-    req->admitted = 1;
-    kernel_signal(&req->connected_cv);
+static void socket_shutdown_read(socket_cb* scb)
+{
+    if (scb->peer_s.read_pipe) {
+        scb->rx_stats = scb->peer_s.read_pipe->stats;
+        pipe_close(scb->peer_s.read_pipe, 0);
+        scb->peer_s.read_pipe = NULL;
+    }
+    if (scb->peer_s.shm_recv) {
+        shm_close(scb->peer_s.shm_recv, 0);
+        scb->peer_s.shm_recv = NULL;
+    }
+}
 
-    listener->refcount--;
-    return newfid;
+static void socket_shutdown_write(socket_cb* scb)
+{
+    if (scb->peer_s.write_pipe) {
+        scb->tx_stats = scb->peer_s.write_pipe->stats;
+        pipe_close(scb->peer_s.write_pipe, 1);
+        scb->peer_s.write_pipe = NULL;
+    }
+    if (scb->peer_s.shm_send) {
+        shm_close(scb->peer_s.shm_send, 1);
+        scb->peer_s.shm_send = NULL;
+    }
 }
 
+
 int sys_ShutDown(Fid_t sock, shutdown_mode how)
 {
     FCB* fcb = get_fcb(sock);
@@ -375,28 +1013,16 @@ int sys_ShutDown(Fid_t sock, shutdown_mode how)
 
     switch (how) {
         case SHUTDOWN_READ:
-            if (scb->peer_s.read_pipe) {
-                pipe_close(scb->peer_s.read_pipe, 0);
-                scb->peer_s.read_pipe = NULL;
-            }
+            socket_shutdown_read(scb);
             break;
 
         case SHUTDOWN_WRITE:
-            if (scb->peer_s.write_pipe) {
-                pipe_close(scb->peer_s.write_pipe, 1);
-                scb->peer_s.write_pipe = NULL;
-            }
+            socket_shutdown_write(scb);
             break;
 
         case SHUTDOWN_BOTH:
-            if (scb->peer_s.read_pipe) {
-                pipe_close(scb->peer_s.read_pipe, 0);
-                scb->peer_s.read_pipe = NULL;
-            }
-            if (scb->peer_s.write_pipe) {
-                pipe_close(scb->peer_s.write_pipe, 1);
-                scb->peer_s.write_pipe = NULL;
-            }
+            socket_shutdown_read(scb);
+            socket_shutdown_write(scb);
             break;
 
         default:
@@ -405,4 +1031,284 @@ int sys_ShutDown(Fid_t sock, shutdown_mode how)
     }
 
     return 0;
-}
\ No newline at end of file
+}
+
+
+int sys_SetSocketOption(Fid_t sock, socket_option opt, int value)
+{
+    FCB* fcb = get_fcb(sock);
+    if (fcb == NULL || fcb->streamfunc != &socket_ops)
+        return -1;
+
+    socket_cb* scb = (socket_cb*)fcb->streamobj;
+
+    /* Only the backlog of a listener can be changed */
+    int listening = (scb->type == SOCKET_LISTENER && opt == SOCKOPT_BACKLOG);
+    if ((scb->type != SOCKET_UNBOUND && !listening) || scb->pending)
+        return -1;
+
+    switch (opt) {
+        case SOCKOPT_MESSAGE:
+            scb->message_mode = (value != 0);
+            return 0;
+        case SOCKOPT_BACKLOG:
+            if (value < 0 || value > MAX_BACKLOG)
+                return -1;
+            scb->backlog = value;
+            if (listening)
+                listener_reserve(scb);
+            return 0;
+        case SOCKOPT_REUSEPORT:
+            scb->reuseport = (value != 0);
+            return 0;
+        case SOCKOPT_SHARED:
+            if (value < 0 || value > MAX_SHARED_SIZE)
+                return -1;
+            scb->shared_size = value;
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+
+
+/* The connected socket of a shared-mode call, or NULL */
+static socket_cb* get_shared_peer(Fid_t sock, FCB** fcb)
+{
+    *fcb = get_fcb(sock);
+    if (*fcb == NULL || (*fcb)->streamfunc != &socket_ops)
+        return NULL;
+
+    socket_cb* scb = (socket_cb*)(*fcb)->streamobj;
+    if (scb->type != SOCKET_PEER || scb->shared_size == 0)
+        return NULL;
+    return scb;
+}
+
+
+/*
+    While these calls block, the socket may be shut down by another thread.
+    They hold a reference to their region, and check that it is still 
+    attached to the socket.
+ */
+
+int sys_ShmReserve(Fid_t sock, unsigned int size, void** buf)
+{
+    FCB* fcb;
+    socket_cb* scb = get_shared_peer(sock, &fcb);
+    if (scb == NULL || buf == NULL || size == 0)
+        return -1;
+
+    shm_region* r = scb->peer_s.shm_send;
+    if (r == NULL || size > r->size)
+        return -1;
+
+    /* A new reservation replaces the previous one */
+    r->reserved = 0;
+
+    int ret = 0;
+    r->refcount++;
+    while (1) {
+        if (scb->peer_s.shm_send != r || r->reader_closed) {
+            ret = -1;
+            break;
+        }
+        /* An empty ring starts over, so that any message fits */
+        if (r->head == r->tail)
+            r->head = r->tail = r->received = 0;
+        if (shm_has_room(r, size)) {
+            /* Skip the end of the ring, if the message does not fit there */
+            r->tail += shm_padding(r, size);
+            r->reserved = size;
+            *buf = r->base + r->tail % r->size;
+            break;
+        }
+        if (fcb_nonblocking(fcb)) {
+            ret = WOULDBLOCK;
+            break;
+        }
+        scb->peer_s.write_pipe->stats.write_waits++;
+        kernel_wait(&r->has_credit, SCHED_PIPE);
+    }
+    shm_decref(r);
+    return ret;
+}
+
+
+int sys_ShmSend(Fid_t sock, unsigned int size)
+{
+    FCB* fcb;
+    socket_cb* scb = get_shared_peer(sock, &fcb);
+    if (scb == NULL)
+        return -1;
+
+    shm_region* r = scb->peer_s.shm_send;
+    if (r == NULL || size == 0 || size > r->reserved)
+        return -1;
+
+    /* The descriptor is sent as a message, as a whole */
+    shm_desc desc = { .pos = r->tail, .len = size };
+
+    r->refcount++;
+    FCB_incref(fcb);
+    TCB* tcb = cur_thread();
+    int saved_flags = tcb->io_flags;
+    tcb->io_flags = saved_flags | fcb->flags;
+    int ret = pipe_write(scb->peer_s.write_pipe, (const char*)&desc, sizeof(desc));
+    tcb->io_flags = saved_flags;
+
+    if (ret == sizeof(desc)) {
+        r->tail += size;
+        r->reserved = 0;
+        scb->bytes_out += size;
+        ret = size;
+    }
+    FCB_decref(fcb);
+    shm_decref(r);
+    return ret;
+}
+
+
+int sys_ShmReceive(Fid_t sock, void** buf)
+{
+    FCB* fcb;
+    socket_cb* scb = get_shared_peer(sock, &fcb);
+    if (scb == NULL || buf == NULL)
+        return -1;
+
+    shm_region* r = scb->peer_s.shm_recv;
+    if (r == NULL)
+        return -1;
+
+    /* Return the space of the previous message to the writer */
+    if (r->head != r->received) {
+        r->head = r->received;
+        kernel_broadcast(&r->has_credit);
+        if (r->writer_watchers)
+            poll_notify(r->writer_watchers, EVENT_WRITE);
+    }
+
+    shm_desc desc;
+    r->refcount++;
+    FCB_incref(fcb);
+    TCB* tcb = cur_thread();
+    int saved_flags = tcb->io_flags;
+    tcb->io_flags = saved_flags | fcb->flags;
+    int ret = pipe_read(scb->peer_s.read_pipe, (char*)&desc, sizeof(desc));
+    tcb->io_flags = saved_flags;
+
+    if (ret == sizeof(desc)) {
+        if (scb->peer_s.shm_recv == r) {
+            r->received = desc.pos + desc.len;
+            *buf = r->base + desc.pos % r->size;
+            scb->bytes_in += desc.len;
+            ret = desc.len;
+        } else {
+            ret = -1;
+        }
+    }
+    FCB_decref(fcb);
+    shm_decref(r);
+    return ret;
+}
+
+
+
+/*
+    Socket information streams. The records of all sockets are taken when
+    the stream is opened, and returned by reads, as whole records.
+ */
+typedef struct socket_info_cb {
+    sockinfo* records;
+    unsigned int count;
+    unsigned int next;
+} socket_info_cb;
+
+
+static void socket_fill_info(socket_cb* scb, sockinfo* info)
+{
+    memset(info, 0, sizeof(sockinfo));
+    info->pid = scb->owner;
+    info->port = scb->port;
+    info->bytes_in = scb->bytes_in;
+    info->bytes_out = scb->bytes_out;
+    info->connect_latency = scb->connect_latency;
+
+    switch (scb->type) {
+    case SOCKET_UNBOUND:
+        info->state = SOCKINFO_UNBOUND;
+        break;
+    case SOCKET_LISTENER:
+        info->state = SOCKINFO_LISTENER;
+        info->queued = scb->listener_s.queued;
+        info->peak_queued = scb->listener_s.peak_queued;
+        info->accepted = scb->listener_s.accepted;
+        info->reserved = scb->listener_s.nspares;
+        break;
+    case SOCKET_PEER: {
+        info->state = SOCKINFO_PEER;
+        pipe_stats* rx = scb->peer_s.read_pipe ? &scb->peer_s.read_pipe->stats : &scb->rx_stats;
+        pipe_stats* tx = scb->peer_s.write_pipe ? &scb->peer_s.write_pipe->stats : &scb->tx_stats;
+        info->read_waits = rx->read_waits;
+        info->rx_peak = rx->peak_count;
+        info->write_waits = tx->write_waits;
+        info->tx_peak = tx->peak_count;
+        info->rx_queued = scb->peer_s.read_pipe ? scb->peer_s.read_pipe->count : 0;
+        info->tx_queued = scb->peer_s.write_pipe ? scb->peer_s.write_pipe->count : 0;
+        break;
+    }
+    }
+}
+
+
+static int socket_info_read(void* obj, char* buf, unsigned int size)
+{
+    socket_info_cb* sicb = (socket_info_cb*)obj;
+    unsigned int n = size / sizeof(sockinfo);
+
+    if (n > sicb->count - sicb->next)
+        n = sicb->count - sicb->next;
+    memcpy(buf, sicb->records + sicb->next, n * sizeof(sockinfo));
+    sicb->next += n;
+    return n * sizeof(sockinfo);
+}
+
+static int socket_info_close(void* obj)
+{
+    socket_info_cb* sicb = (socket_info_cb*)obj;
+    free(sicb->records);
+    free(sicb);
+    return 0;
+}
+
+static file_ops socket_info_ops = {
+    .Read = socket_info_read,
+    .Write = NULL,
+    .Close = socket_info_close,
+    .Open = NULL,
+    .kind = STREAM_INFO
+};
+
+
+Fid_t sys_OpenSocketInfo()
+{
+    Fid_t fid;
+    FCB* fcb;
+
+    if (FCB_reserve(1, &fid, &fcb) == 0)
+        return NOFILE;
+
+    socket_info_cb* sicb = (socket_info_cb*)xmalloc(sizeof(socket_info_cb));
+    sicb->count = socket_count;
+    sicb->next = 0;
+    sicb->records = (sockinfo*)xmalloc((socket_count ? socket_count : 1) * sizeof(sockinfo));
+
+    unsigned int i = 0;
+    for (rlnode* n = socket_list.next; n != &socket_list; n = n->next)
+        socket_fill_info(n->obj, &sicb->records[i++]);
+
+    fcb->streamobj = sicb;
+    fcb->streamfunc = &socket_info_ops;
+    return fid;
+}
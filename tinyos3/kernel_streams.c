@@ -5,39 +5,75 @@
 #include "kernel_streams.h"
 #include "kernel_sched.h"
 #include "kernel_proc.h"
+#include "kernel_poll.h"
 
-#define MAX_FILES MAX_PROC
+/*
+  The file table.
+
+  FCBs are allocated in slabs of FCB_SLAB_SIZE, as they are needed, so 
+  there is no fixed bound on the number of open streams besides the 
+  fid limits of the processes. Slabs are only returned to the system 
+  at the next boot.
+
+  Released FCBs are pushed to the front of the free list, so that the 
+  most recently closed (cache-warm) FCB is reused first. The free list 
+  is protected by the kernel lock.
+ */
+#define FCB_SLAB_SIZE 256
 
-FCB FT[MAX_FILES];
-rlnode FCB_freelist;
+typedef struct fcb_slab {
+  struct fcb_slab* next;
+  FCB fcb[FCB_SLAB_SIZE];
+} fcb_slab;
+
+static fcb_slab* FCB_slabs;
+static rlnode FCB_freelist;
 
 
 void initialize_files()
 {
+  /* Drop the slabs of a previous boot */
+  while(FCB_slabs != NULL) {
+    fcb_slab* slab = FCB_slabs;
+    FCB_slabs = slab->next;
+    free(slab);
+  }
+
   rlnode_init(&FCB_freelist,NULL);
-  for(int i=0;i<MAX_FILES;i++) {
+}
 
-    FT[i].refcount = 0;
-    rlnode_init(& FT[i].freelist_node, &FT[i]);
-    rlist_push_back(&FCB_freelist, & FT[i].freelist_node);
+
+/* Add a new slab to the free list */
+static void new_FCB_slab()
+{
+  fcb_slab* slab = (fcb_slab*) xmalloc(sizeof(fcb_slab));
+  slab->next = FCB_slabs;
+  FCB_slabs = slab;
+
+  for(int i=0;i<FCB_SLAB_SIZE;i++) {
+    FCB* fcb = & slab->fcb[i];
+    fcb->refcount = 0;
+    rlnode_init(& fcb->freelist_node, fcb);
+    rlnode_init(& fcb->event_regs, NULL);
+    rlist_push_back(&FCB_freelist, & fcb->freelist_node);
   }
 }
 
 
 FCB* acquire_FCB()
 {
-  if(! is_rlist_empty(& FCB_freelist)) {
-    FCB* fcb = rlist_pop_front(& FCB_freelist)->fcb;
-    fcb->refcount = 0;
-    return fcb;
-  }
-  else
-    return NULL;
+  if(is_rlist_empty(& FCB_freelist))
+    new_FCB_slab();
+  FCB* fcb = rlist_pop_front(& FCB_freelist)->fcb;
+
+  fcb->refcount = 0;
+  fcb->flags = 0;
+  return fcb;
 }
 
 void release_FCB(FCB* fcb)
 {
-  rlist_push_back(& FCB_freelist, & fcb->freelist_node);
+  rlist_push_front(& FCB_freelist, & fcb->freelist_node);
 }
 
 
@@ -52,6 +88,7 @@ int FCB_decref(FCB* fcb)
   assert(fcb);
   fcb->refcount --;
   if(fcb->refcount==0) {
+    poll_detach(fcb);
     int retval = fcb->streamfunc->Close(fcb->streamobj);
     release_FCB(fcb);
     return retval;
@@ -62,20 +99,194 @@ int FCB_decref(FCB* fcb)
 
 
 
+/*
+  The file id table.
+
+  The FIDT of a process starts with MAX_FILEID slots stored in the PCB, 
+  and doubles as needed, up to the file id limit of the process. A bitmap 
+  marks the used slots, so that the lowest free file id is found by 
+  scanning for a word that is not full, starting from fid_hint (no word
+  before it has a free bit).
+
+  A file id can be used (its bit is set) while its slot is still NULL: 
+  FCB_reserve takes the file ids before it has the FCBs.
+ */
+#define FID_WORDS(n) (((n) + 63) / 64)
+#define FID_BIT(fid) ((uint64_t)1 << ((fid) % 64))
+
+unsigned int fid_limit(PCB* pcb)
+{
+  return (pcb->max_fids > 0) ? pcb->max_fids : MAX_FILEID;
+}
+
+void fidt_init(PCB* pcb)
+{
+  for(int i=0; i<MAX_FILEID; i++)
+    pcb->fidt_inline[i] = NULL;
+  pcb->fid_used_inline = 0;
+  pcb->cloexec_inline = 0;
+
+  pcb->FIDT = pcb->fidt_inline;
+  pcb->fidt_size = MAX_FILEID;
+  pcb->fid_used = &pcb->fid_used_inline;
+  pcb->cloexec = &pcb->cloexec_inline;
+  pcb->fid_hint = 0;
+  pcb->fid_count = 0;
+}
+
+/* Grow the table of the process so that it has slot fid */
+static void fidt_grow(PCB* pcb, Fid_t fid)
+{
+  unsigned int oldsize = pcb->fidt_size;
+  unsigned int newsize = oldsize;
+  while(newsize <= (unsigned int)fid) 
+    newsize *= 2;
+
+  FCB** fidt = (FCB**)xmalloc(newsize * sizeof(FCB*));
+  memcpy(fidt, pcb->FIDT, oldsize * sizeof(FCB*));
+  memset(fidt + oldsize, 0, (newsize - oldsize) * sizeof(FCB*));
+  if(pcb->FIDT != pcb->fidt_inline)
+    free(pcb->FIDT);
+  pcb->FIDT = fidt;
+
+  unsigned int oldwords = FID_WORDS(oldsize), newwords = FID_WORDS(newsize);
+  if(newwords > oldwords) {
+    uint64_t* used = (uint64_t*)xmalloc(newwords * sizeof(uint64_t));
+    uint64_t* cloexec = (uint64_t*)xmalloc(newwords * sizeof(uint64_t));
+    memcpy(used, pcb->fid_used, oldwords * sizeof(uint64_t));
+    memcpy(cloexec, pcb->cloexec, oldwords * sizeof(uint64_t));
+    memset(used + oldwords, 0, (newwords - oldwords) * sizeof(uint64_t));
+    memset(cloexec + oldwords, 0, (newwords - oldwords) * sizeof(uint64_t));
+    if(pcb->fid_used != &pcb->fid_used_inline) {
+      free(pcb->fid_used);
+      free(pcb->cloexec);
+    }
+    pcb->fid_used = used;
+    pcb->cloexec = cloexec;
+  }
+
+  pcb->fidt_size = newsize;
+}
+
+/* Take the lowest free file id, or return NOFILE */
+static Fid_t fid_take(PCB* pcb)
+{
+  unsigned int limit = fid_limit(pcb);
+  unsigned int words = FID_WORDS(pcb->fidt_size);
+
+  for(unsigned int w = pcb->fid_hint; 64*w < limit; w++) {
+    uint64_t used = (w < words) ? pcb->fid_used[w] : 0;
+    if(~used == 0) continue;
+
+    Fid_t fid = 64*w + __builtin_ctzll(~used);
+    if((unsigned int)fid >= limit) break;
+    pcb->fid_hint = w;
+    if((unsigned int)fid >= pcb->fidt_size)
+      fidt_grow(pcb, fid);
+    pcb->fid_used[w] |= FID_BIT(fid);
+    pcb->fid_count++;
+    return fid;
+  }
+  return NOFILE;
+}
+
+/* Release a file id, leaving its slot empty */
+static void fid_put(PCB* pcb, Fid_t fid)
+{
+  pcb->FIDT[fid] = NULL;
+  pcb->fid_used[fid / 64] &= ~FID_BIT(fid);
+  pcb->cloexec[fid / 64] &= ~FID_BIT(fid);
+  pcb->fid_count--;
+  if(fid / 64 < pcb->fid_hint) 
+    pcb->fid_hint = fid / 64;
+}
+
+FCB* fidt_set(PCB* pcb, Fid_t fid, FCB* fcb)
+{
+  if((unsigned int)fid >= pcb->fidt_size)
+    fidt_grow(pcb, fid);
+
+  FCB* old = pcb->FIDT[fid];
+  if(! (pcb->fid_used[fid / 64] & FID_BIT(fid))) {
+    pcb->fid_used[fid / 64] |= FID_BIT(fid);
+    pcb->fid_count++;
+  }
+  pcb->cloexec[fid / 64] &= ~FID_BIT(fid);
+  pcb->FIDT[fid] = fcb;
+  return old;
+}
+
+void fidt_inherit(PCB* parent, PCB* child)
+{
+  unsigned int words = FID_WORDS(parent->fidt_size);
+  for(unsigned int w = 0; w < words; w++) {
+    uint64_t inherit = parent->fid_used[w] & ~parent->cloexec[w];
+    while(inherit) {
+      Fid_t fid = 64*w + __builtin_ctzll(inherit);
+      inherit &= inherit - 1;
+      FCB* fcb = parent->FIDT[fid];
+      if(fcb) {
+        FCB_incref(fcb);
+        fidt_set(child, fid, fcb);
+      }
+    }
+  }
+}
+
+void fidt_clear(PCB* pcb)
+{
+  unsigned int words = FID_WORDS(pcb->fidt_size);
+  for(unsigned int w = 0; w < words; w++) {
+    uint64_t used = pcb->fid_used[w];
+    while(used) {
+      Fid_t fid = 64*w + __builtin_ctzll(used);
+      used &= used - 1;
+      if(pcb->FIDT[fid] != NULL)
+        FCB_decref(pcb->FIDT[fid]);
+    }
+  }
+
+  if(pcb->FIDT != pcb->fidt_inline)
+    free(pcb->FIDT);
+  if(pcb->fid_used != &pcb->fid_used_inline) {
+    free(pcb->fid_used);
+    free(pcb->cloexec);
+  }
+  fidt_init(pcb);
+}
+
+
+/* Account for a transfer on a stream */
+static inline void account_io(FCB* fcb, int n, int write)
+{
+  if(n > 0) {
+    procusage* u = &CURPROC->usage;
+    if(write)
+      u->bytes_written[fcb->streamfunc->kind] += n;
+    else
+      u->bytes_read[fcb->streamfunc->kind] += n;
+  }
+}
+
+
 int FCB_reserve(size_t num, Fid_t *fid, FCB** fcb)
 {
     PCB* cur = CURPROC;
-    size_t f=0;
     uint i;
 
     /* Find distinct fids */
     for(i=0; i<num; i++) {
-	while(f<MAX_FILEID && cur->FIDT[f]!=NULL)
-	    f++;
-	if(f==MAX_FILEID) break;
-	fid[i] = f; f++;
+	fid[i] = fid_take(cur);
+	if(fid[i] == NOFILE) break;
+    }
+    if(i<num) {
+	/* Roll back */
+	while(i>0) {
+	    fid_put(cur, fid[i-1]);
+	    i--;
+	}
+	return 0;
     }
-    if(i<num) return 0;
     /* Allocate FCBs */
     for(i=0;i<num;i++)
 	if((fcb[i] = acquire_FCB()) == NULL)
@@ -86,6 +297,8 @@ int FCB_reserve(size_t num, Fid_t *fid, FCB** fcb)
 	    release_FCB(fcb[i-1]);
 	    i--;
 	}
+	for(i=0;i<num;i++)
+	    fid_put(cur, fid[i]);
 	return 0;
     }
     /* Found all */
@@ -103,7 +316,7 @@ void FCB_unreserve(size_t num, Fid_t *fid, FCB** fcb)
     PCB* cur = CURPROC;
     for(size_t i=0; i<num ; i++) {
 	assert(cur->FIDT[fid[i]]==fcb[i]);
-	cur->FIDT[fid[i]] = NULL;
+	fid_put(cur, fid[i]);
 	release_FCB(fcb[i]);
     }
 }
@@ -122,7 +335,7 @@ void FCB_unreserve(size_t num, Fid_t *fid, FCB** fcb)
 
 FCB* get_fcb(Fid_t fid)
 {
-  if(fid < 0 || fid >= MAX_FILEID) return NULL;
+  if(fid < 0 || fid >= CURPROC->fidt_size) return NULL;
 
   return CURPROC->FIDT[fid];
 }
@@ -145,9 +358,17 @@ int sys_Read(Fid_t fd, char *buf, unsigned int size)
     /* make sure that the stream will not be closed (by another thread) 
        while we are using it! */
     FCB_incref(fcb);
+
+    /* Expose the stream flags to the driver */
+    TCB* tcb = cur_thread();
+    int saved_flags = tcb->io_flags;
+    tcb->io_flags = saved_flags | fcb->flags;
   
     if(devread)
       retcode = devread(sobj, buf, size);
+    account_io(fcb, retcode, 0);
+
+    tcb->io_flags = saved_flags;
 
     /* Need to decrease the reference to FCB */
     FCB_decref(fcb);
@@ -178,10 +399,17 @@ int sys_Write(Fid_t fd, const char *buf, unsigned int size)
     /* make sure that the stream will not be closed (by another thread) 
        while we are using it! */
     FCB_incref(fcb);
-  
+
+    /* Expose the stream flags to the driver */
+    TCB* tcb = cur_thread();
+    int saved_flags = tcb->io_flags;
+    tcb->io_flags = saved_flags | fcb->flags;
 
     if(devwrite)
       retcode = devwrite(sobj, buf, size);
+    account_io(fcb, retcode, 1);
+
+    tcb->io_flags = saved_flags;
 
     /* Need to decrease the reference to FCB */
     FCB_decref(fcb);
@@ -193,14 +421,77 @@ int sys_Write(Fid_t fd, const char *buf, unsigned int size)
 }
 
 
+/*
+  Copy data between two streams, inside the kernel, a chunk at a time.
+  A chunk fits in a message, so that message-mode sockets take it whole.
+
+  The input honors its flags. Once a chunk has been read, it is written 
+  in full, blocking if need be, so that no data is lost. A non-blocking 
+  output is therefore polled before each chunk.
+ */
+#define TRANSFER_CHUNK MAX_MESSAGE_SIZE
+
+int sys_TransferFile(Fid_t out, Fid_t in, unsigned int len)
+{
+  FCB* ofcb = get_fcb(out);
+  FCB* ifcb = get_fcb(in);
+
+  if(ofcb==NULL || ifcb==NULL || ofcb->streamfunc->Write==NULL || ifcb->streamfunc->Read==NULL)
+    return -1;
+
+  FCB_incref(ofcb);
+  FCB_incref(ifcb);
+
+  TCB* tcb = cur_thread();
+  int saved_flags = tcb->io_flags;
+  char chunk[TRANSFER_CHUNK];
+  unsigned int done = 0;
+  int rc = 0;
+
+  while(done < len) {
+    if((ofcb->flags & FID_NONBLOCK) && !(stream_poll(ofcb, NULL) & EVENT_WRITE)) {
+      rc = WOULDBLOCK;
+      break;
+    }
+
+    unsigned int n = len - done;
+    if(n > TRANSFER_CHUNK) n = TRANSFER_CHUNK;
+
+    tcb->io_flags = saved_flags | ifcb->flags;
+    rc = ifcb->streamfunc->Read(ifcb->streamobj, chunk, n);
+    if(rc <= 0) break;
+    account_io(ifcb, rc, 0);
+    n = rc;
+
+    tcb->io_flags = saved_flags & ~FID_NONBLOCK;
+    for(unsigned int w = 0; w < n; w += rc) {
+      rc = ofcb->streamfunc->Write(ofcb->streamobj, chunk + w, n - w);
+      if(rc <= 0) goto finish;
+      account_io(ofcb, rc, 1);
+    }
+    done += n;
+  }
+
+finish:
+  tcb->io_flags = saved_flags;
+
+  FCB_decref(ifcb);
+  FCB_decref(ofcb);
+
+  /* Errors and WOULDBLOCK are only reported if nothing was transferred */
+  return (done > 0 || rc >= 0) ? (int)done : rc;
+}
+
+
 int sys_Close(int fd)
 {
-  int retcode = (fd>=0 && fd<MAX_FILEID) ? 0 : -1;  /* Closing a closed fd is legal! */
+  PCB* cur = CURPROC;
+  int retcode = (fd>=0 && (fd<fid_limit(cur) || fd<cur->fidt_size)) ? 0 : -1;  /* Closing a closed fd is legal! */
 
   FCB* fcb = get_fcb(fd);
 
   if(fcb) {
-    CURPROC->FIDT[fd] = NULL;
+    fid_put(cur, fd);
     retcode = FCB_decref(fcb);    
   }
 
@@ -218,7 +509,7 @@ int sys_Close(int fd)
 int sys_Dup2(int oldfd, int newfd)
 {
   int retcode=0;
-  if(oldfd<0 || newfd<0 || oldfd>=MAX_FILEID || newfd>=MAX_FILEID)
+  if(newfd<0 || newfd>=fid_limit(CURPROC))
     return -1;
 
   FCB* old = get_fcb(oldfd);
@@ -228,16 +519,64 @@ int sys_Dup2(int oldfd, int newfd)
     retcode = -1;
   }
   else if(old!=new) {
+    FCB_incref(old);
+    fidt_set(CURPROC, newfd, old);
     if(new)
       FCB_decref(new);
-    FCB_incref(old);
-    CURPROC->FIDT[newfd] = old;
   }
 
   return retcode;
 }
 
 
+int sys_SetFlags(Fid_t fd, int flags)
+{
+  FCB* fcb = get_fcb(fd);
+
+  if(fcb==NULL || (flags & ~FID_NONBLOCK))
+    return -1;
+
+  int oldflags = fcb->flags;
+  fcb->flags = flags;
+  return oldflags;
+}
+
+
+int sys_SetThreadFlags(int flags)
+{
+  if(flags & ~FID_NONBLOCK)
+    return -1;
+
+  /* Outside a stream operation, io_flags holds the flags of the thread */
+  TCB* tcb = cur_thread();
+  int oldflags = tcb->io_flags;
+  tcb->io_flags = flags;
+  return oldflags;
+}
+
+
+int sys_SetCloseOnExec(Fid_t fd, int on)
+{
+  if(get_fcb(fd)==NULL)
+    return -1;
+
+  uint64_t* word = &CURPROC->cloexec[fd / 64];
+  int old = (*word & FID_BIT(fd)) ? 1 : 0;
+  if(on)
+    *word |= FID_BIT(fd);
+  else
+    *word &= ~FID_BIT(fd);
+  return old;
+}
+
+
+int sys_GetFlags(Fid_t fd)
+{
+  FCB* fcb = get_fcb(fd);
+  return (fcb==NULL) ? -1 : fcb->flags;
+}
+
+
 
 unsigned int sys_GetTerminalDevices()
 {
@@ -3,6 +3,7 @@
 
 #include "tinyos.h"
 #include "kernel_dev.h"
+#include "kernel_sched.h"
 
 /**
 	@file kernel_streams.h
@@ -41,9 +42,11 @@
 typedef struct file_control_block
 {
   uint refcount;  			/**< @brief Reference counter. */
+  int flags;				/**< @brief Stream flags, e.g. @c FID_NONBLOCK */
   void* streamobj;			/**< @brief The stream object (e.g., a device) */
   file_ops* streamfunc;		/**< @brief The stream implementation methods */
   rlnode freelist_node;		/**< @brief Intrusive list node */
+  rlnode event_regs;		/**< @brief Event set registrations of the stream */
 } FCB;
 
 
@@ -118,6 +121,34 @@ int FCB_reserve(size_t num, Fid_t *fid, FCB** fcb);
 void FCB_unreserve(size_t num, Fid_t *fid, FCB** fcb);
 
 
+/** @brief Return the number of file ids a process may use. 
+
+	File ids at or above this limit are never allocated.
+ */
+unsigned int fid_limit(PCB* pcb);
+
+/** @brief Initialize the file id table of a new PCB, to an empty table. */
+void fidt_init(PCB* pcb);
+
+/** @brief Set a file id of a process, growing its table as needed.
+
+	The close-on-exec mark of the file id is cleared. The reference count
+	of @c fcb is not changed.
+
+	@returns the FCB previously at this file id, or NULL.
+ */
+FCB* fidt_set(PCB* pcb, Fid_t fid, FCB* fcb);
+
+/** @brief Copy the file ids of @c parent to the empty table of @c child.
+
+	File ids marked close-on-exec are skipped. 
+ */
+void fidt_inherit(PCB* parent, PCB* child);
+
+/** @brief Close all file ids of a process, and free its table. */
+void fidt_clear(PCB* pcb);
+
+
 /** @brief Translate an fid to an FCB.
 
 	This routine will return NULL if the fid is not legal.
@@ -128,6 +159,32 @@ void FCB_unreserve(size_t num, Fid_t *fid, FCB** fcb);
 FCB* get_fcb(Fid_t fid);
 
 
+/** @brief Check whether the current stream operation must not block.
+
+	While a @c Read or @c Write is served, the flags of the stream are 
+	visible to the driver through this call. A driver that is about to
+	sleep must instead return @c WOULDBLOCK when this is non-zero.
+
+	@returns non-zero if the operation in progress is non-blocking.
+ */
+static inline int stream_nonblocking()
+{
+	return cur_thread()->io_flags & FID_NONBLOCK;
+}
+
+/** @brief Check whether an operation on a stream must not block.
+
+	This is for stream operations other than @c Read and @c Write, 
+	e.g., @c Accept. It takes into account both the flags of the stream and
+	the flags of the operation in progress, so that the kernel can force
+	a non-blocking attempt (see @ref stream_nonblocking).
+ */
+static inline int fcb_nonblocking(FCB* fcb)
+{
+	return (fcb->flags | cur_thread()->io_flags) & FID_NONBLOCK;
+}
+
+
 /** @} */
 
 #endif
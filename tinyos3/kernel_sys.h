@@ -6,6 +6,8 @@
 
 #define SYSCALLS \
 SYSCALL(Exec, int, (Task task, int argl, void* args), (task, argl, args))\
+SYSCALL(Spawn, Pid_t, (Task task, int argl, void* args, const fid_map* fids, unsigned int nfids), (task, argl, args, fids, nfids))\
+SYSCALL(SetLimit, int, (proc_limit which, unsigned int value), (which, value))\
 SYSCALLV(Exit, (int exitval), (exitval))\
 SYSCALL(GetPid, int, (void), ())\
 SYSCALL(GetPPid, int, (void), ())\
@@ -15,20 +17,42 @@ SYSCALL(ThreadSelf, Tid_t, (void), ())\
 SYSCALL(ThreadJoin, int, (Tid_t tid, int* exitval), (tid, exitval))\
 SYSCALL(ThreadDetach, int, (Tid_t tid), (tid))\
 SYSCALLV(ThreadExit, (int exitval), (exitval))\
+SYSCALL(FutexWait, int, (int* addr, int expected, timeout_t timeout), (addr, expected, timeout))\
+SYSCALL(FutexWake, int, (int* addr, unsigned int n), (addr, n))\
 SYSCALL(GetTerminalDevices, unsigned int, (), ())\
 SYSCALL(OpenTerminal, Fid_t, (unsigned int termno), (termno))\
 SYSCALL(OpenNull, Fid_t, (), ())\
 SYSCALL(Read,int,(Fid_t fd, char *buf, unsigned int size), (fd,buf,size))\
 SYSCALL(Write,int,(Fid_t fd, const char *buf, unsigned int size), (fd,buf,size))\
 SYSCALL(Close,int,(Fid_t fd),(fd))\
+SYSCALL(TransferFile, int, (Fid_t out, Fid_t in, unsigned int len), (out, in, len))\
 SYSCALL(Dup2,int, (Fid_t oldfd, Fid_t newfd), (oldfd,newfd))\
+SYSCALL(SetFlags, int, (Fid_t fd, int flags), (fd, flags))\
+SYSCALL(GetFlags, int, (Fid_t fd), (fd))\
+SYSCALL(SetThreadFlags, int, (int flags), (flags))\
+SYSCALL(SetCloseOnExec, int, (Fid_t fd, int on), (fd, on))\
 SYSCALL(Pipe, int, (pipe_t* pipe), (pipe))\
-SYSCALL(Socket, Fid_t, (port_t port), (port))\
+SYSCALL(Pipe2, int, (pipe_t* pipe, int flags), (pipe, flags))\
+SYSCALL(Socket, Fid_t, (int port), (port))\
+SYSCALL(Socket2, Fid_t, (int port, int flags), (port, flags))\
 SYSCALL(Listen, int, (Fid_t sock), (sock))\
 SYSCALL(Accept, Fid_t, (Fid_t lsock), (lsock))\
-SYSCALL(Connect, int, (Fid_t sock, port_t port, timeout_t timeout), (sock, port, timeout))\
+SYSCALL(AcceptMany, int, (Fid_t lsock, Fid_t* fids, unsigned int n), (lsock, fids, n))\
+SYSCALL(Connect, int, (Fid_t sock, int port, timeout_t timeout), (sock, port, timeout))\
 SYSCALL(ShutDown, int, (Fid_t sock, shutdown_mode how), (sock, how))\
+SYSCALL(SetSocketOption, int, (Fid_t sock, socket_option opt, int value), (sock, opt, value))\
+SYSCALL(ShmReserve, int, (Fid_t sock, unsigned int size, void** buf), (sock, size, buf))\
+SYSCALL(ShmSend, int, (Fid_t sock, unsigned int size), (sock, size))\
+SYSCALL(ShmReceive, int, (Fid_t sock, void** buf), (sock, buf))\
 SYSCALL(OpenInfo, Fid_t, (), ())\
+SYSCALL(OpenProcInfo, Fid_t, (const procinfo_filter* filter), (filter))\
+SYSCALL(OpenThreadInfo, Fid_t, (Pid_t pid), (pid))\
+SYSCALL(OpenSocketInfo, Fid_t, (), ())\
+SYSCALL(OpenEventSet, Fid_t, (), ())\
+SYSCALL(EventSetCtl, int, (Fid_t eset, eventset_op op, Fid_t fid, unsigned int events), (eset, op, fid, events))\
+SYSCALL(EventSetWait, int, (Fid_t eset, fid_event* events, unsigned int n, timeout_t timeout), (eset, events, n, timeout))\
+SYSCALL(AioSetup, int, (aio_ring* ring), (ring))\
+SYSCALL(AioSubmit, int, (unsigned int min_complete), (min_complete))\
 
 
 
@@ -4,6 +4,7 @@
 
 #include "kernel_cc.h"
 #include "kernel_streams.h"
+#include "kernel_aio.h"
 #include <stdlib.h>     
 #include <assert.h>     
 #include <string.h>    
@@ -22,6 +23,137 @@ void my_start_main_thread();
    
 }*/
 
+/*
+  The thread handle table.
+
+  Each process maps its Tids to PTCBs through a table of slots, so that
+  ThreadJoin and ThreadDetach find a thread in O(1). Free slots are kept
+  in a free list. Since a released slot gets a new generation, a Tid of an 
+  exited thread does not match a newer thread which reuses its slot.
+ */
+#define TID_INDEX_MASK ((((Tid_t)1) << TID_INDEX_BITS) - 1)
+#define TID_GEN_MASK  ((unsigned int)(((Tid_t)-1) >> TID_INDEX_BITS))
+
+static inline Tid_t tid_make(unsigned int idx, unsigned int gen)
+{
+    return (((Tid_t)gen) << TID_INDEX_BITS) | (idx + 1);
+}
+
+Tid_t tid_acquire(PCB* pcb, PTCB* ptcb)
+{
+    if (pcb->handles_free < 0) {
+        /* Double the table, and put the new slots in the free list */
+        unsigned int oldsize = pcb->handles_size;
+        unsigned int newsize = oldsize ? 2 * oldsize : 16;
+        assert(newsize <= TID_INDEX_MASK);
+        pcb->handles = (ptcb_handle*)realloc(pcb->handles, newsize * sizeof(ptcb_handle));
+        if (pcb->handles == NULL)
+            FATAL("Out of memory for thread handles");
+
+        for (unsigned int i = newsize; i > oldsize; i--) {
+            pcb->handles[i - 1].ptcb = NULL;
+            pcb->handles[i - 1].gen = 0;
+            pcb->handles[i - 1].next_free = pcb->handles_free;
+            pcb->handles_free = i - 1;
+        }
+        pcb->handles_size = newsize;
+    }
+
+    unsigned int idx = pcb->handles_free;
+    ptcb_handle* h = &pcb->handles[idx];
+    pcb->handles_free = h->next_free;
+    h->ptcb = ptcb;
+
+    ptcb->tid = tid_make(idx, h->gen);
+    return ptcb->tid;
+}
+
+PTCB* tid_lookup(PCB* pcb, Tid_t tid)
+{
+    Tid_t idx = (tid & TID_INDEX_MASK);
+    if (idx == 0 || idx > pcb->handles_size)
+        return NULL;
+
+    ptcb_handle* h = &pcb->handles[idx - 1];
+    if (h->ptcb == NULL || tid != tid_make(idx - 1, h->gen))
+        return NULL;
+    return h->ptcb;
+}
+
+void tid_release(PCB* pcb, PTCB* ptcb)
+{
+    unsigned int idx = (ptcb->tid & TID_INDEX_MASK) - 1;
+    assert(idx < pcb->handles_size && pcb->handles[idx].ptcb == ptcb);
+
+    ptcb_handle* h = &pcb->handles[idx];
+    h->ptcb = NULL;
+    h->gen = (h->gen + 1) & TID_GEN_MASK;
+    h->next_free = pcb->handles_free;
+    pcb->handles_free = idx;
+}
+
+void tid_table_destroy(PCB* pcb)
+{
+    free(pcb->handles);
+    pcb->handles = NULL;
+    pcb->handles_size = 0;
+    pcb->handles_free = -1;
+}
+
+
+/*
+  The PTCB cache.
+
+  Released PTCBs are kept in a list (linked by their ptcb_list_node), 
+  so that thread and process creation does not go to malloc. The cache
+  is protected by the kernel lock.
+ */
+#define PTCB_CACHE_SIZE 256
+
+static rlnode ptcb_cache = { .obj = NULL, .prev = &ptcb_cache, .next = &ptcb_cache };
+static unsigned int ptcb_cache_size = 0;
+
+PTCB* acquire_PTCB(PCB* pcb, TCB* tcb, Task task, int argl, void* args)
+{
+    PTCB* ptcb;
+    if (ptcb_cache_size > 0) {
+        ptcb = rlist_pop_front(&ptcb_cache)->ptcb;
+        ptcb_cache_size--;
+    } else {
+        ptcb = (PTCB*)xmalloc(sizeof(PTCB));
+    }
+
+    ptcb->task = task;
+    ptcb->argl = argl;
+    ptcb->args = args;
+    ptcb->tcb = tcb;
+    ptcb->owner_pcb = pcb;
+    ptcb->exitval = 0;
+    ptcb->exited = 0;
+    ptcb->detached = 0;
+    ptcb->exit_cv = COND_INIT;
+    ptcb->refcount = 0;
+
+    rlnode_init(&ptcb->ptcb_list_node, ptcb);
+    rlist_push_back(&pcb->ptcb_list, &ptcb->ptcb_list_node);
+    pcb->thread_count++;
+
+    tcb->ptcb = ptcb;
+    tid_acquire(pcb, ptcb);
+    return ptcb;
+}
+
+void release_PTCB(PTCB* ptcb)
+{
+    if (ptcb_cache_size < PTCB_CACHE_SIZE) {
+        rlist_push_front(&ptcb_cache, &ptcb->ptcb_list_node);
+        ptcb_cache_size++;
+    } else {
+        free(ptcb);
+    }
+}
+
+
 /* @brief Create a new thread in the current process.
   */
 Tid_t sys_CreateThread(Task task, int argl, void* args)
@@ -31,38 +163,19 @@ Tid_t sys_CreateThread(Task task, int argl, void* args)
         return NOTHREAD;
     }
 
-    TCB *temp = spawn_thread(CURPROC , my_start_main_thread);
-    if(temp == NULL){
+    if(CURPROC->max_threads > 0 && CURPROC->thread_count >= CURPROC->max_threads){
         return NOTHREAD;
     }
-    PTCB *ptcbtemp;
 
-    ptcbtemp =(PTCB*)xmalloc(sizeof(PTCB));
-    if (ptcbtemp == NULL) { 
+    TCB *temp = spawn_thread(CURPROC , my_start_main_thread);
+    if(temp == NULL){
         return NOTHREAD;
     }
+    PTCB *ptcbtemp = acquire_PTCB(CURPROC, temp, task, argl, args);
 
-    ptcbtemp->args = args;
-    ptcbtemp->argl = argl;
-    
-    ptcbtemp->detached = 0;
-    ptcbtemp->exit_cv = COND_INIT;
-    ptcbtemp->exited = 0;
-    ptcbtemp->refcount = 0 ;
-    ptcbtemp->task = task; 
-    ptcbtemp->tcb = temp ;
-    ptcbtemp->owner_pcb = CURPROC; 
-
-    rlnode_init(&ptcbtemp->ptcb_list_node, ptcbtemp);
-    rlist_push_back(&CURPROC->ptcb_list , &ptcbtemp->ptcb_list_node);
-
-    CURPROC->thread_count++ ;
-
-    temp->ptcb=ptcbtemp;
-    
     wakeup(temp);
     
-    return(Tid_t)ptcbtemp;
+    return ptcbtemp->tid;
 }
 
 /**
@@ -70,7 +183,7 @@ Tid_t sys_CreateThread(Task task, int argl, void* args)
  */
 Tid_t sys_ThreadSelf()
 {
-    return (Tid_t) cur_thread()->ptcb;
+    return cur_thread()->ptcb->tid;
 }
 
 /**
@@ -79,9 +192,9 @@ Tid_t sys_ThreadSelf()
 
 int sys_ThreadJoin(Tid_t tid, int* exitval)
 {
-    PTCB* ptcb_to_join = (PTCB*)tid;
+    PTCB* ptcb_to_join = tid_lookup(CURPROC, tid);
 
-    if (ptcb_to_join == NULL || rlist_find(&CURPROC->ptcb_list, ptcb_to_join, NULL) == NULL) { //there is no thread with the given tid in this process
+    if (ptcb_to_join == NULL) { //there is no thread with the given tid in this process
         return -1; 
     }
 
@@ -102,7 +215,9 @@ int sys_ThreadJoin(Tid_t tid, int* exitval)
     if(ptcb_to_join->detached == 1){
         ptcb_to_join->refcount--;
         if(ptcb_to_join->refcount == 0 && ptcb_to_join->exited == 1){
-            free(ptcb_to_join); 
+            rlist_remove(&ptcb_to_join->ptcb_list_node);
+            tid_release(CURPROC, ptcb_to_join);
+            release_PTCB(ptcb_to_join); 
         }
         return -1;
     }
@@ -115,7 +230,8 @@ int sys_ThreadJoin(Tid_t tid, int* exitval)
 
     if(ptcb_to_join->refcount == 0){
         rlist_remove(&ptcb_to_join->ptcb_list_node);
-        free(ptcb_to_join); 
+        tid_release(CURPROC, ptcb_to_join);
+        release_PTCB(ptcb_to_join); 
     }
     
     return 0;
@@ -126,9 +242,9 @@ int sys_ThreadJoin(Tid_t tid, int* exitval)
 
 int sys_ThreadDetach(Tid_t tid)
 {
-    PTCB* ptcb_to_detach = (PTCB*)tid;
+    PTCB* ptcb_to_detach = tid_lookup(CURPROC, tid);
 
-    if (ptcb_to_detach == NULL || rlist_find(&CURPROC->ptcb_list, ptcb_to_detach, NULL) == NULL) {
+    if (ptcb_to_detach == NULL) {
         return -1; 
     }
 
@@ -139,7 +255,8 @@ int sys_ThreadDetach(Tid_t tid)
     if(ptcb_to_detach->exited == 1){
         if (ptcb_to_detach->refcount == 0) {
             rlist_remove(&ptcb_to_detach->ptcb_list_node);
-            free(ptcb_to_detach);
+            tid_release(CURPROC, ptcb_to_detach);
+            release_PTCB(ptcb_to_detach);
         }
         return -1; 
     }
@@ -169,10 +286,15 @@ void sys_ThreadExit(int exitval)
         should_free_ptcb = 1;
         // Αν είναι να το ελευθερώσουμε, ΤΩΡΑ το αφαιρούμε
         rlist_remove(&ptcb->ptcb_list_node); 
+        tid_release(curproc, ptcb);
     }
 
     if(curproc->thread_count == 0){ // Αν είμαστε το τελευταίο νήμα
         // ... (Ο κώδικας καθαρισμού του PCB είναι σωστός ως έχει) ...
+        /* Stop the aio worker first, as this may sleep: the parent 
+           must not see us exited before the worker has exited */
+        aio_release(curproc);
+
         if(sys_GetPid() != 1 && curproc->parent != NULL){ 
             PCB* initpcb = get_pcb(1);
             while(!is_rlist_empty(& curproc->children_list)) {
@@ -186,6 +308,7 @@ void sys_ThreadExit(int exitval)
             }
             rlist_push_front(& curproc->parent->exited_list, &curproc->exited_node);
             kernel_broadcast(& curproc->parent->child_exit);
+            kernel_broadcast(& curproc->wait_chan);
         }
         assert(is_rlist_empty(& curproc->children_list));
         assert(is_rlist_empty(& curproc->exited_list));
@@ -193,19 +316,110 @@ void sys_ThreadExit(int exitval)
             free(curproc->args);
             curproc->args = NULL;
         }
-        for(int i=0;i<MAX_FILEID;i++) {
-            if(curproc->FIDT[i] != NULL) {
-                FCB_decref(curproc->FIDT[i]);
-                curproc->FIDT[i] = NULL;
-            }
-        }
+        fidt_clear(curproc);
+        tid_table_destroy(curproc);
         curproc->main_thread = NULL;
         curproc->pstate = ZOMBIE;
     } 
 
     if (should_free_ptcb) {
-        free(ptcb);
+        release_PTCB(ptcb);
     }
     
     kernel_sleep(EXITED, SCHED_USER);
-}
\ No newline at end of file
+}
+
+/*
+  Thread information streams.
+
+  The records are taken when the stream is opened, under the kernel lock.
+  A thread that has not exited cannot release its TCB while we hold the
+  kernel lock, so its TCB can be read safely.
+ */
+typedef struct thread_info_cb {
+    unsigned int count;
+    unsigned int next;
+    threadinfo records[];
+} thread_info_cb;
+
+static void thread_fill_info(PCB* pcb, PTCB* ptcb, threadinfo* info)
+{
+    memset(info, 0, sizeof(threadinfo));
+    info->tid = ptcb->tid;
+    info->pid = get_pid(pcb);
+    if (ptcb->exited) {
+        info->state = THREADINFO_EXITED;
+        return;
+    }
+
+    TCB* tcb = ptcb->tcb;
+    switch (tcb->state) {
+    case RUNNING:
+        info->state = THREADINFO_RUNNING;
+        break;
+    case STOPPED:
+        info->state = THREADINFO_STOPPED;
+        break;
+    default:
+        info->state = THREADINFO_READY;
+        break;
+    }
+    info->priority = tcb->priority;
+    info->cpu_time = tcb->cpu_time;
+    info->slices = tcb->slices;
+    unsigned int hist = tcb->cause_history;
+    for (unsigned int i = 0; i < THREADINFO_CAUSES; i++, hist >>= 4)
+        info->causes[i] = hist & 0xf;
+}
+
+static int thread_info_read(void* obj, char* buf, unsigned int size)
+{
+    thread_info_cb* ticb = (thread_info_cb*)obj;
+    unsigned int n = size / sizeof(threadinfo);
+
+    if (n > ticb->count - ticb->next)
+        n = ticb->count - ticb->next;
+    memcpy(buf, ticb->records + ticb->next, n * sizeof(threadinfo));
+    ticb->next += n;
+    return n * sizeof(threadinfo);
+}
+
+static int thread_info_close(void* obj)
+{
+    free(obj);
+    return 0;
+}
+
+static file_ops thread_info_ops = {
+    .Read = thread_info_read,
+    .Write = NULL,
+    .Close = thread_info_close,
+    .Open = NULL,
+    .kind = STREAM_INFO
+};
+
+
+Fid_t sys_OpenThreadInfo(Pid_t pid)
+{
+    PCB* pcb = (pid == NOPROC) ? CURPROC : get_pcb(pid);
+    if (pcb == NULL)
+        return NOFILE;
+
+    Fid_t fid;
+    FCB* fcb;
+    if (FCB_reserve(1, &fid, &fcb) == 0)
+        return NOFILE;
+
+    unsigned int count = rlist_len(&pcb->ptcb_list);
+    thread_info_cb* ticb = (thread_info_cb*)xmalloc(sizeof(thread_info_cb) + count * sizeof(threadinfo));
+    ticb->count = count;
+    ticb->next = 0;
+
+    unsigned int i = 0;
+    for (rlnode* n = pcb->ptcb_list.next; n != &pcb->ptcb_list; n = n->next)
+        thread_fill_info(pcb, n->ptcb, &ticb->records[i++]);
+
+    fcb->streamobj = ticb;
+    fcb->streamfunc = &thread_info_ops;
+    return fid;
+}
@@ -45,10 +45,15 @@ typedef unsigned long timeout_t;
 /** @brief The type of a file ID. */
 typedef int Fid_t;  
 
-/** @brief The maximum number of open files per process. 
-   Only values 0 to MAX_FILEID-1 are legal for file descriptors. */
+/** @brief The default number of file ids of a process. 
+   By default, only values 0 to MAX_FILEID-1 are legal for file descriptors. 
+   A process can raise its number of file ids up to @c MAX_FILEID_LIMIT,
+   by @c SetLimit(LIMIT_FIDS,...). */
 #define MAX_FILEID 16
 
+/** @brief The maximum number of file ids of a process. */
+#define MAX_FILEID_LIMIT 65536
+
 /** @brief The invalid file id. */
 #define NOFILE  (-1)
 
@@ -202,6 +207,38 @@ void Cond_Signal(CondVar*);
 void Cond_Broadcast(CondVar*); 
 
 
+/** @brief Wait on a futex.
+
+  A futex is an int in memory. If its value is @c expected, the calling
+  thread sleeps until another thread calls @c FutexWake on the same address,
+  or the timeout expires. The check and the sleep happen atomically with
+  respect to @c FutexWake. 
+
+  Futexes are the building block of synchronization objects whose 
+  uncontended operations are atomic instructions, without entering the
+  kernel (see tinyoslib.h).
+
+  @param addr the address of the futex, aligned to an int
+  @param expected the value of the futex for which to sleep
+  @param timeout the time to wait in milliseconds, or @c TIMEOUT_INFINITE
+  @returns 1 if woken up by @c FutexWake, 0 if the value of the futex was not
+    @c expected or the timeout expired, or -1 if @c addr is not legal.
+  @see FutexWake
+ */
+int FutexWait(int* addr, int expected, timeout_t timeout);
+
+/** @brief Wake up threads waiting on a futex.
+
+  Threads are woken up in the order they started waiting.
+
+  @param addr the address of the futex
+  @param n the maximum number of threads to wake up
+  @returns the number of threads woken up, or -1 if @c addr is not legal.
+  @see FutexWait
+ */
+int FutexWake(int* addr, unsigned int n);
+
+
 /*******************************************
  *
  * Process creation
@@ -224,7 +261,8 @@ typedef int (*Task)(int, void*);
   byte array defined by the (argl, args) pair of arguments to Exec.
   
   
-  - The new process inherits all file ids of the current process.
+  - The new process inherits all file ids of the current process, 
+    except the ones marked by @c SetCloseOnExec.
   - The new process is a child of the current process.
   - The new process is started with a thread executing @c task. When 
     this thread returns, with an integer value, the process terminates,
@@ -241,6 +279,66 @@ typedef int (*Task)(int, void*);
 Pid_t Exec(Task task, int argl, void* args);
 
 
+/** @brief A file id mapping for @c Spawn. */
+typedef struct fid_map {
+  Fid_t parent;     /**< @brief A file id of the calling process */
+  Fid_t child;      /**< @brief The file id it becomes in the new process */
+} fid_map;
+
+
+/** @brief Create a new process with the given file ids.
+
+  This call is like @c Exec, except that the new process does not inherit
+  the file ids of the current process. Instead, for each mapping in
+  @c fids, the stream of file id @c parent of the current process becomes
+  file id @c child of the new process. All other file ids of the new 
+  process are closed. This saves the caller from having to rearrange
+  its own file ids with @c Dup2 and @c Close before @c Exec.
+
+  @param task the main function  of the new process
+  @param argl the length of byte array @c args
+  @param args the byte array copied as argument to `task`
+  @param fids an array of @c nfids file id mappings
+  @param nfids the number of mappings
+  @return On success, the pid of the new process is returned.
+    On error, NOPROC is returned.
+    Possible errors:
+   -  The maximum number of processes has been reached.
+   -  A parent file id is not an open file.
+   -  A child file id is invalid, or it appears in more than one mapping.
+  @see Exec
+  */
+Pid_t Spawn(Task task, int argl, void* args, const fid_map* fids, unsigned int nfids);
+
+
+/** @brief A resource limit of a process. 
+  @see SetLimit
+ */
+typedef enum {
+  LIMIT_THREADS,   /**< @brief The maximum number of threads */
+  LIMIT_FIDS       /**< @brief The number of file ids: file ids from this one up cannot be used */
+} proc_limit;
+
+/** @brief Set a resource limit of the current process.
+
+  A limit of 0 means the default: no limit for @c LIMIT_THREADS, and
+  @c MAX_FILEID for @c LIMIT_FIDS. The file id limit cannot exceed 
+  @c MAX_FILEID_LIMIT. New processes inherit the limits of their parent. Lowering a limit below the current usage is allowed;
+  it only prevents further allocation:
+  - with @c LIMIT_THREADS, @c CreateThread fails once the process has 
+    this many threads.
+  - with @c LIMIT_FIDS, file ids at or above the limit are never 
+    allocated, and @c Dup2 to them fails.
+
+  @param which the limit to set
+  @param value the new value
+  @return the previous value of the limit, or -1 on error. Possible errors are:
+    - @c which is not legal.
+    - the value of @c LIMIT_FIDS is greater than @c MAX_FILEID_LIMIT.
+ */
+int SetLimit(proc_limit which, unsigned int value);
+
+
 /** @brief Exit the current process.
 
   When this function is called by a process thread, the process terminates
@@ -315,6 +413,8 @@ Pid_t GetPPid(void);
   programmer to define their meaning.
 
   @param task a function to execute
+  @returns the tid of the new thread, or NOTHREAD on error. Possible errors are:
+    - the process has reached its @c LIMIT_THREADS.
 
   */
 Tid_t CreateThread(Task task, int argl, void* args);
@@ -431,6 +531,7 @@ Fid_t OpenNull();
         Possible errors are:
          - The file descriptor is invalid.
          - There was a I/O runtime problem.
+        If the stream is non-blocking and no data is available, @c WOULDBLOCK is returned.
  */
 int Read(Fid_t fd, char *buf, unsigned int size);
 
@@ -454,10 +555,33 @@ int Read(Fid_t fd, char *buf, unsigned int size);
    Possible errors are:
    - The file id is invalid.
    - There was a I/O runtime problem.
+   If the stream is non-blocking, the call may copy fewer bytes than @c size,
+   and if no bytes can be copied without blocking, @c WOULDBLOCK is returned.
  */
 int Write(Fid_t fd, const char* buf, unsigned int size);
 
 
+/** @brief Copy data from one stream to another.
+
+   Up to @c len bytes are read from @c in and written to @c out, inside 
+   the kernel, in chunks of up to @c MAX_MESSAGE_SIZE bytes. The call 
+   stops early at end of file, or when the input cannot be read without 
+   blocking, if it is non-blocking.
+
+   Data that has been read is always written in full. If @c out is 
+   non-blocking, the call stops before a chunk if @c out cannot be written.
+
+   @param out the file id to write to
+   @param in the file id to read from
+   @param len the maximum number of bytes to copy
+   @returns the number of bytes copied (0 at end of file), or, if nothing
+     was copied, @c WOULDBLOCK or -1 on error. Possible reasons for error:
+     - either file id is invalid
+     - @c in cannot be read or @c out cannot be written
+ */
+int TransferFile(Fid_t out, Fid_t in, unsigned int len);
+
+
 /** @brief Close a file id.
    
 
@@ -489,6 +613,76 @@ int Close(Fid_t fd);
  */
 int Dup2(Fid_t oldfd, Fid_t newfd);
 
+
+/** @brief Stream flag: operations on the stream never block.
+
+  When this flag is set on a stream, calls that would otherwise put the
+  caller to sleep (@c Read, @c Write, @c Accept and @c Connect) return
+  @c WOULDBLOCK instead.
+
+  The flag can be given when a stream is created, with @c Pipe2 or 
+  @c Socket2, or set later with @c SetFlags.
+
+  @see SetFlags
+*/
+#define FID_NONBLOCK  (1 << 0)
+
+/** @brief Returned by an operation on a non-blocking stream that would block. */
+#define WOULDBLOCK  (-2)
+
+
+/** @brief Set the flags of a stream.
+
+  The flags belong to the stream, not to the file id. Therefore, all file ids
+  that share a stream (e.g., by @c Dup2 or inheritance) share its flags.
+
+  Sockets returned by @c Accept inherit the flags of the listening socket.
+
+  @param fd the file id of the stream
+  @param flags the new flags, a bitwise-or of @c FID_NONBLOCK etc.
+  @return the previous flags of the stream on success, or -1 on failure.
+  Possible reasons for failure:
+  - The file id is invalid.
+  - The flags are not legal.
+ */
+int SetFlags(Fid_t fd, int flags);
+
+/** @brief Get the flags of a stream.
+
+  @param fd the file id of the stream
+  @return the flags of the stream on success, or -1 if the file id is invalid.
+  @see SetFlags
+ */
+int GetFlags(Fid_t fd);
+
+/** @brief Set the stream flags of the calling thread.
+
+  The flags of the thread apply to each stream operation of the thread, 
+  in addition to the flags of the stream. Unlike @c SetFlags, this does 
+  not affect the other users of the streams; e.g., a thread can do a
+  non-blocking @c Read on a stream that other threads read blocking.
+
+  @param flags the new flags, a bitwise-or of @c FID_NONBLOCK etc.
+  @return the previous flags of the thread on success, or -1 if the flags
+  are not legal.
+  @see SetFlags
+ */
+int SetThreadFlags(int flags);
+
+/** @brief Mark a file id to be closed on @c Exec.
+
+  A file id marked close-on-exec is not inherited by the processes 
+  created by @c Exec. Unlike the flags of @c SetFlags, the mark belongs
+  to the file id, not to the stream. It is cleared when the file id is
+  closed, or replaced by @c Dup2.
+
+  @param fd the file id
+  @param on non-zero to mark the file id, zero to unmark it
+  @return the previous mark (0 or 1) on success, or -1 if the file id is invalid.
+  @see Exec
+ */
+int SetCloseOnExec(Fid_t fd, int on);
+
 /*******************************************
  *
  * Pipes
@@ -531,6 +725,21 @@ typedef struct pipe_s {
 */
 int Pipe(pipe_t* pipe);
 
+/**
+	@brief Construct and return a pipe, with the given stream flags.
+
+	This is like @c Pipe, except that both ends of the pipe are created
+	with @c flags, as if by @c SetFlags.
+
+	@param pipe a pointer to a pipe_t structure for storing the file ids.
+	@param flags the flags of the pipe ends, a bitwise-or of @c FID_NONBLOCK etc.
+	@returns 0 on success, or -1 on error. Possible reasons for error:
+		- the flags are not legal.
+		- the available file ids for the process are exhausted.
+	@see Pipe
+*/
+int Pipe2(pipe_t* pipe, int flags);
+
 /*******************************************
  *
  * Sockets (local)
@@ -547,7 +756,7 @@ typedef int16_t port_t;
 /**
 	@brief the maximum legal port 
 */
-#define MAX_PORT 1023
+#define MAX_PORT INT16_MAX
 
 /**
 	@brief a null value for a port
@@ -563,13 +772,34 @@ typedef int16_t port_t;
 	socket will not be bound to a port. Else, the socket
 	will be bound to the specified port. 
 
+	The port is passed as an @c int and checked against the legal
+	range before it is narrowed to a @c port_t, so that an out-of-range
+	value cannot wrap around to a legal port.
+
 	@param port the port the new socket will be bound to
 	@returns a file id for the new socket, or NOFILE on error. Possible
 		reasons for error:
 		- the port is iilegal
 		- the available file ids for the process are exhausted
 */
-Fid_t Socket(port_t port);
+Fid_t Socket(int port);
+
+/**
+	@brief Return a new socket bound on a port, with the given stream flags.
+
+	This is like @c Socket, except that the socket is created with 
+	@c flags, as if by @c SetFlags.
+
+	@param port the port the new socket will be bound to
+	@param flags the flags of the socket, a bitwise-or of @c FID_NONBLOCK etc.
+	@returns a file id for the new socket, or NOFILE on error. Possible
+		reasons for error:
+		- the flags are not legal
+		- the port is iilegal
+		- the available file ids for the process are exhausted
+	@see Socket
+*/
+Fid_t Socket2(int port, int flags);
 
 /**
 	@brief Initialize a socket as a listening socket.
@@ -613,6 +843,8 @@ int Listen(Fid_t sock);
 		- the file id is not initialized by @c Listen()
 		- the available file ids for the process are exhausted
 		- while waiting, the listening socket @c lsock was closed
+	    If @c lsock is non-blocking and no connection is pending, @c WOULDBLOCK
+	    is returned.
 
 	@see Connect
 	@see Listen
@@ -620,6 +852,26 @@ int Listen(Fid_t sock);
 Fid_t Accept(Fid_t lsock);
 
 
+/**
+	@brief Accept a number of connections at once.
+
+	This call blocks like @c Accept, until at least one connection request is
+	queued. Then, it accepts up to @c n queued requests, storing the new
+	socket file ids in @c fids.
+
+	@param lsock the listening socket
+	@param fids an array of at least @c n file ids
+	@param n the maximum number of connections to accept
+	@returns the number of accepted connections, or -1 on error. Possible 
+		reasons for error are those of @c Accept, and:
+		- @c fids is NULL or @c n is 0
+		If @c lsock is non-blocking and no connection is pending, @c WOULDBLOCK
+		is returned.
+	@see Accept
+ */
+int AcceptMany(Fid_t lsock, Fid_t* fids, unsigned int n);
+
+
 
 /**
 	@brief Create a connection to a listener at a specific port.
@@ -645,8 +897,13 @@ Fid_t Accept(Fid_t lsock);
 	   - the given port is illegal.
 	   - the port does not have a listening socket bound to it by @c Listen.
 	   - the timeout has expired without a successful connection.
+
+	If @c sock is non-blocking, the request is queued at the listener and 
+	@c WOULDBLOCK is returned. Subsequent calls to @c Connect on the same socket
+	return the progress of the request: @c WOULDBLOCK while it is still queued, 
+	0 once it has been accepted and -1 if it was refused.
 */
-int Connect(Fid_t sock, port_t port, timeout_t timeout);
+int Connect(Fid_t sock, int port, timeout_t timeout);
 
 
 /**
@@ -694,6 +951,322 @@ typedef enum {
 int ShutDown(Fid_t sock, shutdown_mode how);
 
 
+/** @brief The maximum size of a message on a message-mode socket. */
+#define MAX_MESSAGE_SIZE 4096
+
+/** @brief The maximum size of the shared region of a shared-mode socket. */
+#define MAX_SHARED_SIZE (1 << 26)
+
+/** @brief Socket options, for @c SetSocketOption. */
+typedef enum {
+  /** @brief Preserve message boundaries.
+
+    On a connection in message mode, each @c Write of up to 
+    @c MAX_MESSAGE_SIZE bytes is delivered atomically, as a single 
+    message, and each @c Read returns exactly one message. If the buffer of 
+    the @c Read is smaller than the message, the rest of the message is 
+    discarded. Writing 0 bytes sends nothing.
+
+    A connection is in message mode if its listener is. A socket can only 
+    connect to a listener of the same mode.
+   */
+  SOCKOPT_MESSAGE,
+
+  /** @brief The maximum number of queued connection requests of a listener.
+
+    When the queue of a listener is full, @c Connect fails at once. 
+    A value of 0 (the default) sets no limit; the maximum value is
+    @c MAX_BACKLOG. This option can also be set on a listener.
+
+    A listener reserves the memory of a connection for each request of
+    its backlog, so that admitting connections does not allocate memory.
+    The reservation belongs to the listener, and is reported in the
+    @c reserved field of its @c sockinfo record.
+   */
+  SOCKOPT_BACKLOG,
+
+  /** @brief Allow several listeners on the same port.
+
+    A socket can @c Listen on a port that has listeners, if both it and
+    those listeners have this option set (and are of the same mode). 
+    Each @c Connect to the port is queued at the listener with the 
+    fewest queued requests, with ties broken round-robin.
+   */
+  SOCKOPT_REUSEPORT,
+
+  /** @brief Transfer data through shared regions (shared mode).
+
+    The value is the size of a region, up to @c MAX_SHARED_SIZE bytes; 0 (the
+    default) disables the mode. Each direction of a connection in shared
+    mode has its own region, mapped by both peers, of the smaller size of
+    the connecting socket and the listener. Data is written in place, into
+    the region, with @c ShmReserve and @c ShmSend, and is read in place with 
+    @c ShmReceive. Only small descriptors travel through the connection,
+    so large messages are never copied by the kernel.
+
+    A socket can only connect to a listener that is also in shared mode.
+    @c Read and @c Write fail on a connection in shared mode.
+   */
+  SOCKOPT_SHARED
+} socket_option;
+
+
+/** @brief The maximum value of @c SOCKOPT_BACKLOG. */
+#define MAX_BACKLOG 1024
+
+
+/** @brief Set an option of a socket.
+
+  Options must be set before the socket is used to @c Listen or @c Connect,
+  except where noted.
+
+  @param sock the socket
+  @param opt the option
+  @param value the new value of the option; for boolean options, non-zero
+    enables the option
+  @returns 0 on success, or -1 on error. Possible reasons for error:
+    - @c sock is not a socket
+    - the socket is not unbound (i.e., it is a listener or connected)
+    - the option or its value is not legal
+ */
+int SetSocketOption(Fid_t sock, socket_option opt, int value);
+
+
+/** @brief Reserve space for a message in the shared region of a socket.
+
+  The caller fills the reserved space in place and sends it with @c ShmSend.
+  The space is returned to the writer once the reader has moved past the 
+  message. This call blocks until there is enough free space; a new 
+  reservation replaces an unsent one.
+
+  @param sock a connected socket in shared mode (see @c SOCKOPT_SHARED)
+  @param size the size of the message, no larger than the region
+  @param buf location to store the address of the reserved space
+  @returns 0 on success, @c WOULDBLOCK if the socket is non-blocking and
+    there is not enough space, or -1 on error. Possible reasons for error:
+    - @c sock is not a connected socket in shared mode
+    - @c size is 0 or larger than the region
+    - the socket is shut down for writing, or the peer for reading
+ */
+int ShmReserve(Fid_t sock, unsigned int size, void** buf);
+
+/** @brief Send a message from the reserved space of a socket.
+
+  @param sock a connected socket in shared mode
+  @param size the size of the message, at most the size of the reservation
+  @returns @c size on success, @c WOULDBLOCK, or -1 on error.
+ */
+int ShmSend(Fid_t sock, unsigned int size);
+
+/** @brief Receive a message on a socket in shared mode.
+
+  The message is not copied: on return, @c buf points to it, in the 
+  region shared with the peer. It remains valid until the next call to 
+  @c ShmReceive, or until the socket is closed.
+
+  @param sock a connected socket in shared mode
+  @param buf location to store the address of the message
+  @returns the size of the message, 0 if the peer has shut down writing, 
+    @c WOULDBLOCK, or -1 on error.
+ */
+int ShmReceive(Fid_t sock, void** buf);
+
+
+
+/*******************************************
+ *
+ * Event sets
+ *
+ *******************************************/
+
+/** @brief Event: the stream can be read without blocking. */
+#define EVENT_READ    (1 << 0)
+
+/** @brief Event: the stream can be written without blocking. */
+#define EVENT_WRITE   (1 << 1)
+
+/** @brief Event: the other end of the stream is gone. 
+
+  This event is always reported, whether it was requested or not.
+*/
+#define EVENT_HANGUP  (1 << 2)
+
+/** @brief Registration flag: report each readiness change only once.
+
+  By default, a registration is reported by every @c EventSetWait for as long as
+  the stream remains ready (level-triggered). With this flag, it is reported
+  once per readiness change (edge-triggered).
+*/
+#define EVENT_EDGE    (1 << 3)
+
+/** @brief A timeout value denoting an unbounded wait. */
+#define TIMEOUT_INFINITE  ((timeout_t)-1)
+
+
+/** @brief Operations of @c EventSetCtl */
+typedef enum {
+  EVENTSET_ADD,   /**< Add a stream to the event set */
+  EVENTSET_MOD,   /**< Change the events of a stream in the event set */
+  EVENTSET_DEL    /**< Remove a stream from the event set */
+} eventset_op;
+
+
+/** @brief A ready stream, as reported by @c EventSetWait. */
+typedef struct fid_event {
+  Fid_t fid;              /**< The file id that was registered */
+  unsigned int events;    /**< The ready events */
+} fid_event;
+
+
+/** @brief Open a new event set.
+
+  An event set monitors the readiness of a number of streams, so that 
+  a single thread can wait on all of them at once (see @c EventSetWait).
+  It is closed by @c Close, like any other stream.
+
+  @returns a file id for the event set, or NOFILE on error. Possible reasons
+    for error are:
+    - the available file ids for the process are exhausted.
+ */
+Fid_t OpenEventSet();
+
+
+/** @brief Control the streams monitored by an event set.
+
+  With @c EVENTSET_ADD, stream @c fid is added to the event set, monitored
+  for @c events, a bitwise-or of @c EVENT_READ, @c EVENT_WRITE and, 
+  optionally, @c EVENT_EDGE. With @c EVENTSET_MOD, the events of an already
+  added stream are changed and with @c EVENTSET_DEL, the stream is removed.
+
+  A stream is removed from all event sets automatically, when it is closed.
+
+  @param eset the event set
+  @param op the operation
+  @param fid the stream to monitor
+  @param events the events to monitor (ignored for @c EVENTSET_DEL)
+  @returns 0 on success and -1 on error. Possible reasons for error:
+    - @c eset is not an event set
+    - @c fid is not a legal file id, or it is an event set
+    - the events are not legal
+    - @c fid is already added (@c EVENTSET_ADD), or not added to the set.
+ */
+int EventSetCtl(Fid_t eset, eventset_op op, Fid_t fid, unsigned int events);
+
+
+/** @brief Wait for streams of an event set to become ready.
+
+  The call blocks until at least one stream of the event set is ready, or the
+  timeout expires. Then, up to @c n ready streams are stored in @c events.
+
+  @param eset the event set
+  @param events an array of at least @c n elements
+  @param n the size of the array
+  @param timeout the maximum time to wait in milliseconds. A value of 0 does 
+    not block, and @c TIMEOUT_INFINITE waits for ever.
+  @returns the number of ready streams stored in @c events, 0 if the timeout
+    expired, or -1 on error. Possible reasons for error:
+    - @c eset is not an event set, or it was closed while waiting
+    - @c events is NULL or @c n is 0
+ */
+int EventSetWait(Fid_t eset, fid_event* events, unsigned int n, timeout_t timeout);
+
+
+/*******************************************
+ *
+ * Asynchronous I/O
+ *
+ *******************************************/
+
+/** @brief The maximum number of entries of an asynchronous I/O ring. */
+#define AIO_MAX_ENTRIES 4096
+
+/** @brief Operations of asynchronous I/O requests */
+typedef enum {
+  AIO_READ,       /**< @c Read up to @c len bytes into @c buf */
+  AIO_WRITE,      /**< @c Write up to @c len bytes from @c buf */
+  AIO_ACCEPT,     /**< @c Accept a connection on listener @c fid */
+  AIO_CONNECT     /**< @c Connect socket @c fid to @c port */
+} aio_opcode;
+
+/** @brief A submission queue entry: an asynchronous I/O request. */
+typedef struct aio_sqe {
+  aio_opcode op;        /**< The operation */
+  Fid_t fid;            /**< The stream */
+  void* buf;            /**< The buffer of @c AIO_READ and @c AIO_WRITE */
+  unsigned int len;     /**< The size of @c buf */
+  port_t port;          /**< The port of @c AIO_CONNECT */
+  void* data;           /**< User data, copied to the completion */
+} aio_sqe;
+
+/** @brief A completion queue entry: the outcome of a request. */
+typedef struct aio_cqe {
+  void* data;           /**< The user data of the request */
+  int result;           /**< The return value of the operation */
+} aio_cqe;
+
+/** @brief A pair of submission and completion queues.
+
+  The rings are owned by the process and shared with the kernel. Each queue is
+  an array of @c entries elements (a power of 2), indexed by free-running 
+  counters modulo @c entries.
+
+  The process adds requests at @c sq[sq_tail] and advances @c sq_tail; the 
+  kernel consumes them, advancing @c sq_head, during @c AioSubmit. The kernel
+  adds completions at @c cq[cq_tail] and advances @c cq_tail; the process
+  reaps them, advancing @c cq_head, without a system call.
+  Counters written by one side should be read by the other with
+  acquire semantics (e.g., @c __atomic_load_n).
+
+  @see AioSetup
+  @see AioSubmit
+ */
+typedef struct aio_ring {
+  unsigned int entries;   /**< The size of the queues */
+  unsigned int sq_head;   /**< Advanced by the kernel */
+  unsigned int sq_tail;   /**< Advanced by the process */
+  unsigned int cq_head;   /**< Advanced by the process */
+  unsigned int cq_tail;   /**< Advanced by the kernel */
+  aio_sqe* sq;            /**< The submission queue */
+  aio_cqe* cq;            /**< The completion queue */
+} aio_ring;
+
+
+/** @brief Register the asynchronous I/O rings of the current process.
+
+  The ring, and the arrays it points to, must remain valid for as long as 
+  the process lives. The counters of the ring are reset to 0.
+
+  @param ring the ring to register
+  @returns 0 on success, or -1 on error. Possible reasons for error:
+    - @c ring or its arrays are NULL
+    - @c ring->entries is not a power of 2, or exceeds @c AIO_MAX_ENTRIES
+    - the process has already registered a ring
+ */
+int AioSetup(aio_ring* ring);
+
+
+/** @brief Submit asynchronous I/O requests and wait for completions.
+
+  All requests between @c sq_head and @c sq_tail are consumed, as long as
+  there is room in the completion queue for their completions. Each request
+  is attempted at once; if it would block, it is completed later by a kernel
+  thread, when its stream becomes ready (see @c EventSetWait). 
+  Requests on the same stream and direction complete in submission order.
+
+  Each completion carries the value that the corresponding blocking call
+  would return. A pending @c AIO_CONNECT does not time out. Closing a 
+  stream does not cancel its pending requests; they are dropped when the
+  process exits.
+
+  @param min_complete if not 0, the call blocks until at least this many 
+    completions are waiting to be reaped, or no request is pending.
+  @returns the number of requests consumed, or -1 if the process has not
+    registered a ring.
+ */
+int AioSubmit(unsigned int min_complete);
+
+
+
 
 /*******************************************
  *
@@ -706,6 +1279,42 @@ int ShutDown(Fid_t sock, shutdown_mode how);
   */
 #define PROCINFO_MAX_ARGS_SIZE (128)
 
+/**
+	@brief The kind of a stream, for accounting.
+  */
+typedef enum {
+  STREAM_OTHER,      /**< @brief Any other stream */
+  STREAM_TERMINAL,   /**< @brief A terminal, or the console */
+  STREAM_NULL,       /**< @brief The null device */
+  STREAM_PIPE,       /**< @brief A pipe */
+  STREAM_SOCKET,     /**< @brief A socket */
+  STREAM_INFO,       /**< @brief An information stream (e.g., @c OpenInfo) */
+  STREAM_EVENTSET,   /**< @brief An event set */
+  STREAM_KINDS       /**< @brief The number of stream kinds */
+} stream_kind;
+
+/** @brief The number of time-slice causes, counted by @c procusage.yields 
+    and indexed by @c threadinfo_cause */
+#define PROCINFO_CAUSES 7
+
+/**
+	@brief Resource usage of a process.
+
+	The counters are kept by the kernel as the process runs, and returned
+	in @c procinfo.
+  */
+typedef struct procusage
+{
+	unsigned long cpu_time;      /**< @brief Time spent running by all threads, in usec */
+	unsigned long yields[PROCINFO_CAUSES]; /**< @brief The number of time-slices that
+	                                ended, by cause. The slices ended by 
+	                                @c THREADINFO_QUANTUM are the involuntary ones. */
+	unsigned long bytes_read[STREAM_KINDS];    /**< @brief Bytes read, by stream kind */
+	unsigned long bytes_written[STREAM_KINDS]; /**< @brief Bytes written, by stream kind */
+	unsigned long stack_memory;  /**< @brief Memory in thread stacks, in bytes */
+} procusage;
+
+
 /**
 	@brief A struct containing process-related information for a non-free
 	pid.
@@ -736,6 +1345,11 @@ typedef struct procinfo
 
     If the task's argument is longer (as designated by the @c argl field), the
     bytes contained in this field are just the prefix.  */
+
+  procusage usage;          /**< @brief The resource usage of the process */
+  unsigned int fid_count;   /**< @brief The number of open file ids */
+  unsigned int max_threads; /**< @brief The thread limit, or 0 */
+  unsigned int max_fids;    /**< @brief The file id limit, or 0 for the default */
 } procinfo;
 
 
@@ -756,10 +1370,161 @@ typedef struct procinfo
 	@returns a file id on success, or NOFILE on error. Possible reasons
 		for error are:
 		- the available file ids for the process are exhausted.
+	@see OpenProcInfo
  */
 Fid_t OpenInfo();
 
 
+/**
+	@brief Select the processes returned by @c OpenProcInfo.
+  */
+typedef struct procinfo_filter
+{
+	Pid_t ppid;       /**< @brief Only the children of this process, or NOPROC for all */
+	int alive_only;   /**< @brief If non-zero, skip zombies */
+	Pid_t pid_min;    /**< @brief The lowest pid returned */
+	Pid_t pid_max;    /**< @brief Pids from this one up are not returned */
+} procinfo_filter;
+
+/** @brief A filter that selects all processes. */
+#define PROCINFO_ALL ((procinfo_filter){ .ppid = NOPROC, .alive_only = 0, .pid_min = 0, .pid_max = MAX_PROC })
+
+
+/**
+	@brief Open a kernel information stream for some processes.
+
+	This is like @c OpenInfo, but the stream returns only the processes
+	selected by @c filter. The set of pids is taken when the stream is opened: 
+	processes created later are not returned, and processes that are released
+	before they are read are skipped. Reading the stream takes time proportional
+	to the number of processes in it, not to the size of the process table.
+
+	@param filter the selection, or NULL for all processes
+	@returns a file id on success, or NOFILE on error. Possible reasons
+		for error are:
+		- the available file ids for the process are exhausted.
+	@see OpenInfo
+ */
+Fid_t OpenProcInfo(const procinfo_filter* filter);
+
+
+/** @brief The state of a thread, in a @c threadinfo record */
+typedef enum {
+  THREADINFO_READY,    /**< @brief Runnable, waiting for a core */
+  THREADINFO_RUNNING,  /**< @brief Running on a core */
+  THREADINFO_STOPPED,  /**< @brief Blocked */
+  THREADINFO_EXITED    /**< @brief Exited, but not yet joined */
+} threadinfo_state;
+
+/** @brief The reason a time-slice of a thread ended, in a @c threadinfo record */
+typedef enum {
+  THREADINFO_QUANTUM,  /**< @brief The quantum expired */
+  THREADINFO_IO,       /**< @brief Waiting for I/O */
+  THREADINFO_MUTEX,    /**< @brief Contention on a kernel spinlock */
+  THREADINFO_PIPE,     /**< @brief Waiting at a pipe or socket */
+  THREADINFO_POLL,     /**< @brief Polling a device */
+  THREADINFO_IDLE,     /**< @brief (not used for user threads) */
+  THREADINFO_USER      /**< @brief Any other wait */
+} threadinfo_cause;
+
+/** @brief The number of time-slice causes kept in a @c threadinfo record */
+#define THREADINFO_CAUSES 8
+
+/**
+	@brief Scheduling information of a thread, as returned by thread information streams.
+
+	@see OpenThreadInfo
+  */
+typedef struct threadinfo
+{
+	Tid_t tid;                 /**< @brief The thread */
+	Pid_t pid;                 /**< @brief The process of the thread */
+	threadinfo_state state;    /**< @brief The state of the thread */
+	int priority;              /**< @brief The scheduling priority (0 is the highest) */
+	unsigned long cpu_time;    /**< @brief The time spent running, in usec */
+	unsigned long slices;      /**< @brief The number of time-slices that ended */
+	unsigned char causes[THREADINFO_CAUSES]; /**< @brief The @c threadinfo_cause
+	                               of the last time-slices, most recent first. Only
+	                               the first @c slices entries are meaningful. */
+} threadinfo;
+
+
+/**
+	@brief Open a thread information stream.
+
+	This is a read-only stream that returns a @c threadinfo record for each 
+	thread of a process, taken when the stream is opened. Each @c Read 
+	returns as many whole records as fit in its buffer, and 0 after the 
+	last record. Threads that have exited report only their tid, pid and state.
+
+	@param pid the process, or NOPROC for the current process
+	@returns a file id on success, or NOFILE on error. Possible reasons
+		for error are:
+		- the available file ids for the process are exhausted.
+		- there is no process with this pid.
+ */
+Fid_t OpenThreadInfo(Pid_t pid);
+
+
+/** @brief The state of a socket, in a @c sockinfo record */
+typedef enum {
+  SOCKINFO_UNBOUND,   /**< @brief Neither listening nor connected */
+  SOCKINFO_LISTENER,  /**< @brief Listening on a port */
+  SOCKINFO_PEER       /**< @brief Connected */
+} sockinfo_state;
+
+/**
+	@brief Counters of a socket, as returned by socket information streams.
+
+	Byte counts are in the direction of the socket: @c bytes_in have been 
+	read from it and @c bytes_out have been written to it. The counters of
+	a direction that has been shut down keep their last values.
+
+	@see OpenSocketInfo
+  */
+typedef struct sockinfo
+{
+	Pid_t pid;                /**< @brief The process that opened the socket, 
+	                               or whose listener accepted it. */
+	port_t port;              /**< @brief The port of the socket, or NOPORT. */
+	sockinfo_state state;     /**< @brief The state of the socket. */
+
+	unsigned long bytes_in;   /**< @brief Bytes read from the socket. */
+	unsigned long bytes_out;  /**< @brief Bytes written to the socket. */
+	unsigned int read_waits;  /**< @brief Times a reader blocked on an empty buffer. */
+	unsigned int write_waits; /**< @brief Times a writer blocked on a full buffer
+	                               (or on credit, in shared mode). */
+	unsigned int rx_queued;   /**< @brief Bytes waiting to be read. */
+	unsigned int tx_queued;   /**< @brief Bytes written but not yet read by the peer. */
+	unsigned int rx_peak;     /**< @brief The peak of @c rx_queued. */
+	unsigned int tx_peak;     /**< @brief The peak of @c tx_queued. */
+	unsigned long connect_latency; /**< @brief The time from @c Connect to 
+	                               the admission of the connection, in usec,
+	                               at the resolution of the system clock. */
+
+	unsigned int queued;      /**< @brief Listener: queued connection requests. */
+	unsigned int peak_queued; /**< @brief Listener: the peak of @c queued. */
+	unsigned int accepted;    /**< @brief Listener: connections admitted. */
+	unsigned int reserved;    /**< @brief Listener: connections reserved for 
+	                               the backlog (see @c SOCKOPT_BACKLOG). */
+} sockinfo;
+
+
+/**
+	@brief Open a socket information stream.
+
+	This is a read-only stream that returns a @c sockinfo record for each 
+	socket of the system, taken when the stream is opened. Each @c Read 
+	returns as many whole records as fit in its buffer, and 0 after the 
+	last record.
+
+	@returns a file id on success, or NOFILE on error. Possible reasons
+		for error are:
+		- the available file ids for the process are exhausted.
+ */
+Fid_t OpenSocketInfo();
+
+
 
 
 /*******************************************
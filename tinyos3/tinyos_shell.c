@@ -172,8 +172,8 @@ int SystemInfo(size_t argc, const char** argv)
 	if(finfo!=NOFILE) {
 		/* Print per-process info */
 		procinfo info;
-		printf("%5s %5s %6s %8s %20s\n",
-			"PID", "PPID", "State", "Threads", "Main program"
+		printf("%5s %5s %6s %8s %8s %20s\n",
+			"PID", "PPID", "State", "Threads", "CPU(ms)", "Main program"
 			);
 		/* Read in next piece of info */		
 		while(Read(finfo, (char*) &info, sizeof(info)) > 0) {
@@ -189,11 +189,12 @@ int SystemInfo(size_t argc, const char** argv)
 				if(info.pid==1) pname = "init";
 			}
 
-			printf("%5d %5d %6s %8u %20s\n",
+			printf("%5d %5d %6s %8lu %8lu %20s\n",
 				info.pid,
 				info.ppid,
 				(info.alive?"ALIVE":"ZOMBIE"),
 				info.thread_count,
+				info.usage.cpu_time/1000,
 				pname
 				);
 		}
@@ -488,6 +489,9 @@ int RemoteServer(size_t argc, const char** argv)
 
 	log_init(__globals);
 
+	/* Each connection holds a socket, so do not stop at the default fid limit */
+	SetLimit(LIMIT_FIDS, MAX_FILEID_LIMIT);
+
 	/* Start a thread to listen on */
 	GS(listener) = CreateThread(rsrv_listener_thread, GS(port), __globals);
 	
@@ -635,27 +639,22 @@ static int recv_message(Fid_t sock, void* buf, size_t len)
 /* Helper to execute a remote process */
 static int rsrv_process(size_t argc, const char** argv)
 {
-	checkargs(2);
-	Fid_t sock = atoi(argv[1]);
+	checkargs(1);
 
-	/* Fix the streams */
-	assert(sock!=0 && sock!=1);	
-	Dup2(sock, 0);
-	Dup2(sock, 1);
-	Close(sock);
+	/* The socket was spawned as our standard streams */
 
 	/* (a) find the command */
-	int c = getprog(2);
+	int c = getprog(1);
 	if(c==-1) {
 		/* This will appear in the rcli console */
-		printf("Error in remote process: Command %s is not found\n", argv[2]);
+		printf("Error in remote process: Command %s is not found\n", argv[1]);
 		return -1;
 	}
 	Program proc = COMMANDS[c].prog;
 
 	/* Execute */
 	int exitstatus;
-	WaitChild(Execute(proc, argc-2, argv+2), &exitstatus);
+	WaitChild(Execute(proc, argc-1, argv+1), &exitstatus);
 	return exitstatus;
 }
 
@@ -691,16 +690,15 @@ static int rsrv_client(int sock, void* __globals)
 		
 		/* Prepare to execute subprocess */
 		size_t argc = argscount(argl, args);	
-		const char* argv[argc+2];
+		const char* argv[argc+1];
 		argv[0] = "rsrv_process";
-		char sock_value[32];
-		sprintf(sock_value, "%d", sock);
-		argv[1] = sock_value;
-		argvunpack(argc, argv+2, argl, args);
+		argvunpack(argc, argv+1, argl, args);
 	
-		/* Now, execute the message in a new process */
+		/* Now, execute the message in a new process, with the socket 
+		   as its standard input and output */
 		int exitstatus;
-		Pid_t pid = Execute(rsrv_process, argc+2, argv);
+		fid_map streams[2] = { {sock, 0}, {sock, 1} };
+		Pid_t pid = ExecuteWith(rsrv_process, argc+1, argv, streams, 2);
 		Close(sock);
 		WaitChild(pid, &exitstatus);
 	
@@ -3,7 +3,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <limits.h>
 #include <stdio_ext.h>
+#include <stdint.h>
+#include <ucontext.h>
 
 #include "util.h"
 #include "tinyos.h"
@@ -146,6 +149,13 @@ int ParseProcInfo(procinfo* pinfo, Program* prog, int argc, const char** argv )
 
 
 int Execute(Program prog, size_t argc, const char** argv)
+{
+	return ExecuteWith(prog, argc, argv, NULL, 0);
+}
+
+
+int ExecuteWith(Program prog, size_t argc, const char** argv, 
+	const fid_map* fids, unsigned int nfids)
 {
 	/* We will pack the prog pointer and the arguments to 
 	  an argument buffer.
@@ -164,30 +174,806 @@ int Execute(Program prog, size_t argc, const char** argv)
 	argvpack(args+sizeof(prog), argc, argv);
 
 	/* Execute the process */
-	return Exec(exec_wrapper, argl, args);
+	if(fids == NULL)
+		return Exec(exec_wrapper, argl, args);
+	else
+		return Spawn(exec_wrapper, argl, args, fids, nfids);
+}
+
+
+
+/*
+	Futex-based synchronization
+ */
+
+#define atomic_load(p)  __atomic_load_n((p), __ATOMIC_SEQ_CST)
+
+
+void FMutex_Lock(fmutex* mx)
+{
+	int c = 0;
+	if(__atomic_compare_exchange_n(&mx->state, &c, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		return;
+
+	/* Contended: mark the mutex as having waiters, and sleep */
+	if(c != 2)
+		c = __atomic_exchange_n(&mx->state, 2, __ATOMIC_ACQUIRE);
+	while(c != 0) {
+		FutexWait(&mx->state, 2, TIMEOUT_INFINITE);
+		c = __atomic_exchange_n(&mx->state, 2, __ATOMIC_ACQUIRE);
+	}
+}
+
+int FMutex_TryLock(fmutex* mx)
+{
+	int c = 0;
+	return __atomic_compare_exchange_n(&mx->state, &c, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+void FMutex_Unlock(fmutex* mx)
+{
+	if(__atomic_fetch_sub(&mx->state, 1, __ATOMIC_RELEASE) != 1) {
+		__atomic_store_n(&mx->state, 0, __ATOMIC_RELEASE);
+		FutexWake(&mx->state, 1);
+	}
+}
+
+
+int FCond_TimedWait(fmutex* mx, fcond* cv, timeout_t timeout)
+{
+	/* Waiters register with the mutex locked, so signallers holding it see them */
+	int seq = atomic_load(&cv->seq);
+	__atomic_fetch_add(&cv->waiters, 1, __ATOMIC_SEQ_CST);
+	FMutex_Unlock(mx);
+
+	int woken = FutexWait(&cv->seq, seq, timeout);
+
+	__atomic_fetch_sub(&cv->waiters, 1, __ATOMIC_SEQ_CST);
+	FMutex_Lock(mx);
+
+	/* A signal between the unlock and the sleep changes seq, and counts too */
+	return woken || atomic_load(&cv->seq) != seq;
+}
+
+int FCond_Wait(fmutex* mx, fcond* cv)
+{
+	return FCond_TimedWait(mx, cv, TIMEOUT_INFINITE);
+}
+
+void FCond_Signal(fcond* cv)
+{
+	if(atomic_load(&cv->waiters) == 0)
+		return;
+	__atomic_fetch_add(&cv->seq, 1, __ATOMIC_SEQ_CST);
+	FutexWake(&cv->seq, 1);
+}
+
+void FCond_Broadcast(fcond* cv)
+{
+	if(atomic_load(&cv->waiters) == 0)
+		return;
+	__atomic_fetch_add(&cv->seq, 1, __ATOMIC_SEQ_CST);
+	FutexWake(&cv->seq, INT_MAX);
+}
+
+
+int Sem_TryDown(semaphore* sem)
+{
+	int v = atomic_load(&sem->value);
+	while(v > 0)
+		if(__atomic_compare_exchange_n(&sem->value, &v, v-1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			return 1;
+	return 0;
+}
+
+void Sem_Down(semaphore* sem)
+{
+	while(! Sem_TryDown(sem)) {
+		__atomic_fetch_add(&sem->waiters, 1, __ATOMIC_SEQ_CST);
+		FutexWait(&sem->value, 0, TIMEOUT_INFINITE);
+		__atomic_fetch_sub(&sem->waiters, 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+void Sem_Up(semaphore* sem)
+{
+	__atomic_fetch_add(&sem->value, 1, __ATOMIC_RELEASE);
+	if(atomic_load(&sem->waiters) > 0)
+		FutexWake(&sem->value, 1);
+}
+
+
+/*
+	The reader's increment of its count and the writer's store of @c writer
+	are both followed by a load of the other side (sequentially consistent), 
+	so that at least one of them sees the other.
+ */
+
+int BRLock_ReadLock(brlock* lock)
+{
+	int slot = cpu_core_id;
+	int* readers = &lock->slot[slot].readers;
+
+	while(1) {
+		__atomic_fetch_add(readers, 1, __ATOMIC_SEQ_CST);
+		if(! atomic_load(&lock->writer))
+			return slot;
+
+		/* Back off, letting the writer know, and wait for it */
+		__atomic_fetch_sub(readers, 1, __ATOMIC_SEQ_CST);
+		FutexWake(readers, 1);
+		FutexWait(&lock->writer, 1, TIMEOUT_INFINITE);
+	}
 }
 
+void BRLock_ReadUnlock(brlock* lock, int slot)
+{
+	int* readers = &lock->slot[slot].readers;
+	if(__atomic_sub_fetch(readers, 1, __ATOMIC_SEQ_CST) == 0 && atomic_load(&lock->writer))
+		FutexWake(readers, 1);
+}
+
+void BRLock_WriteLock(brlock* lock)
+{
+	FMutex_Lock(&lock->wmx);
+	__atomic_store_n(&lock->writer, 1, __ATOMIC_SEQ_CST);
+
+	/* Wait for the readers of each core to drain */
+	for(int i=0; i<MAX_CORES; i++) {
+		int n;
+		while((n = atomic_load(&lock->slot[i].readers)) != 0)
+			FutexWait(&lock->slot[i].readers, n, TIMEOUT_INFINITE);
+	}
+}
+
+void BRLock_WriteUnlock(brlock* lock)
+{
+	__atomic_store_n(&lock->writer, 0, __ATOMIC_SEQ_CST);
+	FutexWake(&lock->writer, INT_MAX);
+	FMutex_Unlock(&lock->wmx);
+}
 
 
 void BarrierSync(barrier* bar, unsigned int n)
 {
 	assert(n>0);
-	Mutex_Lock(& bar->mx);
 
-	int epoch = bar->epoch;
-	assert(bar->count < n);
+	int epoch = atomic_load(&bar->epoch);
+	int count = __atomic_add_fetch(&bar->count, 1, __ATOMIC_SEQ_CST);
+	assert(count <= n);
+
+	if(count == n) {
+		/* The next round cannot start before the epoch changes */
+		__atomic_store_n(&bar->count, 0, __ATOMIC_SEQ_CST);
+		__atomic_fetch_add(&bar->epoch, 1, __ATOMIC_SEQ_CST);
+		if(n > 1)
+			FutexWake(&bar->epoch, INT_MAX);
+		return;
+	}
+
+	while(atomic_load(&bar->epoch) == epoch)
+		FutexWait(&bar->epoch, epoch, TIMEOUT_INFINITE);
+}
+
+
+
+
+int Future_Wait(future* fut)
+{
+	while(! atomic_load(&fut->done))
+		FutexWait(&fut->done, 0, TIMEOUT_INFINITE);
+	return fut->result;
+}
+
+
+/*
+	Thread pools.
+
+	The queued tasks are counted by the semaphore @c items, and the free
+	places in the deques by the semaphore @c slots. A worker that takes a 
+	token from @c items is sure to find a task in some deque (maybe after 
+	another worker has taken one it saw), and a submitter that takes a token 
+	from @c slots is sure to find room in some deque.
+ */
+typedef struct tp_task {
+	Task task;
+	int argl;
+	void* args;
+	future* fut;
+} tp_task;
+
+typedef struct tp_deque {
+	fmutex lock;
+	unsigned int head, tail;    /* tasks are taken at the head by thieves, at the tail by the owner */
+	tp_task* ring;
+} __attribute__((aligned(64))) tp_deque;
+
+struct threadpool {
+	unsigned int nworkers;
+	unsigned int queue_size;
+	tp_deque* deques;
+	Tid_t* workers;
+
+	semaphore items;
+	semaphore slots;
+	unsigned int next;          /* the deque of the next submitted task */
+	int stopping;
+
+	int pending;                /* submitted tasks that have not completed */
+	fmutex mx;
+	fcond idle;                 /* signalled when pending drops to 0 */
+};
+
+
+static int tp_deque_push(threadpool* pool, tp_deque* dq, tp_task* t)
+{
+	int ok = 0;
+	FMutex_Lock(&dq->lock);
+	if(dq->tail - dq->head < pool->queue_size) {
+		dq->ring[dq->tail++ % pool->queue_size] = *t;
+		ok = 1;
+	}
+	FMutex_Unlock(&dq->lock);
+	return ok;
+}
+
+static int tp_deque_take(threadpool* pool, tp_deque* dq, tp_task* t, int owner)
+{
+	int ok = 0;
+	FMutex_Lock(&dq->lock);
+	if(dq->tail != dq->head) {
+		if(owner)
+			*t = dq->ring[--dq->tail % pool->queue_size];
+		else
+			*t = dq->ring[dq->head++ % pool->queue_size];
+		ok = 1;
+	}
+	FMutex_Unlock(&dq->lock);
+	return ok;
+}
+
+static int tp_worker(int id, void* arg)
+{
+	threadpool* pool = arg;
+	tp_task t;
+
+	while(1) {
+		Sem_Down(&pool->items);
+
+		/* Our own deque first, then steal from the others */
+		int found = tp_deque_take(pool, &pool->deques[id], &t, 1);
+		for(unsigned int i=1; !found; i++)
+			found = tp_deque_take(pool, &pool->deques[(id+i) % pool->nworkers], &t, 0);
+
+		if(t.task == NULL) 
+			break;     /* the pool is stopping */
+		Sem_Up(&pool->slots);
+
+		int result = t.task(t.argl, t.args);
+		if(t.fut) {
+			t.fut->result = result;
+			__atomic_store_n(&t.fut->done, 1, __ATOMIC_RELEASE);
+			FutexWake(&t.fut->done, INT_MAX);
+		}
+
+		if(__atomic_sub_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST) == 0) {
+			FMutex_Lock(&pool->mx);
+			FCond_Broadcast(&pool->idle);
+			FMutex_Unlock(&pool->mx);
+		}
+	}
+	return 0;
+}
+
+static void tp_enqueue(threadpool* pool, tp_task* t)
+{
+	Sem_Down(&pool->slots);
+	unsigned int d = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+	while(! tp_deque_push(pool, &pool->deques[d % pool->nworkers], t))
+		d++;
+	Sem_Up(&pool->items);
+}
+
+threadpool* ThreadPool_Create(unsigned int nworkers, unsigned int queue_size)
+{
+	if(nworkers == 0 || queue_size == 0)
+		return NULL;
+
+	threadpool* pool = malloc(sizeof(threadpool));
+	pool->nworkers = nworkers;
+	pool->queue_size = queue_size;
+	pool->deques = aligned_alloc(64, nworkers*sizeof(tp_deque));
+	pool->workers = malloc(nworkers*sizeof(Tid_t));
+	for(unsigned int i=0; i<nworkers; i++) {
+		pool->deques[i].lock = FMUTEX_INIT;
+		pool->deques[i].head = pool->deques[i].tail = 0;
+		pool->deques[i].ring = malloc(queue_size*sizeof(tp_task));
+	}
+
+	pool->items = SEMAPHORE_INIT(0);
+	pool->slots = SEMAPHORE_INIT(nworkers*queue_size);
+	pool->next = 0;
+	pool->stopping = 0;
+	pool->pending = 0;
+	pool->mx = FMUTEX_INIT;
+	pool->idle = FCOND_INIT;
+
+	for(unsigned int i=0; i<nworkers; i++)
+		pool->workers[i] = CreateThread(tp_worker, i, pool);
+
+	return pool;
+}
+
+int ThreadPool_Submit(threadpool* pool, Task task, int argl, void* args, future* fut)
+{
+	if(task == NULL || atomic_load(&pool->stopping))
+		return -1;
+
+	if(fut) 
+		*fut = FUTURE_INIT;
+	__atomic_fetch_add(&pool->pending, 1, __ATOMIC_SEQ_CST);
+
+	tp_task t = { .task = task, .argl = argl, .args = args, .fut = fut };
+	tp_enqueue(pool, &t);
+	return 0;
+}
+
+void ThreadPool_Wait(threadpool* pool)
+{
+	FMutex_Lock(&pool->mx);
+	while(atomic_load(&pool->pending) > 0)
+		FCond_Wait(&pool->mx, &pool->idle);
+	FMutex_Unlock(&pool->mx);
+}
+
+void ThreadPool_Destroy(threadpool* pool)
+{
+	__atomic_store_n(&pool->stopping, 1, __ATOMIC_SEQ_CST);
+	ThreadPool_Wait(pool);
+
+	/* A NULL task stops the worker that takes it */
+	tp_task stop = { .task = NULL };
+	for(unsigned int i=0; i<pool->nworkers; i++)
+		tp_enqueue(pool, &stop);
+	for(unsigned int i=0; i<pool->nworkers; i++)
+		ThreadJoin(pool->workers[i], NULL);
+
+	for(unsigned int i=0; i<pool->nworkers; i++)
+		free(pool->deques[i].ring);
+	free(pool->deques);
+	free(pool->workers);
+	free(pool);
+}
+
+
+/*
+	Fibers.
+
+	A fiber's control block lies at the bottom of its stack, which is aligned 
+	to its size; therefore a fiber finds itself from the address of any local 
+	variable, without help from the kernel.
+
+	A fiber that stops running switches back to its carrier, and leaves an 
+	action for the carrier to perform: to queue it again, to park it or to 
+	free it. This way, the fiber is never made runnable (and picked up by
+	another carrier) before its context has been saved.
+ */
+typedef enum fiber_action { 
+	FIBER_RUN, FIBER_YIELD, FIBER_PARK, FIBER_EXIT 
+} fiber_action;
+
+typedef struct fiber {
+	ucontext_t ctx;
+	fiber_pool* pool;
+	ucontext_t* carrier;        /* the context of the carrier running us */
+	fiber_action action;
+
+	Task task;
+	int argl;
+	void* args;
+
+	Fid_t wait_fid;
+	unsigned int wait_events;
+	int wait_result;
+
+	struct fiber* next;         /* in the run queue, or among the waiters of a stream */
+} fiber;
+
+#define FIBER_STACK_OFFSET  ((sizeof(fiber) + 63) & ~(size_t)63)
+
+#define FIBER_POLL_EVENTS  16
+
+/*
+	The fibers parked on a stream form a list, and the stream is registered
+	in the event set for the union of their events. The lists and the 
+	registrations are changed together, under the pool mutex.
+
+	A carrier polls the event set only if it has no fiber to run. It sleeps 
+	until some stream is ready or, if a fiber is made runnable meanwhile, 
+	until it is woken by a byte on the wake-up pipe of the pool.
+ */
+struct fiber_pool {
+	unsigned int ncarriers;
+	Tid_t* carriers;
+
+	fmutex mx;                  /* protects the run queue and parked[] */
+	fiber *head, *tail;
+	int seq;                    /* changed on each push to the run queue */
+
+	int live;                   /* the fibers that have not finished */
+	int stopping;
+
+	fmutex poll_mx;             /* held by the carrier polling the event set */
+	Fid_t eset;
+	int nparked;
+	fiber** parked;             /* the fibers parked on each fid, grows as needed */
+	int parked_size;
+
+	pipe_t wake;                /* wakes up the polling carrier */
+	int polling;                /* a carrier sleeps in EventSetWait */
+	int wake_pending;           /* a byte is in the wake-up pipe */
+};
+
+
+static inline fiber* fiber_self()
+{
+	char here;
+	return (fiber*)((uintptr_t)&here & ~(uintptr_t)(FIBER_STACK_SIZE-1));
+}
+
+/* Wake up the polling carrier, if any, to notice a runnable fiber */
+static void fiber_wake_poller(fiber_pool* pool)
+{
+	int zero = 0;
+	if(atomic_load(&pool->polling) && 
+		__atomic_compare_exchange_n(&pool->wake_pending, &zero, 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+		Write(pool->wake.write, "", 1);
+}
+
+static void fiber_push(fiber_pool* pool, fiber* f)
+{
+	f->next = NULL;
+	FMutex_Lock(&pool->mx);
+	if(pool->tail) 
+		pool->tail->next = f;
+	else
+		pool->head = f;
+	pool->tail = f;
+	FMutex_Unlock(&pool->mx);
+
+	__atomic_fetch_add(&pool->seq, 1, __ATOMIC_SEQ_CST);
+	FutexWake(&pool->seq, 1);
+	fiber_wake_poller(pool);
+}
+
+static fiber* fiber_pop(fiber_pool* pool)
+{
+	FMutex_Lock(&pool->mx);
+	fiber* f = pool->head;
+	if(f) {
+		pool->head = f->next;
+		if(pool->head == NULL) pool->tail = NULL;
+	}
+	FMutex_Unlock(&pool->mx);
+	return f;
+}
+
+/* Switch to the carrier, leaving it an action */
+static void fiber_switch(fiber* f, fiber_action action)
+{
+	f->action = action;
+	swapcontext(&f->ctx, f->carrier);
+}
+
+static void fiber_start()
+{
+	fiber* f = fiber_self();
+	f->task(f->argl, f->args);
+	f->action = FIBER_EXIT;
+	setcontext(f->carrier);
+}
+
+/* The events that the fibers of a list wait for */
+static unsigned int fiber_wait_events(fiber* list)
+{
+	unsigned int events = 0;
+	for(fiber* f = list; f != NULL; f = f->next)
+		events |= f->wait_events;
+	return events;
+}
+
+/* Register a fiber that switched out to wait for a stream */
+static void fiber_park(fiber_pool* pool, fiber* f)
+{
+	Fid_t fid = f->wait_fid;
+	int rc;
+
+	FMutex_Lock(&pool->mx);
+	if(fid >= pool->parked_size) {
+		int size = pool->parked_size;
+		while(size <= fid) size *= 2;
+		pool->parked = realloc(pool->parked, size*sizeof(fiber*));
+		for(int i=pool->parked_size; i<size; i++)
+			pool->parked[i] = NULL;
+		pool->parked_size = size;
+	}
+
+	fiber* list = pool->parked[fid];
+	unsigned int events = fiber_wait_events(list);
+	if(list == NULL)
+		rc = EventSetCtl(pool->eset, EVENTSET_ADD, fid, f->wait_events);
+	else if((events | f->wait_events) != events)
+		rc = EventSetCtl(pool->eset, EVENTSET_MOD, fid, events | f->wait_events);
+	else
+		rc = 0;
+
+	if(rc == 0) {
+		f->next = list;
+		pool->parked[fid] = f;
+	}
+	FMutex_Unlock(&pool->mx);
+
+	if(rc == 0)
+		__atomic_fetch_add(&pool->nparked, 1, __ATOMIC_SEQ_CST);
+	else {
+		f->wait_result = -1;
+		fiber_push(pool, f);
+	}
+}
 
-	bar->count ++;
-	if(bar->count == n) {
-		bar->epoch ++;
-		bar->count = 0;
-		Cond_Broadcast(&bar->cv);
+/* Make runnable the fibers parked on a stream, that wait for the given events */
+static void fiber_unpark(fiber_pool* pool, Fid_t fid, unsigned int events)
+{
+	fiber* ready = NULL;
+
+	FMutex_Lock(&pool->mx);
+	if(fid < pool->parked_size) {
+		fiber** pf = &pool->parked[fid];
+		while(*pf != NULL) {
+			fiber* f = *pf;
+			if((f->wait_events & events) || (events & EVENT_HANGUP)) {
+				*pf = f->next;
+				f->next = ready;
+				ready = f;
+			} 
+			else
+				pf = &f->next;
+		}
+		/* Register the stream only for the events still waited for */
+		if(ready != NULL) {
+			if(pool->parked[fid] == NULL)
+				EventSetCtl(pool->eset, EVENTSET_DEL, fid, 0);
+			else
+				EventSetCtl(pool->eset, EVENTSET_MOD, fid, fiber_wait_events(pool->parked[fid]));
+		}
+	}
+	FMutex_Unlock(&pool->mx);
+
+	while(ready != NULL) {
+		fiber* f = ready;
+		ready = f->next;
+		__atomic_fetch_sub(&pool->nparked, 1, __ATOMIC_SEQ_CST);
+		f->wait_result = 0;
+		fiber_push(pool, f);
 	}
+}
 
-	while(epoch == bar->epoch)
-		Cond_Wait(&bar->mx, &bar->cv);
+/* Wait for streams to become ready, unless the run queue has changed since seq */
+static void fiber_poll(fiber_pool* pool, int seq)
+{
+	fid_event ev[FIBER_POLL_EVENTS];
+
+	__atomic_store_n(&pool->polling, 1, __ATOMIC_SEQ_CST);
+	timeout_t timeout = (atomic_load(&pool->seq) == seq) ? TIMEOUT_INFINITE : 0;
+	int n = EventSetWait(pool->eset, ev, FIBER_POLL_EVENTS, timeout);
+	__atomic_store_n(&pool->polling, 0, __ATOMIC_SEQ_CST);
+
+	for(int i=0; i<n; i++) {
+		if(ev[i].fid == pool->wake.read) {
+			char buf[16];
+			__atomic_store_n(&pool->wake_pending, 0, __ATOMIC_SEQ_CST);
+			while(Read(pool->wake.read, buf, sizeof(buf)) > 0);
+		}
+		else
+			fiber_unpark(pool, ev[i].fid, ev[i].events);
+	}
+}
 
-	Mutex_Unlock(& bar->mx);
+static void fiber_run(fiber_pool* pool, ucontext_t* carrier, fiber* f)
+{
+	f->carrier = carrier;
+	f->action = FIBER_RUN;
+	swapcontext(carrier, &f->ctx);
+
+	switch(f->action) {
+	case FIBER_YIELD:
+		fiber_push(pool, f);
+		break;
+	case FIBER_PARK:
+		fiber_park(pool, f);
+		break;
+	case FIBER_EXIT:
+		free(f);
+		if(__atomic_sub_fetch(&pool->live, 1, __ATOMIC_SEQ_CST) == 0)
+			FutexWake(&pool->live, INT_MAX);
+		break;
+	default:
+		assert(0);
+	}
+}
+
+static int fiber_carrier(int argl, void* args)
+{
+	fiber_pool* pool = args;
+	ucontext_t carrier;
+
+	while(1) {
+		int seq = atomic_load(&pool->seq);
+
+		fiber* f = fiber_pop(pool);
+		if(f) {
+			fiber_run(pool, &carrier, f);
+			continue;
+		}
+
+		if(atomic_load(&pool->stopping))
+			break;
+
+		if(atomic_load(&pool->nparked) > 0 && FMutex_TryLock(&pool->poll_mx)) {
+			fiber_poll(pool, seq);
+			FMutex_Unlock(&pool->poll_mx);
+
+			/* Let a sleeping carrier take over the polling, if we get busy */
+			if(atomic_load(&pool->nparked) > 0) {
+				__atomic_fetch_add(&pool->seq, 1, __ATOMIC_SEQ_CST);
+				FutexWake(&pool->seq, 1);
+			}
+		} 
+		else
+			FutexWait(&pool->seq, seq, TIMEOUT_INFINITE);
+	}
+	return 0;
 }
 
 
+fiber_pool* FiberPool_Create(unsigned int ncarriers)
+{
+	if(ncarriers == 0)
+		return NULL;
+
+	Fid_t eset = OpenEventSet();
+	if(eset == NOFILE)
+		return NULL;
+	pipe_t wake;
+	if(Pipe(&wake) != 0) {
+		Close(eset);
+		return NULL;
+	}
+	SetFlags(wake.read, FID_NONBLOCK);
+	EventSetCtl(eset, EVENTSET_ADD, wake.read, EVENT_READ);
+
+	fiber_pool* pool = malloc(sizeof(fiber_pool));
+	pool->ncarriers = ncarriers;
+	pool->carriers = malloc(ncarriers*sizeof(Tid_t));
+	pool->mx = FMUTEX_INIT;
+	pool->head = pool->tail = NULL;
+	pool->seq = 0;
+	pool->live = 0;
+	pool->stopping = 0;
+	pool->poll_mx = FMUTEX_INIT;
+	pool->eset = eset;
+	pool->nparked = 0;
+	pool->parked_size = MAX_FILEID;
+	pool->parked = malloc(MAX_FILEID*sizeof(fiber*));
+	for(int i=0; i<MAX_FILEID; i++)
+		pool->parked[i] = NULL;
+	pool->wake = wake;
+	pool->polling = 0;
+	pool->wake_pending = 0;
+
+	for(unsigned int i=0; i<ncarriers; i++)
+		pool->carriers[i] = CreateThread(fiber_carrier, i, pool);
+	return pool;
+}
+
+int FiberPool_Spawn(fiber_pool* pool, Task task, int argl, void* args)
+{
+	if(task == NULL || atomic_load(&pool->stopping))
+		return -1;
+
+	fiber* f = aligned_alloc(FIBER_STACK_SIZE, FIBER_STACK_SIZE);
+	if(f == NULL)
+		return -1;
+
+	f->pool = pool;
+	f->task = task;
+	f->argl = argl;
+	f->args = args;
+
+	getcontext(&f->ctx);
+	f->ctx.uc_link = NULL;
+	f->ctx.uc_stack.ss_sp = (char*)f + FIBER_STACK_OFFSET;
+	f->ctx.uc_stack.ss_size = FIBER_STACK_SIZE - FIBER_STACK_OFFSET;
+	makecontext(&f->ctx, fiber_start, 0);
+
+	__atomic_fetch_add(&pool->live, 1, __ATOMIC_SEQ_CST);
+	fiber_push(pool, f);
+	return 0;
+}
+
+void FiberPool_Join(fiber_pool* pool)
+{
+	int n;
+	while((n = atomic_load(&pool->live)) > 0)
+		FutexWait(&pool->live, n, TIMEOUT_INFINITE);
+
+	__atomic_store_n(&pool->stopping, 1, __ATOMIC_SEQ_CST);
+	__atomic_fetch_add(&pool->seq, 1, __ATOMIC_SEQ_CST);
+	FutexWake(&pool->seq, INT_MAX);
+	fiber_wake_poller(pool);
+	for(unsigned int i=0; i<pool->ncarriers; i++)
+		ThreadJoin(pool->carriers[i], NULL);
+
+	Close(pool->eset);
+	Close(pool->wake.read);
+	Close(pool->wake.write);
+	free(pool->carriers);
+	free(pool->parked);
+	free(pool);
+}
+
+void Fiber_Yield()
+{
+	fiber_switch(fiber_self(), FIBER_YIELD);
+}
+
+int Fiber_Wait(Fid_t fid, unsigned int events)
+{
+	if(fid < 0)
+		return -1;
+
+	fiber* f = fiber_self();
+	f->wait_fid = fid;
+	f->wait_events = events;
+	fiber_switch(f, FIBER_PARK);
+	return f->wait_result;
+}
+
+/*
+	The stream operations of fibers are made non-blocking through the flags
+	of the carrier thread, not of the stream, which may be shared with 
+	threads outside the pool.
+ */
+static int fiber_read_nonblocking(Fid_t fd, char* buf, unsigned int size)
+{
+	int flags = SetThreadFlags(FID_NONBLOCK);
+	int rc = Read(fd, buf, size);
+	SetThreadFlags(flags);
+	return rc;
+}
+
+static int fiber_write_nonblocking(Fid_t fd, const char* buf, unsigned int size)
+{
+	int flags = SetThreadFlags(FID_NONBLOCK);
+	int rc = Write(fd, buf, size);
+	SetThreadFlags(flags);
+	return rc;
+}
+
+int Fiber_Read(Fid_t fd, char* buf, unsigned int size)
+{
+	int rc;
+	while((rc = fiber_read_nonblocking(fd, buf, size)) == WOULDBLOCK)
+		if(Fiber_Wait(fd, EVENT_READ) < 0) 
+			return -1;
+	return rc;
+}
+
+int Fiber_Write(Fid_t fd, const char* buf, unsigned int size)
+{
+	int rc;
+	while((rc = fiber_write_nonblocking(fd, buf, size)) == WOULDBLOCK)
+		if(Fiber_Wait(fd, EVENT_WRITE) < 0) 
+			return -1;
+	return rc;
+}
@@ -4,6 +4,7 @@
 
 #include <stdio.h>
 #include "tinyos.h"
+#include "bios.h"
 
 /**
 	@file tinyoslib.h
@@ -43,6 +44,16 @@ typedef int (*Program)(size_t argc, const char** argv);
   */
 int Execute(Program prog, size_t argc, const char** argv);
 
+/**
+	@brief Execute a new process with the given file ids.
+
+	This is like @ref Execute, but uses the Spawn system call, so that
+	the new process receives exactly the file ids mapped by @c fids.
+	If @c fids is NULL, this is the same as @ref Execute.
+  */
+int ExecuteWith(Program prog, size_t argc, const char** argv, 
+	const fid_map* fids, unsigned int nfids);
+
 
 /**
 	@brief Try to reclaim the arguments of a process.
@@ -73,17 +84,233 @@ int Execute(Program prog, size_t argc, const char** argv);
 int ParseProcInfo(procinfo* pinfo, Program* prog, int argc, const char** argv );
 
 
+/*
+	Synchronization objects built on futexes (see @ref FutexWait). Their 
+	uncontended operations are atomic instructions; they only enter the 
+	kernel to sleep, or to wake up sleeping threads. 
+ */
+
+/**
+	@brief A mutex built on a futex.
+
+	The state is 0 when unlocked, 1 when locked, and 2 when locked with 
+	(possible) waiters.
+  */
+typedef struct fmutex {
+	int state;
+} fmutex;
+
+#define FMUTEX_INIT  ((fmutex){ 0 })
+
+void FMutex_Lock(fmutex* mx);
+
+/** @brief Lock the mutex if it is unlocked. Returns 1 on success, 0 otherwise. */
+int FMutex_TryLock(fmutex* mx);
+
+void FMutex_Unlock(fmutex* mx);
+
+
+/**
+	@brief A condition variable built on a futex.
+
+	Signalling a condition variable without waiters does not enter the kernel.
+  */
+typedef struct fcond {
+	int seq;            /**< @brief Changed by each signal */
+	int waiters;        /**< @brief The number of waiting threads */
+} fcond;
+
+#define FCOND_INIT  ((fcond){ 0, 0 })
+
+/** @brief Wait on the condition variable, with the mutex locked. 
+	Returns 1 if woken up by a signal or broadcast, 0 otherwise. */
+int FCond_Wait(fmutex* mx, fcond* cv);
+
+/** @brief As @c FCond_Wait, with a timeout in milliseconds. */
+int FCond_TimedWait(fmutex* mx, fcond* cv, timeout_t timeout);
+
+void FCond_Signal(fcond* cv);
+void FCond_Broadcast(fcond* cv);
+
+
+/**
+	@brief A counting semaphore built on a futex.
+  */
+typedef struct semaphore {
+	int value;
+	int waiters;
+} semaphore;
+
+#define SEMAPHORE_INIT(n)  ((semaphore){ (n), 0 })
+
+/** @brief Decrement the semaphore, waiting while it is 0. */
+void Sem_Down(semaphore* sem);
+
+/** @brief Decrement the semaphore if it is positive. Returns 1 on success, 0 otherwise. */
+int Sem_TryDown(semaphore* sem);
+
+/** @brief Increment the semaphore, waking up a waiter. */
+void Sem_Up(semaphore* sem);
+
+
+/**
+	@brief A reader-writer lock for read-mostly data (a big-reader lock).
+
+	Each core has its own count of readers, in its own cache line, so that
+	readers on different cores do not contend. A reader only touches the 
+	count of its core, and checks for a writer. A writer announces itself,
+	and then waits for the counts of all cores to drain; it is therefore 
+	expensive, in proportion to @c MAX_CORES. Writers are preferred: new
+	readers wait while a writer is waiting or holds the lock.
+
+	A reader may move to another core while it holds the lock, so
+	@c BRLock_ReadLock returns the slot to pass to @c BRLock_ReadUnlock.
+  */
+typedef struct brlock {
+	struct {
+		int readers;
+	} __attribute__((aligned(64))) slot[MAX_CORES];
+
+	int writer;         /**< @brief 1 while a writer waits for or holds the lock */
+	fmutex wmx;         /**< @brief Serializes the writers */
+} brlock;
+
+#define BRLOCK_INIT  ((brlock){ .writer = 0, .wmx = FMUTEX_INIT })
+
+/** @brief Lock for reading. Returns the slot for @c BRLock_ReadUnlock. */
+int BRLock_ReadLock(brlock* lock);
+
+void BRLock_ReadUnlock(brlock* lock, int slot);
+
+void BRLock_WriteLock(brlock* lock);
+
+void BRLock_WriteUnlock(brlock* lock);
+
+
 
 typedef struct barrier {
-	Mutex mx;
-	CondVar cv;
-	unsigned int count, epoch;
+	int count, epoch;
 } barrier;
 
-#define BARRIER_INIT  ((barrier){ MUTEX_INIT, COND_INIT, 0, 0})
+#define BARRIER_INIT  ((barrier){ 0, 0 })
 
 
 void BarrierSync(barrier* bar, unsigned int n);
 
 
+/**
+	@brief The result of a task submitted to a thread pool.
+  */
+typedef struct future {
+	int done;           /**< @brief Set to 1 when the task has completed */
+	int result;         /**< @brief The return value of the task */
+} future;
+
+#define FUTURE_INIT  ((future){ 0, 0 })
+
+/** @brief Wait for the task of the future to complete, and return its result. */
+int Future_Wait(future* fut);
+
+
+/**
+	@brief A pool of worker threads, executing submitted tasks.
+
+	Each worker has a bounded deque of tasks. Submitted tasks are spread 
+	over the deques; a worker takes the newest task of its own deque, and 
+	when it is empty, it steals the oldest task of another worker's deque.
+	The total number of queued tasks is bounded, and @c ThreadPool_Submit 
+	waits while the queues are full.
+
+	A thread pool avoids the cost of creating a thread per task. Tasks
+	should not block waiting for other tasks of the same pool, since all 
+	the workers may end up waiting.
+  */
+typedef struct threadpool threadpool;
+
+/**
+	@brief Create a thread pool.
+
+	@param nworkers the number of worker threads
+	@param queue_size the capacity of each worker's deque
+	@returns the new pool, or NULL on error
+  */
+threadpool* ThreadPool_Create(unsigned int nworkers, unsigned int queue_size);
+
+/**
+	@brief Submit a task to a thread pool. 
+
+	The call waits while the pool's queues are full. If @c fut is not NULL, 
+	it is initialized, and completed with the result of the task.
+
+	@returns 0 on success, -1 if the pool is being destroyed
+  */
+int ThreadPool_Submit(threadpool* pool, Task task, int argl, void* args, future* fut);
+
+/** @brief Wait until all the tasks submitted so far have completed. */
+void ThreadPool_Wait(threadpool* pool);
+
+/** @brief Wait for all the submitted tasks, stop the workers and free the pool. */
+void ThreadPool_Destroy(threadpool* pool);
+
+
+/**
+	@brief The size of the stack of a fiber (including its control block).
+  */
+#define FIBER_STACK_SIZE  (32*1024)
+
+/**
+	@brief A pool of fibers (user-level threads), run by a number of carrier threads.
+
+	Fibers are much cheaper than threads: they have small stacks, and they
+	are created and switched without entering the kernel. A fiber runs until 
+	it calls @c Fiber_Yield, waits for a stream with @c Fiber_Wait (or the 
+	calls built on it, such as @c Fiber_Read), or returns. Fibers are not
+	preempted by each other, but the carrier threads are preempted by the
+	kernel as usual.
+
+	A fiber which waits for a stream is parked, and the carrier runs another 
+	fiber. The streams of parked fibers are monitored by an event set of the
+	pool, and a fiber is made runnable again when its stream is ready. 
+	Several fibers may wait for the same stream. A stream must not be 
+	closed while a fiber waits for it.
+
+	The functions named @c Fiber_* must only be called by fibers.
+  */
+typedef struct fiber_pool fiber_pool;
+
+/** @brief Create a fiber pool, with the given number of carrier threads. */
+fiber_pool* FiberPool_Create(unsigned int ncarriers);
+
+/** @brief Create a new fiber in the pool, executing @c task(argl, args).
+	Returns 0 on success and -1 on error. */
+int FiberPool_Spawn(fiber_pool* pool, Task task, int argl, void* args);
+
+/** @brief Wait for all the fibers to finish, then stop the carriers and free the pool. */
+void FiberPool_Join(fiber_pool* pool);
+
+/** @brief Let the other runnable fibers run. */
+void Fiber_Yield();
+
+/** 
+	@brief Park the fiber until a stream is ready for the given events. 
+
+	Returns 0 when the stream may be ready (the operation should be retried), 
+	or -1 if the stream cannot be waited for.
+  */
+int Fiber_Wait(Fid_t fid, unsigned int events);
+
+/**
+	@brief Read from a stream, parking the fiber instead of blocking.
+
+	The read is non-blocking for the carrier thread (see @c SetThreadFlags), 
+	so that it never blocks; the flags of the stream are not changed. 
+	Returns as @c Read.
+  */
+int Fiber_Read(Fid_t fd, char* buf, unsigned int size);
+
+/** @brief Write to a stream, parking the fiber instead of blocking. 
+	See @c Fiber_Read. */
+int Fiber_Write(Fid_t fd, const char* buf, unsigned int size);
+
+
 #endif
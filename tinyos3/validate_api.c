@@ -295,6 +295,313 @@ BOOT_TEST(test_exit_returns_status,
 }
 
 
+static int blocked_child(int argl, void* args)
+{
+	char c;
+	pipe_t* p = args;
+	Close(p->write);
+	ASSERT(Read(p->read, &c, 1)==0);
+	return 42;
+}
+
+static int waitchild_thread(int argl, void* args)
+{
+	int status = 0;
+	Pid_t cpid = WaitChild(argl, &status);
+	ASSERT(cpid==NOPROC || status==42);
+	return cpid;
+}
+
+BOOT_TEST(test_waitchild_by_many_threads,
+	"Test that when many threads wait for the same child, exactly one reaps it."
+	)
+{
+	pipe_t p;
+	ASSERT(Pipe(&p)==0);
+	Pid_t cpid = Exec(blocked_child, sizeof(p), &p);
+	ASSERT(cpid!=NOPROC);
+	Pid_t other = Exec(exiting_child, 0, NULL);
+	ASSERT(other!=NOPROC);
+
+	Tid_t t[4];
+	for(int i=0; i<4; i++)
+		ASSERT((t[i] = CreateThread(waitchild_thread, cpid, NULL))!=NOTHREAD);
+
+	/* A sibling exiting does not disturb the waiters */
+	int status;
+	ASSERT(WaitChild(other, &status)==other);
+	ASSERT(status==other);
+
+	/* Let the child go */
+	Close(p.write);
+	Close(p.read);
+
+	int reaped = 0;
+	for(int i=0; i<4; i++) {
+		int ret;
+		ASSERT(ThreadJoin(t[i], &ret)==0);
+		if(ret==cpid) reaped++;
+		else ASSERT(ret==NOPROC);
+	}
+	ASSERT(reaped==1);
+	ASSERT(WaitChild(NOPROC, NULL)==NOPROC);
+	return 0;
+}
+
+
+static int read_procinfo(const procinfo_filter* filter, Pid_t* pids, int max)
+{
+	Fid_t finfo = OpenProcInfo(filter);
+	ASSERT(finfo!=NOFILE);
+	procinfo info[3];
+	int n = 0, rc;
+	while((rc = Read(finfo, (char*)info, sizeof(info))) > 0) {
+		ASSERT(rc % sizeof(procinfo) == 0);
+		for(int i=0; i < rc/sizeof(procinfo); i++) {
+			ASSERT(n < max);
+			pids[n++] = info[i].pid;
+		}
+	}
+	ASSERT(rc==0);
+	ASSERT(Close(finfo)==0);
+	return n;
+}
+
+BOOT_TEST(test_proc_info_filter,
+	"Test that OpenProcInfo returns the processes selected by the filter."
+	)
+{
+	pipe_t p;
+	ASSERT(Pipe(&p)==0);
+
+	Pid_t alive[5], zombie[5];
+	for(int i=0; i<5; i++) {
+		ASSERT((alive[i] = Exec(blocked_child, sizeof(p), &p))!=NOPROC);
+		ASSERT((zombie[i] = Exec(exiting_child, 0, NULL))!=NOPROC);
+	}
+
+	/* Wait until the zombies have exited */
+	for(int i=0; i<5; i++) {
+		int rounds = 0;
+		while(1) {
+			procinfo_filter f = { .ppid = GetPid(), .alive_only = 1, .pid_min = zombie[i], .pid_max = zombie[i]+1 };
+			Pid_t pid;
+			if(read_procinfo(&f, &pid, 1)==0) break;
+			ASSERT(++rounds < 10000);
+			Mutex mx = MUTEX_INIT;
+			CondVar cv = COND_INIT;
+			Mutex_Lock(&mx);
+			Cond_TimedWait(&mx, &cv, 1);
+			Mutex_Unlock(&mx);
+		}
+	}
+
+	Pid_t pids[20];
+	procinfo_filter all = PROCINFO_ALL;
+	ASSERT(read_procinfo(&all, pids, 20)==12);   /* idle, init and the children */
+	ASSERT(read_procinfo(NULL, pids, 20)==12);
+	for(int i=1; i<12; i++) ASSERT(pids[i-1] < pids[i]);
+
+	procinfo_filter children = { .ppid = GetPid(), .alive_only = 0, .pid_min = 0, .pid_max = MAX_PROC };
+	ASSERT(read_procinfo(&children, pids, 20)==10);
+
+	children.alive_only = 1;
+	ASSERT(read_procinfo(&children, pids, 20)==5);
+	for(int i=0; i<5; i++) ASSERT(pids[i]==alive[i]);
+
+	procinfo_filter range = { .ppid = NOPROC, .alive_only = 0, .pid_min = 1, .pid_max = alive[2] };
+	ASSERT(read_procinfo(&range, pids, 20)==alive[2]-1);
+	ASSERT(pids[0]==1);
+
+	procinfo_filter none = { .ppid = 1234, .alive_only = 0, .pid_min = 0, .pid_max = MAX_PROC };
+	ASSERT(read_procinfo(&none, pids, 20)==0);
+
+	/* Ranges outside the process table are empty */
+	procinfo_filter out = { .ppid = NOPROC, .alive_only = 0, .pid_min = (1<<30)+5, .pid_max = -1 };
+	ASSERT(read_procinfo(&out, pids, 20)==0);
+	out.pid_min = MAX_PROC;
+	out.pid_max = MAX_PROC+100;
+	ASSERT(read_procinfo(&out, pids, 20)==0);
+	out.ppid = GetPid();
+	ASSERT(read_procinfo(&out, pids, 20)==0);
+	procinfo_filter reversed = { .ppid = NOPROC, .alive_only = 0, .pid_min = alive[2], .pid_max = 1 };
+	ASSERT(read_procinfo(&reversed, pids, 20)==0);
+
+	Close(p.read);
+	Close(p.write);
+	while(WaitChild(NOPROC, NULL)!=NOPROC);
+	ASSERT(read_procinfo(&children, pids, 20)==0);
+	return 0;
+}
+
+
+static int noop_thread(int argl, void* args) { return argl; }
+
+static int limit_checking_child(int argl, void* args)
+{
+	ASSERT(SetLimit(LIMIT_THREADS, 0)==argl);
+	ASSERT(SetLimit(LIMIT_FIDS, 0)==argl);
+	return 0;
+}
+
+static procinfo my_procinfo()
+{
+	procinfo_filter f = { .ppid = NOPROC, .alive_only = 0, .pid_min = GetPid(), .pid_max = GetPid()+1 };
+	Fid_t finfo = OpenProcInfo(&f);
+	ASSERT(finfo!=NOFILE);
+	procinfo info;
+	ASSERT(Read(finfo, (char*)&info, sizeof(info))==sizeof(info));
+	ASSERT(Close(finfo)==0);
+	return info;
+}
+
+BOOT_TEST(test_limits_and_usage,
+	"Test process limits, and the resource usage returned in procinfo."
+	)
+{
+	ASSERT(SetLimit(LIMIT_FIDS+1, 1)==-1);
+
+	/* Thread limit */
+	ASSERT(SetLimit(LIMIT_THREADS, 2)==0);
+	Tid_t t = CreateThread(noop_thread, 0, NULL);
+	ASSERT(t!=NOTHREAD);
+	ASSERT(CreateThread(noop_thread, 0, NULL)==NOTHREAD);
+	ASSERT(ThreadJoin(t, NULL)==0);
+	ASSERT((t = CreateThread(noop_thread, 0, NULL))!=NOTHREAD);
+	ASSERT(ThreadJoin(t, NULL)==0);
+
+	/* Fid limit */
+	ASSERT(SetLimit(LIMIT_FIDS, 2)==0);
+	Fid_t f0 = OpenNull(), f1 = OpenNull();
+	ASSERT(f0==0 && f1==1);
+	ASSERT(OpenNull()==NOFILE);
+	ASSERT(Dup2(f0, 2)==-1);
+	ASSERT(Dup2(f0, 1)==0);
+
+	/* Limits are inherited */
+	ASSERT(SetLimit(LIMIT_THREADS, 2)==2);
+	Pid_t cpid = Exec(limit_checking_child, 2, NULL);
+	ASSERT(cpid!=NOPROC);
+	int status;
+	ASSERT(WaitChild(cpid, &status)==cpid && status==0);
+	ASSERT(SetLimit(LIMIT_FIDS, 0)==2);
+
+	/* Usage */
+	char buf[1000];
+	ASSERT(Write(f0, buf, 1000)==1000);
+	ASSERT(Read(f0, buf, 10)==10);
+	pipe_t p;
+	ASSERT(Pipe(&p)==0);
+	ASSERT(Write(p.write, buf, 100)==100);
+	ASSERT(Read(p.read, buf, 1000)==100);
+	Fid_t sock = Socket(NOPORT);
+	Fid_t finfo = OpenSocketInfo();
+	int ninfo = Read(finfo, buf, sizeof(buf));
+	ASSERT(ninfo > 0);
+	ASSERT(Close(finfo)==0);
+	ASSERT(Close(sock)==0);
+	fibo(25);
+
+	procinfo info = my_procinfo();
+	ASSERT(info.max_threads==2 && info.max_fids==0);
+	ASSERT(info.fid_count==5);   /* 0, 1, the pipe and the info stream */
+	ASSERT(info.usage.bytes_written[STREAM_NULL]==1000);
+	ASSERT(info.usage.bytes_read[STREAM_NULL]==10);
+	ASSERT(info.usage.bytes_written[STREAM_PIPE]==100);
+	ASSERT(info.usage.bytes_read[STREAM_PIPE]==100);
+	ASSERT(info.usage.bytes_read[STREAM_INFO] >= (unsigned long)ninfo);
+	ASSERT(info.usage.bytes_read[STREAM_OTHER]==0);
+	ASSERT(info.usage.stack_memory > 0);
+	unsigned long yields = 0;
+	for(int i=0; i<PROCINFO_CAUSES; i++) yields += info.usage.yields[i];
+	ASSERT(yields > 0);
+	return 0;
+}
+
+
+static int high_fid_child(int argl, void* args)
+{
+	char c = 0;
+	ASSERT(SetLimit(LIMIT_FIDS, 0)==20000);
+	ASSERT(Write(argl, &c, 1)==1);
+	ASSERT(Close(20000)==-1);
+	return 0;
+}
+
+BOOT_TEST(test_many_fids,
+	"Test that a process can raise its fid limit and use many file ids."
+	)
+{
+	const int N = 5000;
+	ASSERT(SetLimit(LIMIT_FIDS, MAX_FILEID_LIMIT+1)==-1);
+	ASSERT(OpenNull()==0);
+	for(int i=1; i<MAX_FILEID; i++) ASSERT(OpenNull()==i);
+	ASSERT(OpenNull()==NOFILE);
+
+	ASSERT(SetLimit(LIMIT_FIDS, 20000)==0);
+	for(int i=MAX_FILEID; i<N; i++) ASSERT(OpenNull()==i);
+
+	/* The lowest free fid is reused */
+	ASSERT(Close(4000)==0);
+	ASSERT(Close(100)==0);
+	ASSERT(OpenNull()==100);
+	ASSERT(OpenNull()==4000);
+	ASSERT(OpenNull()==N);
+
+	/* Dup2 beyond the end of the table */
+	ASSERT(Dup2(0, 20000)==-1);
+	ASSERT(Dup2(0, 19999)==0);
+	ASSERT(Close(19999)==0);
+	ASSERT(Dup2(0, 15000)==0);
+
+	/* High fids are inherited */
+	int status;
+	Pid_t cpid = Exec(high_fid_child, 15000, NULL);
+	ASSERT(cpid!=NOPROC);
+	ASSERT(WaitChild(cpid, &status)==cpid && status==0);
+
+	procinfo info = my_procinfo();
+	ASSERT(info.max_fids==20000);
+	ASSERT(info.fid_count==N+3);   /* 0..N, 15000 and the info stream */
+
+	for(int i=0; i<=N; i++) ASSERT(Close(i)==0);
+	ASSERT(OpenNull()==0);
+	return 0;
+}
+
+
+static int pipe_opening_child(int argl, void* args)
+{
+	pipe_t p;
+	ASSERT(Pipe(&p)==-1);
+	ASSERT(Close(0)==0 && Close(1)==0);
+	ASSERT(Pipe(&p)==0);
+	return 0;
+}
+
+BOOT_TEST(test_file_table_grows,
+	"Test that the number of open streams is not bounded by a fixed file table."
+	)
+{
+	ASSERT(SetLimit(LIMIT_FIDS, MAX_FILEID_LIMIT)==0);
+	for(int i=0; i<MAX_FILEID_LIMIT-2; i++) ASSERT(OpenNull()==i);
+	pipe_t p;
+	ASSERT(Pipe(&p)==0);
+	ASSERT(p.read==MAX_FILEID_LIMIT-2 && p.write==MAX_FILEID_LIMIT-1);
+	ASSERT(OpenNull()==NOFILE);
+
+	/* The child needs new streams, beyond the MAX_FILEID_LIMIT of the parent */
+	int status;
+	Pid_t cpid = Exec(pipe_opening_child, 0, NULL);
+	ASSERT(cpid!=NOPROC);
+	ASSERT(WaitChild(cpid, &status)==cpid && status==0);
+
+	for(int i=0; i<MAX_FILEID_LIMIT; i++) ASSERT(Close(i)==0);
+	for(int i=0; i<MAX_FILEID_LIMIT; i++) ASSERT(OpenNull()==i);
+	return 0;
+}
+
+
 static int pid_returning_child(int arg, void* args) {
 	return GetPid();
 }
@@ -553,6 +860,65 @@ BOOT_TEST(test_dup2_error_on_invalid_fid,
 	return 0;
 }
 
+BOOT_TEST(test_setflags_error_on_invalid_fid,
+	"Test that SetFlags and GetFlags fail on invalid fids and illegal flags."
+	)
+{
+	ASSERT(SetFlags(NOFILE, FID_NONBLOCK)==-1);
+	ASSERT(SetFlags(MAX_FILEID, FID_NONBLOCK)==-1);
+	ASSERT(GetFlags(NOFILE)==-1);
+	ASSERT(GetFlags(MAX_FILEID)==-1);
+
+	Fid_t fid = OpenNull();
+	ASSERT(fid!=NOFILE);
+	ASSERT(GetFlags(fid)==0);
+	ASSERT(SetFlags(fid, ~0)==-1);
+	ASSERT(SetFlags(fid, FID_NONBLOCK)==0);
+	ASSERT(GetFlags(fid)==FID_NONBLOCK);
+
+	/* Flags are shared by duplicated file ids */
+	ASSERT(Dup2(fid, fid+1)==0);
+	ASSERT(GetFlags(fid+1)==FID_NONBLOCK);
+	ASSERT(SetFlags(fid+1, 0)==FID_NONBLOCK);
+	ASSERT(GetFlags(fid)==0);
+	return 0;
+}
+
+
+BOOT_TEST(test_eventset_errors,
+	"Test that the event set calls fail on bad arguments."
+	)
+{
+	fid_event ev[4];
+	Fid_t null = OpenNull();
+	ASSERT(null!=NOFILE);
+
+	ASSERT(EventSetCtl(NOFILE, EVENTSET_ADD, null, EVENT_READ)==-1);
+	ASSERT(EventSetCtl(null, EVENTSET_ADD, null, EVENT_READ)==-1);
+	ASSERT(EventSetWait(null, ev, 4, 0)==-1);
+
+	Fid_t eset = OpenEventSet();
+	ASSERT(eset!=NOFILE);
+	ASSERT(EventSetCtl(eset, EVENTSET_ADD, NOFILE, EVENT_READ)==-1);
+	ASSERT(EventSetCtl(eset, EVENTSET_ADD, eset, EVENT_READ)==-1);
+	ASSERT(EventSetCtl(eset, EVENTSET_ADD, null, EVENT_HANGUP<<4)==-1);
+	ASSERT(EventSetCtl(eset, EVENTSET_MOD, null, EVENT_READ)==-1);
+	ASSERT(EventSetCtl(eset, EVENTSET_DEL, null, 0)==-1);
+	ASSERT(EventSetWait(eset, ev, 0, 0)==-1);
+	ASSERT(EventSetWait(eset, NULL, 4, 0)==-1);
+
+	/* Streams that never block are always ready */
+	ASSERT(EventSetCtl(eset, EVENTSET_ADD, null, EVENT_READ|EVENT_WRITE)==0);
+	ASSERT(EventSetCtl(eset, EVENTSET_ADD, null, EVENT_READ)==-1);
+	ASSERT(EventSetWait(eset, ev, 4, 0)==1);
+	ASSERT(ev[0].fid==null && ev[0].events==(EVENT_READ|EVENT_WRITE));
+	ASSERT(EventSetCtl(eset, EVENTSET_DEL, null, 0)==0);
+	ASSERT(EventSetWait(eset, ev, 4, 0)==0);
+
+	ASSERT(Close(eset)==0);
+	return 0;
+}
+
 
 BOOT_TEST(test_open_terminals,
 	"Test that every legal terminal can be opened."
@@ -662,6 +1028,34 @@ BOOT_TEST(test_read_kbd_big,
 }
 
 
+BOOT_TEST(test_eventset_terminal,
+	"Test that EventSetWait wakes up on keyboard input, which is signalled by interrupts.",
+	.minimum_terminals = 1, .timeout = 20
+	)
+{
+	Fid_t fterm = OpenTerminal(0);
+	ASSERT(fterm!=NOFILE);
+	Fid_t eset = OpenEventSet();
+	ASSERT(eset!=NOFILE);
+	ASSERT(EventSetCtl(eset, EVENTSET_ADD, fterm, EVENT_READ)==0);
+
+	fid_event ev;
+	for(int i=0; i<200; i++) {
+		sendme(0, "ab");
+		ASSERT(EventSetWait(eset, &ev, 1, TIMEOUT_INFINITE)==1);
+		ASSERT(ev.fid==fterm && (ev.events & EVENT_READ));
+		char buf[2];
+		for(int n=0; n<2; ) {
+			int rc = Read(fterm, buf+n, 2-n);
+			ASSERT(rc>0);
+			n += rc;
+		}
+		ASSERT(buf[0]=='a' && buf[1]=='b');
+	}
+	return 0;
+}
+
+
 BOOT_TEST(test_dup2_copies_file,
 	"This test copies that Dup2 copies the file to another file descriptor.",
 	.minimum_terminals = 1
@@ -760,6 +1154,93 @@ BOOT_TEST(test_child_inherits_files,
 
 
 
+/* 
+	A child which checks its file ids. The argument is an array of
+	MAX_FILEID flags, telling which file ids should be open.
+ */
+static int check_fids_child(int argl, void* args)
+{
+	ASSERT(argl == MAX_FILEID*sizeof(int));
+	int* expected = args;
+	for(Fid_t fid=0; fid<MAX_FILEID; fid++)
+		ASSERT((GetFlags(fid) != -1) == expected[fid]);
+	return 0;
+}
+
+static void check_child_fids(Pid_t cpid)
+{
+	int status;
+	ASSERT(cpid != NOPROC);
+	ASSERT(WaitChild(cpid, &status)==cpid);
+	ASSERT(status==0);
+}
+
+BOOT_TEST(test_close_on_exec,
+	"Test that file ids marked close-on-exec are not inherited by Exec."
+	)
+{
+	int expected[MAX_FILEID] = { 0 };
+
+	ASSERT(SetCloseOnExec(NOFILE, 1)==-1);
+	ASSERT(SetCloseOnExec(MAX_FILEID, 1)==-1);
+	ASSERT(SetCloseOnExec(0, 1)==-1);
+
+	Fid_t f1 = OpenNull();
+	Fid_t f2 = OpenNull();
+	ASSERT(f1!=NOFILE && f2!=NOFILE);
+
+	ASSERT(SetCloseOnExec(f1, 1)==0);
+	ASSERT(SetCloseOnExec(f1, 1)==1);
+	expected[f2] = 1;
+	check_child_fids(Exec(check_fids_child, sizeof(expected), expected));
+
+	/* Dup2 clears the mark of newfd */
+	ASSERT(Dup2(f2, f1)==0);
+	expected[f1] = 1;
+	check_child_fids(Exec(check_fids_child, sizeof(expected), expected));
+
+	/* Close clears the mark */
+	ASSERT(SetCloseOnExec(f1, 1)==0);
+	ASSERT(Close(f1)==0);
+	Fid_t f3 = OpenNull();
+	ASSERT(f3==f1);
+	ASSERT(SetCloseOnExec(f3, 0)==0);
+	return 0;
+}
+
+
+BOOT_TEST(test_spawn_maps_fids,
+	"Test that Spawn passes exactly the mapped file ids to the child."
+	)
+{
+	int expected[MAX_FILEID] = { 0 };
+
+	Fid_t f1 = OpenNull();
+	Fid_t f2 = OpenNull();
+	ASSERT(f1!=NOFILE && f2!=NOFILE);
+
+	/* No mappings: no file ids */
+	check_child_fids(Spawn(check_fids_child, sizeof(expected), expected, NULL, 0));
+
+	/* The same stream can be mapped many times, and close-on-exec does not matter */
+	ASSERT(SetCloseOnExec(f2, 1)==0);
+	fid_map map[3] = { {f1, MAX_FILEID-1}, {f2, 0}, {f2, 1} };
+	expected[MAX_FILEID-1] = expected[0] = expected[1] = 1;
+	check_child_fids(Spawn(check_fids_child, sizeof(expected), expected, map, 3));
+
+	/* Errors */
+	fid_map dup[2] = { {f1, 3}, {f2, 3} };
+	ASSERT(Spawn(check_fids_child, sizeof(expected), expected, dup, 2)==NOPROC);
+	fid_map bad_parent[1] = { {MAX_FILEID-2, 3} };
+	ASSERT(Spawn(check_fids_child, sizeof(expected), expected, bad_parent, 1)==NOPROC);
+	fid_map bad_child[1] = { {f1, MAX_FILEID} };
+	ASSERT(Spawn(check_fids_child, sizeof(expected), expected, bad_child, 1)==NOPROC);
+	ASSERT(Spawn(check_fids_child, sizeof(expected), expected, NULL, 1)==NOPROC);
+	ASSERT(WaitChild(NOPROC, NULL)==NOPROC);
+	return 0;
+}
+
+
 BOOT_TEST(test_null_device,
 	"Test the null device."
 	)
@@ -913,9 +1394,16 @@ TEST_SUITE(basic_tests,
 	&test_waitchild_error_on_invalid_pid,
 	&test_exec_getpid_wait,
 	&test_exec_copies_arguments,
+	&test_close_on_exec,
+	&test_spawn_maps_fids,
 	&test_exit_returns_status,
 	&test_main_return_returns_status,
 	&test_wait_for_any_child,
+	&test_waitchild_by_many_threads,
+	&test_proc_info_filter,
+	&test_limits_and_usage,
+	&test_many_fids,
+	&test_file_table_grows,
 	&test_orphans_adopted_by_init,
 	&test_cond_timedwait_timeout,
 	&test_cond_timedwait_signal,
@@ -925,12 +1413,15 @@ TEST_SUITE(basic_tests,
 	&test_open_terminals,
 	&test_dup2_error_on_nonfile,
 	&test_dup2_error_on_invalid_fid,
+	&test_setflags_error_on_invalid_fid,
+	&test_eventset_errors,
 	&test_dup2_copies_file,
 	&test_close_error_on_invalid_fid,
 	&test_close_success_on_valid_nonfile_fid,
 	&test_close_terminals,
 	&test_read_kbd,
 	&test_read_kbd_big,
+	&test_eventset_terminal,
 	&test_read_error_on_bad_fid,
 	&test_read_from_many_terminals,
 	&test_write_con,
@@ -1398,158 +1889,1052 @@ BOOT_TEST(test_cyclic_joins,
 }
 
 
-TEST_SUITE(thread_tests, 
-	"A suite of tests for threads."
+static int return_argl(int argl, void* args) { return argl; }
+
+BOOT_TEST(test_stale_tid_gives_error,
+	"Test that the Tid of a joined or detached thread is not confused with a newer thread's"
 	)
 {
-	&test_join_illegal_tid_gives_error,
-	&test_detach_illegal_tid_gives_error,
-	&test_detach_self,
-	&test_detach_other,
-	&test_multiple_detach,
-	&test_join_main_thread,
-	&test_detach_main_thread,
-	&test_detach_after_join,
-	&test_create_join_thread,
-	&test_join_many_threads,
-	&test_exit_many_threads,
-	&test_main_exit_cleanup,
-	&test_noexit_cleanup,
-	&test_cyclic_joins,
-	NULL
-};
+	/* Join the thread, its Tid becomes stale */
+	Tid_t t1 = CreateThread(return_argl, 1, NULL);
+	ASSERT(ThreadJoin(t1, NULL)==0);
+	ASSERT(ThreadJoin(t1, NULL)==-1);
+	ASSERT(ThreadDetach(t1)==-1);
+
+	/* A new thread may reuse the resources, but not the Tid */
+	Tid_t t2 = CreateThread(return_argl, 2, NULL);
+	ASSERT(t2 != t1);
+	ASSERT(ThreadJoin(t1, NULL)==-1);
+	int exitval;
+	ASSERT(ThreadJoin(t2, &exitval)==0);
+	ASSERT(exitval==2);
 
+	/* A detached thread that has exited is gone */
+	Tid_t t3 = CreateThread(return_argl, 3, NULL);
+	ASSERT(ThreadDetach(t3)==0);
+	sleep_thread(1);
+	ASSERT(ThreadJoin(t3, NULL)==-1);
+	ASSERT(ThreadDetach(t3)==-1);
 
+	/* Many threads, joined in order */
+	const int N = 2000;
+	Tid_t tids[N];
+	for(int i=0; i<N; i++)
+		ASSERT((tids[i] = CreateThread(return_argl, i, NULL)) != NOTHREAD);
+	for(int i=0; i<N; i++) {
+		ASSERT(ThreadJoin(tids[i], &exitval)==0);
+		ASSERT(exitval==i);
+	}
+	for(int i=0; i<N; i++)
+		ASSERT(ThreadJoin(tids[i], NULL)==-1);
+	return 0;
+}
 
 
+static int futex_waiter(int argl, void* args)
+{
+	return FutexWait((int*)args, 0, TIMEOUT_INFINITE);
+}
 
+static int busy_then_read(int argl, void* args)
+{
+	char c;
+	fibo(30);
+	ASSERT(Read(argl, &c, 1)==0);
+	return 0;
+}
 
+static int read_threadinfo(Pid_t pid, threadinfo* tinfo, int max)
+{
+	Fid_t finfo = OpenThreadInfo(pid);
+	ASSERT(finfo!=NOFILE);
+	int n = 0, rc;
+	while((rc = Read(finfo, (char*)(tinfo+n), sizeof(threadinfo))) > 0) {
+		ASSERT(rc == sizeof(threadinfo));
+		ASSERT(++n <= max);
+	}
+	ASSERT(Close(finfo)==0);
+	return n;
+}
 
-/*********************************************
- *
- *
- *
- *  Pipe tests
- *
- *
- *
- *********************************************/
+BOOT_TEST(test_thread_info,
+	"Test the thread information stream."
+	)
+{
+	ASSERT(OpenThreadInfo(MAX_PROC-1)==NOFILE);
+
+	pipe_t p;
+	ASSERT(Pipe(&p)==0);
+	Tid_t busy = CreateThread(busy_then_read, p.read, NULL);
+	Tid_t done = CreateThread(return_argl, 1, NULL);
+	ASSERT(busy!=NOTHREAD && done!=NOTHREAD);
+
+	/* Wait for both threads to block or exit */
+	threadinfo tinfo[4];
+	int n;
+	for(int rounds=0; ; rounds++) {
+		ASSERT(rounds < 10000);
+		n = read_threadinfo(NOPROC, tinfo, 4);
+		ASSERT(n==3);
+		/* The slice of a thread going to sleep ends a little after it is STOPPED */
+		if(tinfo[1].state==THREADINFO_STOPPED && tinfo[1].causes[0]==THREADINFO_PIPE
+			&& tinfo[2].state==THREADINFO_EXITED) 
+			break;
+		sleep_thread(0);
+	}
 
+	ASSERT(tinfo[0].tid==ThreadSelf());
+	ASSERT(tinfo[0].pid==GetPid());
+	ASSERT(tinfo[0].state==THREADINFO_RUNNING);
 
+	ASSERT(tinfo[1].tid==busy);
+	ASSERT(tinfo[1].slices > 0);
+	ASSERT(tinfo[1].cpu_time > 0);
+	ASSERT(tinfo[1].priority >= 0);
 
-BOOT_TEST(test_pipe_open,
-	"Open a pipe and put just a little data in it"
-	)
-{
-	pipe_t pipe;
-	ASSERT(Pipe(&pipe)==0);	
-	int rc;
+	ASSERT(tinfo[2].tid==done);
 
-	for(int i=0;i<3;i++) {
-		ASSERT((rc=Write(pipe.write, "Hello world", 12))==12);
-	}
-	char buffer[12] = { [0] = 0 };
-	for(int i=0;i<3;i++) {
-		ASSERT((rc=Read(pipe.read, buffer, 12))==12);
-		ASSERT(strcmp(buffer, "Hello world")==0);
-	}
+	ASSERT(read_threadinfo(GetPid(), tinfo, 4)==3);
+
+	Close(p.write);
+	ASSERT(ThreadJoin(busy, NULL)==0);
+	ASSERT(ThreadJoin(done, NULL)==0);
+	ASSERT(read_threadinfo(NOPROC, tinfo, 4)==1);
 	return 0;
 }
 
 
-BOOT_TEST(test_pipe_fails_on_exhausted_fid,
-	"Test that Pipe will fail if the fids are exhausted."
+BOOT_TEST(test_futex_wait_wake,
+	"Test that FutexWait sleeps only on the expected value, until FutexWake."
 	)
 {
-	pipe_t pipe;
-	for(uint i=0; i< (MAX_FILEID/2); i++ )
-		ASSERT(Pipe(&pipe)==0);
-	for(uint i=0; i< (MAX_FILEID/2); i++ )
-		ASSERT(Pipe(&pipe)==-1);	
+	int futex = 0;
+	ASSERT(FutexWait(NULL, 0, 10)==-1);
+	ASSERT(FutexWait((int*)((char*)&futex+1), 0, 10)==-1);
+	ASSERT(FutexWake(NULL, 1)==-1);
+
+	/* The value is checked, and the timeout expires */
+	ASSERT(FutexWait(&futex, 1, TIMEOUT_INFINITE)==0);
+	ASSERT(FutexWait(&futex, 0, 10)==0);
+	ASSERT(FutexWake(&futex, 1)==0);
+
+	Tid_t t[3];
+	for(int i=0; i<3; i++)
+		t[i] = CreateThread(futex_waiter, 0, &futex);
+	sleep_thread(1);
+
+	ASSERT(FutexWake(&futex, 1)==1);
+	ASSERT(FutexWake(&futex, 5)==2);
+	for(int i=0; i<3; i++) {
+		int exitval;
+		ASSERT(ThreadJoin(t[i], &exitval)==0);
+		ASSERT(exitval==1);
+	}
 	return 0;
 }
 
 
+struct futex_sync {
+	fmutex mx;
+	fcond cv;
+	semaphore items, slots;
+	barrier bar;
+	int counter, ready, produced, buffer[4];
+};
 
-BOOT_TEST(test_pipe_close_reader,
-	"Open a pipe and put just a little data in it"
-	)
+#define FUTEX_SYNC_THREADS 4
+#define FUTEX_SYNC_ROUNDS 1000
+
+static int futex_sync_thread(int argl, void* args)
 {
-	pipe_t pipe;
-	ASSERT(Pipe(&pipe)==0);	
-	int rc;
+	struct futex_sync* S = args;
 
-	for(int i=0;i<3;i++) {
-		ASSERT((rc=Write(pipe.write, "Hello world", 12))==12);
+	/* Mutual exclusion */
+	for(int i=0; i<FUTEX_SYNC_ROUNDS; i++) {
+		FMutex_Lock(&S->mx);
+		S->counter++;
+		FMutex_Unlock(&S->mx);
 	}
-	Close(pipe.read);
-	for(int i=0;i<3;i++) {
-		ASSERT((rc=Write(pipe.write, "Hello world", 12))==-1);
+	BarrierSync(&S->bar, FUTEX_SYNC_THREADS);
+	ASSERT(S->counter == FUTEX_SYNC_THREADS*FUTEX_SYNC_ROUNDS);
+	BarrierSync(&S->bar, FUTEX_SYNC_THREADS);
+
+	/* Wait for the go signal */
+	FMutex_Lock(&S->mx);
+	S->ready++;
+	FCond_Broadcast(&S->cv);
+	while(S->ready < FUTEX_SYNC_THREADS+1)
+		FCond_Wait(&S->mx, &S->cv);
+	FMutex_Unlock(&S->mx);
+
+	/* Produce into a bounded buffer */
+	for(int i=0; i<FUTEX_SYNC_ROUNDS; i++) {
+		Sem_Down(&S->slots);
+		FMutex_Lock(&S->mx);
+		S->buffer[S->produced++ % 4] = 1;
+		FMutex_Unlock(&S->mx);
+		Sem_Up(&S->items);
 	}
 	return 0;
 }
 
-BOOT_TEST(test_pipe_close_writer,
-	"Open a pipe and put just a little data in it"
+BOOT_TEST(test_futex_sync_objects,
+	"Test the mutexes, condition variables, semaphores and barriers built on futexes."
 	)
 {
-	pipe_t pipe;
-	ASSERT(Pipe(&pipe)==0);	
-	int rc;
+	struct futex_sync S = {
+		.mx = FMUTEX_INIT, .cv = FCOND_INIT, 
+		.items = SEMAPHORE_INIT(0), .slots = SEMAPHORE_INIT(4),
+		.bar = BARRIER_INIT, .counter = 0, .ready = 0, .produced = 0
+	};
 
-	for(int i=0;i<3;i++) {
-		ASSERT((rc=Write(pipe.write, "Hello world", 12))==12);
+	ASSERT(FMutex_TryLock(&S.mx)==1);
+	ASSERT(FMutex_TryLock(&S.mx)==0);
+	FMutex_Unlock(&S.mx);
+	ASSERT(Sem_TryDown(&S.items)==0);
+	FCond_Signal(&S.cv);
+
+	Tid_t t[FUTEX_SYNC_THREADS];
+	for(int i=0; i<FUTEX_SYNC_THREADS; i++)
+		t[i] = CreateThread(futex_sync_thread, 0, &S);
+
+	/* Let the producers go */
+	FMutex_Lock(&S.mx);
+	while(S.ready < FUTEX_SYNC_THREADS)
+		FCond_Wait(&S.mx, &S.cv);
+	S.ready++;
+	FCond_Broadcast(&S.cv);
+	FMutex_Unlock(&S.mx);
+
+	/* Consume everything */
+	for(int i=0; i<FUTEX_SYNC_THREADS*FUTEX_SYNC_ROUNDS; i++) {
+		Sem_Down(&S.items);
+		Sem_Up(&S.slots);
 	}
+	ASSERT(Sem_TryDown(&S.items)==0);
 
-	char buffer[12] = { [0] = 0 };
-	for(int i=0;i<3;i++) {
-		ASSERT((rc=Read(pipe.read, buffer, 12))==12);
-		ASSERT(strcmp(buffer, "Hello world")==0);
-	}
-	Close(pipe.write);
-	for(int i=0;i<3;i++) {
-		ASSERT((rc=Read(pipe.read, buffer, 12))==0);
-	}
+	for(int i=0; i<FUTEX_SYNC_THREADS; i++)
+		ASSERT(ThreadJoin(t[i], NULL)==0);
+	ASSERT(S.produced == FUTEX_SYNC_THREADS*FUTEX_SYNC_ROUNDS);
 	return 0;
 }
 
 
-/* Takes one integer argument, writes that many bytes to stdout.
- */
-int data_producer(int argl, void* args)
-{
-	assert(argl == sizeof(int));
-	int nbytes = *(int*)args;
-
-	Close(0);
+struct brlock_table {
+	brlock lock;
+	int a, b;           /* always equal, outside of the write lock */
+};
 
-	char buffer[32768];
+#define BRLOCK_ROUNDS 2000
 
-	while(nbytes>0) {
-		unsigned int n = (nbytes<32768) ? nbytes : 32768;
-		int rc = Write(1, buffer, n);
-		assert(rc>0);
-		nbytes -= rc;
+static int brlock_user(int argl, void* args)
+{
+	struct brlock_table* T = args;
+	for(int i=0; i<BRLOCK_ROUNDS; i++) {
+		if(argl && i%10==0) {
+			BRLock_WriteLock(&T->lock);
+			T->a++;
+			for(volatile int k=0; k<1000; k++);
+			T->b++;
+			BRLock_WriteUnlock(&T->lock);
+		} else {
+			int slot = BRLock_ReadLock(&T->lock);
+			ASSERT(T->a == T->b);
+			BRLock_ReadUnlock(&T->lock, slot);
+		}
 	}
-	Close(1);
 	return 0;
 }
 
-/* Takes one integer argument. Reads its standard input to exhaustion,
-   asserts it read that many bytes. */
-int data_consumer(int argl, void* args) 
+BOOT_TEST(test_brlock,
+	"Test that a big-reader lock excludes writers from readers and each other."
+	)
 {
-	assert(argl == sizeof(int));
-	int nbytes = *(int*)args;
-	Close(1);
+	struct brlock_table T = { .lock = BRLOCK_INIT, .a = 0, .b = 0 };
+	Tid_t t[6];
+	for(int i=0; i<6; i++)
+		t[i] = CreateThread(brlock_user, i%2, &T);
+	for(int i=0; i<6; i++)
+		ASSERT(ThreadJoin(t[i], NULL)==0);
+	ASSERT(T.a == 3*BRLOCK_ROUNDS/10);
+	ASSERT(T.b == T.a);
+	return 0;
+}
 
-	char buffer[16384];
-	int count = 0;
 
-	int rc = 1;
-	while(rc) {
-		rc = Read(0, buffer, 16384);
-		assert(rc>=0);
+BARE_TEST(test_brlock_read_scaling,
+	"Report the read-side throughput of a big-reader lock and a mutex, as cores are added.",
+	.timeout = 120
+	)
+{
+	static brlock B;
+	static fmutex M;
+	static int use_brlock;
+	double Trun;
+	const int R = 1000000;
+
+	int reader(int argl, void* args)
+	{
+		for(int i=0; i<R; i++) {
+			if(use_brlock) {
+				int slot = BRLock_ReadLock(&B);
+				BRLock_ReadUnlock(&B, slot);
+			} else {
+				FMutex_Lock(&M);
+				FMutex_Unlock(&M);
+			}
+		}
+		return 0;
+	}
+
+	int run_readers(int argl, void* args)
+	{
+		Tid_t t[MAX_CORES];
+		struct timespec t1, t2;
+		clock_gettime(CLOCK_REALTIME, &t1);
+		for(int i=0; i<argl; i++)
+			t[i] = CreateThread(reader, 0, NULL);
+		for(int i=0; i<argl; i++)
+			ThreadJoin(t[i], NULL);
+		clock_gettime(CLOCK_REALTIME, &t2);
+		Trun = (tspec2msec(t2)-tspec2msec(t1) + 1) / 1000.0;
+		return 0;
+	}
+
+	/* One reader thread per core */
+	long host = sysconf(_SC_NPROCESSORS_ONLN);
+	for(int ncores=1; ncores<=MAX_CORES; ncores*=2) {
+		double rate[2];
+		for(use_brlock=0; use_brlock<2; use_brlock++) {
+			B = BRLOCK_INIT;
+			M = FMUTEX_INIT;
+			boot(ncores, 0, run_readers, ncores, NULL);
+			rate[use_brlock] = ncores*R / Trun;
+		}
+		MSG("cores=%2d  brlock: %10.0f reads/sec   mutex: %10.0f reads/sec\n",
+			ncores, rate[1], rate[0]);
+		if(ncores >= host) break;
+	}
+}
+
+
+BARE_TEST(test_broadcast_wakeup_latency,
+	"Report the latency of waking up many threads joined to the same thread.",
+	.timeout = 60
+	)
+{
+	enum { N = 1000 };
+	static int ready;
+	static double t_exit;
+	static double latency[N];
+
+	double usec_now() {
+		struct timespec t;
+		clock_gettime(CLOCK_REALTIME, &t);
+		return t.tv_sec*1E6 + t.tv_nsec/1E3;
+	}
+
+	int target(int argl, void* args)
+	{
+		/* Wait for all joiners to block */
+		while(__atomic_load_n(&ready, __ATOMIC_SEQ_CST) < N)
+			FutexWait(&ready, __atomic_load_n(&ready, __ATOMIC_SEQ_CST), 10);
+		int dummy = 0;
+		FutexWait(&dummy, 0, 100);
+		t_exit = usec_now();
+		return 42;
+	}
+
+	int joiner(int argl, void* args)
+	{
+		Tid_t t = (Tid_t) args;
+		int exitval;
+		__atomic_fetch_add(&ready, 1, __ATOMIC_SEQ_CST);
+		ASSERT(ThreadJoin(t, &exitval)==0);
+		latency[argl] = usec_now() - t_exit;
+		ASSERT(exitval==42);
+		return 0;
+	}
+
+	int boot_joiners(int argl, void* args)
+	{
+		Tid_t joiners[N];
+		ready = 0;
+		Tid_t t = CreateThread(target, 0, NULL);
+		for(int i=0; i<N; i++)
+			joiners[i] = CreateThread(joiner, i, (void*)t);
+		for(int i=0; i<N; i++)
+			ASSERT(ThreadJoin(joiners[i], NULL)==0);
+		return 0;
+	}
+
+	long host = sysconf(_SC_NPROCESSORS_ONLN);
+	for(int ncores=1; ncores<=4; ncores*=2) {
+		boot(ncores, 0, boot_joiners, 0, NULL);
+		double sum = 0.0, max = 0.0;
+		for(int i=0; i<N; i++) {
+			sum += latency[i];
+			if(latency[i] > max) max = latency[i];
+		}
+		MSG("cores=%d  %d joiners: mean wakeup latency %8.1f usec, max %8.1f usec\n",
+			ncores, N, sum/N, max);
+		if(ncores >= host) break;
+	}
+}
+
+
+static int pool_square(int argl, void* args)
+{
+	if(args) __atomic_fetch_add((int*)args, 1, __ATOMIC_SEQ_CST);
+	return argl*argl;
+}
+
+BOOT_TEST(test_thread_pool,
+	"Test that a thread pool runs all submitted tasks, with bounded queues."
+	)
+{
+	ASSERT(ThreadPool_Create(0, 8)==NULL);
+
+	/* Queues much smaller than the number of tasks */
+	threadpool* pool = ThreadPool_Create(3, 2);
+	ASSERT(pool != NULL);
+	ASSERT(ThreadPool_Submit(pool, NULL, 0, NULL, NULL)==-1);
+
+	const int N = 200;
+	future fut[N];
+	for(int i=0; i<N; i++)
+		ASSERT(ThreadPool_Submit(pool, pool_square, i, NULL, &fut[i])==0);
+	for(int i=N-1; i>=0; i--)
+		ASSERT(Future_Wait(&fut[i])==i*i);
+
+	/* Tasks without futures, waited for all together */
+	int count = 0;
+	for(int i=0; i<N; i++)
+		ASSERT(ThreadPool_Submit(pool, pool_square, i, &count, NULL)==0);
+	ThreadPool_Wait(pool);
+	ASSERT(count == N);
+
+	ThreadPool_Destroy(pool);
+	return 0;
+}
+
+
+BARE_TEST(test_thread_pool_throughput,
+	"Report the throughput of short tasks, with a thread per task and with a thread pool.",
+	.timeout = 300
+	)
+{
+	enum { N = 100000, BATCH = 1000, WORKERS = 4 };
+	static double Tthreads, Tpool;
+
+	int run_tasks(int argl, void* args)
+	{
+		struct timespec t1, t2, t3;
+		Tid_t t[BATCH];
+
+		/* One thread per task, joined a batch at a time */
+		clock_gettime(CLOCK_REALTIME, &t1);
+		for(int b=0; b<N; b+=BATCH) {
+			for(int i=0; i<BATCH; i++)
+				t[i] = CreateThread(pool_square, i, NULL);
+			for(int i=0; i<BATCH; i++)
+				ThreadJoin(t[i], NULL);
+		}
+		clock_gettime(CLOCK_REALTIME, &t2);
+
+		threadpool* pool = ThreadPool_Create(WORKERS, 256);
+		for(int i=0; i<N; i++)
+			ThreadPool_Submit(pool, pool_square, i, NULL, NULL);
+		ThreadPool_Wait(pool);
+		clock_gettime(CLOCK_REALTIME, &t3);
+		ThreadPool_Destroy(pool);
+
+		Tthreads = (tspec2msec(t2)-tspec2msec(t1) + 1) / 1000.0;
+		Tpool = (tspec2msec(t3)-tspec2msec(t2) + 1) / 1000.0;
+		return 0;
+	}
+
+	long host = sysconf(_SC_NPROCESSORS_ONLN);
+	for(int ncores=1; ncores<=4; ncores*=2) {
+		boot(ncores, 0, run_tasks, 0, NULL);
+		MSG("cores=%d  %d tasks: thread per task %10.0f tasks/sec   pool %10.0f tasks/sec\n",
+			ncores, N, N/Tthreads, N/Tpool);
+		if(ncores >= host) break;
+	}
+}
+
+
+#define FIBER_PIPE_BYTES 100000
+
+struct fiber_pipe { 
+	pipe_t pipe; 
+	int total; 
+};
+
+static int fiber_counter(int argl, void* args)
+{
+	for(int i=0; i<argl; i++) {
+		__atomic_fetch_add((int*)args, 1, __ATOMIC_SEQ_CST);
+		Fiber_Yield();
+	}
+	return 0;
+}
+
+static int fiber_pipe_writer(int argl, void* args)
+{
+	pipe_t* pipe = & ((struct fiber_pipe*)args)->pipe;
+	char buf[1000];
+	for(int sent=0; sent < FIBER_PIPE_BYTES; sent += sizeof(buf)) {
+		for(int i=0; i<sizeof(buf); i++) buf[i] = (char)(sent+i);
+		int off = 0;
+		while(off < sizeof(buf)) {
+			int rc = Fiber_Write(pipe->write, buf+off, sizeof(buf)-off);
+			ASSERT(rc > 0);
+			off += rc;
+		}
+	}
+	Close(pipe->write);
+	return 0;
+}
+
+static int fiber_pipe_reader(int argl, void* args)
+{
+	struct fiber_pipe* P = args;
+	char buf[700];
+	int total = 0, rc;
+	while((rc = Fiber_Read(P->pipe.read, buf, sizeof(buf))) > 0) {
+		for(int i=0; i<rc; i++)
+			ASSERT(buf[i] == (char)(total+i));
+		total += rc;
+	}
+	ASSERT(rc == 0);
+	ASSERT(total == FIBER_PIPE_BYTES);
+	P->total = total;
+	return 0;
+}
+
+static int fiber_byte_reader(int argl, void* args)
+{
+	char c;
+	ASSERT(Fiber_Read(argl, &c, 1)==1);
+	__atomic_fetch_add((int*)args, c, __ATOMIC_SEQ_CST);
+	return 0;
+}
+
+static int fiber_byte_writer(int argl, void* args)
+{
+	for(int i=0; i<4; i++)
+		ASSERT(Fiber_Write(argl, "\1", 1)==1);
+	return 0;
+}
+
+BOOT_TEST(test_fibers,
+	"Test that fibers run cooperatively on carrier threads, and park on blocking streams."
+	)
+{
+	ASSERT(FiberPool_Create(0)==NULL);
+
+	fiber_pool* pool = FiberPool_Create(2);
+	ASSERT(pool != NULL);
+	ASSERT(FiberPool_Spawn(pool, NULL, 0, NULL)==-1);
+
+	/* Many fibers, switching often */
+	int counter = 0;
+	const int N = 1000, Y = 10;
+	for(int i=0; i<N; i++)
+		ASSERT(FiberPool_Spawn(pool, fiber_counter, Y, &counter)==0);
+
+	/* A reader and a writer on a pipe, much larger than the pipe buffer */
+	struct fiber_pipe P = { .total = 0 };
+	ASSERT(Pipe(&P.pipe)==0);
+	ASSERT(FiberPool_Spawn(pool, fiber_pipe_reader, 0, &P)==0);
+	ASSERT(FiberPool_Spawn(pool, fiber_pipe_writer, 0, &P)==0);
+
+	FiberPool_Join(pool);
+	ASSERT(counter == N*Y);
+	ASSERT(P.total == FIBER_PIPE_BYTES);
+	Close(P.pipe.read);
+
+	/* Many fibers parked on one stream, woken up by a fiber spawned later */
+	pool = FiberPool_Create(1);
+	pipe_t Q;
+	ASSERT(Pipe(&Q)==0);
+	int got = 0;
+	for(int i=0; i<4; i++)
+		ASSERT(FiberPool_Spawn(pool, fiber_byte_reader, Q.read, &got)==0);
+	Mutex mx = MUTEX_INIT;
+	CondVar cv = COND_INIT;
+	Mutex_Lock(&mx);
+	Cond_TimedWait(&mx, &cv, 50);   /* let the readers park */
+	Mutex_Unlock(&mx);
+	ASSERT(FiberPool_Spawn(pool, fiber_byte_writer, Q.write, NULL)==0);
+	FiberPool_Join(pool);
+	ASSERT(got == 4);
+	ASSERT(GetFlags(Q.read)==0 && GetFlags(Q.write)==0);
+	Close(Q.read);
+	Close(Q.write);
+	return 0;
+}
+
+
+TEST_SUITE(thread_tests, 
+	"A suite of tests for threads."
+	)
+{
+	&test_join_illegal_tid_gives_error,
+	&test_detach_illegal_tid_gives_error,
+	&test_detach_self,
+	&test_detach_other,
+	&test_multiple_detach,
+	&test_join_main_thread,
+	&test_detach_main_thread,
+	&test_detach_after_join,
+	&test_create_join_thread,
+	&test_join_many_threads,
+	&test_exit_many_threads,
+	&test_main_exit_cleanup,
+	&test_noexit_cleanup,
+	&test_cyclic_joins,
+	&test_stale_tid_gives_error,
+	&test_thread_info,
+	&test_futex_wait_wake,
+	&test_futex_sync_objects,
+	&test_brlock,
+	&test_brlock_read_scaling,
+	&test_broadcast_wakeup_latency,
+	&test_thread_pool,
+	&test_thread_pool_throughput,
+	&test_fibers,
+	NULL
+};
+
+
+
+
+
+
+
+/*********************************************
+ *
+ *
+ *
+ *  Pipe tests
+ *
+ *
+ *
+ *********************************************/
+
+
+
+BOOT_TEST(test_pipe_open,
+	"Open a pipe and put just a little data in it"
+	)
+{
+	pipe_t pipe;
+	ASSERT(Pipe(&pipe)==0);	
+	int rc;
+
+	for(int i=0;i<3;i++) {
+		ASSERT((rc=Write(pipe.write, "Hello world", 12))==12);
+	}
+	char buffer[12] = { [0] = 0 };
+	for(int i=0;i<3;i++) {
+		ASSERT((rc=Read(pipe.read, buffer, 12))==12);
+		ASSERT(strcmp(buffer, "Hello world")==0);
+	}
+	return 0;
+}
+
+
+BOOT_TEST(test_pipe_fails_on_exhausted_fid,
+	"Test that Pipe will fail if the fids are exhausted."
+	)
+{
+	pipe_t pipe;
+	for(uint i=0; i< (MAX_FILEID/2); i++ )
+		ASSERT(Pipe(&pipe)==0);
+	for(uint i=0; i< (MAX_FILEID/2); i++ )
+		ASSERT(Pipe(&pipe)==-1);	
+	return 0;
+}
+
+
+
+BOOT_TEST(test_pipe_close_reader,
+	"Open a pipe and put just a little data in it"
+	)
+{
+	pipe_t pipe;
+	ASSERT(Pipe(&pipe)==0);	
+	int rc;
+
+	for(int i=0;i<3;i++) {
+		ASSERT((rc=Write(pipe.write, "Hello world", 12))==12);
+	}
+	Close(pipe.read);
+	for(int i=0;i<3;i++) {
+		ASSERT((rc=Write(pipe.write, "Hello world", 12))==-1);
+	}
+	return 0;
+}
+
+BOOT_TEST(test_pipe_close_writer,
+	"Open a pipe and put just a little data in it"
+	)
+{
+	pipe_t pipe;
+	ASSERT(Pipe(&pipe)==0);	
+	int rc;
+
+	for(int i=0;i<3;i++) {
+		ASSERT((rc=Write(pipe.write, "Hello world", 12))==12);
+	}
+
+	char buffer[12] = { [0] = 0 };
+	for(int i=0;i<3;i++) {
+		ASSERT((rc=Read(pipe.read, buffer, 12))==12);
+		ASSERT(strcmp(buffer, "Hello world")==0);
+	}
+	Close(pipe.write);
+	for(int i=0;i<3;i++) {
+		ASSERT((rc=Read(pipe.read, buffer, 12))==0);
+	}
+	return 0;
+}
+
+static int hello_reader(int argl, void* args)
+{
+	char buffer[12] = { [0] = 0 };
+	ASSERT(Read(argl, buffer, 12)==12);
+	ASSERT(strcmp(buffer, "Hello world")==0);
+	return 0;
+}
+
+BOOT_TEST(test_thread_flags,
+	"Test that the stream flags of a thread apply to its operations, but not to the stream."
+	)
+{
+	pipe_t pipe;
+	char c;
+	ASSERT(Pipe(&pipe)==0);
+	ASSERT(SetThreadFlags(1<<5)==-1);
+	ASSERT(SetThreadFlags(FID_NONBLOCK)==0);
+	ASSERT(Read(pipe.read, &c, 1)==WOULDBLOCK);
+	ASSERT(GetFlags(pipe.read)==0);
+	ASSERT(SetThreadFlags(0)==FID_NONBLOCK);
+	ASSERT(Write(pipe.write, "x", 1)==1);
+	ASSERT(Read(pipe.read, &c, 1)==1);
+	return 0;
+}
+
+BOOT_TEST(test_pipe_close_while_reading,
+	"Test that a blocked Read keeps its stream, when its fid is closed and reused."
+	)
+{
+	pipe_t pipe;
+	ASSERT(Pipe(&pipe)==0);
+	Tid_t t = CreateThread(hello_reader, pipe.read, NULL);
+	ASSERT(t!=NOTHREAD);
+
+	/* Wait for the reader to block */
+	threadinfo tinfo[2];
+	for(int rounds=0; ; rounds++) {
+		ASSERT(rounds < 10000);
+		ASSERT(read_threadinfo(NOPROC, tinfo, 2)==2);
+		if(tinfo[1].state==THREADINFO_STOPPED && tinfo[1].causes[0]==THREADINFO_PIPE)
+			break;
+		sleep_thread(0);
+	}
+
+	/* Grow the fid table, and reuse the fid of the reader */
+	ASSERT(SetLimit(LIMIT_FIDS, 1000)==0);
+	for(int i=2; i<1000; i++) ASSERT(OpenNull()==i);
+	ASSERT(Close(pipe.read)==0);
+	ASSERT(OpenNull()==pipe.read);
+
+	ASSERT(Write(pipe.write, "Hello world", 12)==12);
+	ASSERT(ThreadJoin(t, NULL)==0);
+
+	/* The reader held the last reference to the read end */
+	ASSERT(Write(pipe.write, "Hello world", 12)==-1);
+	return 0;
+}
+
+BOOT_TEST(test_pipe_nonblocking,
+	"Test that a non-blocking pipe does not block on empty or full buffers."
+	)
+{
+	pipe_t pipe;
+	ASSERT(Pipe(&pipe)==0);
+	ASSERT(SetFlags(pipe.read, FID_NONBLOCK)==0);
+	ASSERT(SetFlags(pipe.write, FID_NONBLOCK)==0);
+
+	char buffer[1024];
+	ASSERT(Read(pipe.read, buffer, sizeof(buffer))==WOULDBLOCK);
+
+	/* Fill the pipe, the last write must be short */
+	int total = 0, rc;
+	while((rc = Write(pipe.write, buffer, sizeof(buffer))) > 0)
+		total += rc;
+	ASSERT(rc==WOULDBLOCK);
+	ASSERT(total > 0);
+
+	/* Drain the pipe */
+	int drained = 0;
+	while((rc = Read(pipe.read, buffer, sizeof(buffer))) > 0)
+		drained += rc;
+	ASSERT(rc==WOULDBLOCK);
+	ASSERT(drained==total);
+
+	/* EOF is still reported */
+	Close(pipe.write);
+	ASSERT(Read(pipe.read, buffer, sizeof(buffer))==0);
+	return 0;
+}
+
+BOOT_TEST(test_pipe_create_nonblocking,
+	"Test that Pipe2 creates a pipe with the given flags."
+	)
+{
+	pipe_t pipe;
+	char c;
+	ASSERT(Pipe2(&pipe, 1<<5)==-1);
+
+	ASSERT(Pipe2(&pipe, FID_NONBLOCK)==0);
+	ASSERT(GetFlags(pipe.read)==FID_NONBLOCK);
+	ASSERT(GetFlags(pipe.write)==FID_NONBLOCK);
+	ASSERT(Read(pipe.read, &c, 1)==WOULDBLOCK);
+	ASSERT(Write(pipe.write, "x", 1)==1);
+	ASSERT(Read(pipe.read, &c, 1)==1);
+
+	ASSERT(Pipe2(&pipe, 0)==0);
+	ASSERT(GetFlags(pipe.read)==0);
+	ASSERT(GetFlags(pipe.write)==0);
+	return 0;
+}
+
+
+static int eventset_pipe_writer(int argl, void* args)
+{
+	Fid_t wfid = *(Fid_t*)args;
+	ASSERT(Write(wfid, "x", 1)==1);
+	return 0;
+}
+
+BOOT_TEST(test_eventset_pipe,
+	"Test level- and edge-triggered event sets on a pipe."
+	)
+{
+	pipe_t pipe;
+	ASSERT(Pipe(&pipe)==0);
+	Fid_t eset = OpenEventSet();
+	ASSERT(eset!=NOFILE);
+
+	fid_event ev[2];
+	char c;
+
+	/* An empty pipe is writable but not readable */
+	ASSERT(EventSetCtl(eset, EVENTSET_ADD, pipe.read, EVENT_READ)==0);
+	ASSERT(EventSetCtl(eset, EVENTSET_ADD, pipe.write, EVENT_WRITE)==0);
+	ASSERT(EventSetWait(eset, ev, 2, 0)==1);
+	ASSERT(ev[0].fid==pipe.write && ev[0].events==EVENT_WRITE);
+	ASSERT(EventSetCtl(eset, EVENTSET_DEL, pipe.write, 0)==0);
+	ASSERT(EventSetWait(eset, ev, 2, 0)==0);
+
+	/* Wait for data from another process */
+	ASSERT(Exec(eventset_pipe_writer, sizeof(Fid_t), &pipe.write)!=NOPROC);
+	ASSERT(EventSetWait(eset, ev, 2, TIMEOUT_INFINITE)==1);
+	ASSERT(ev[0].fid==pipe.read && ev[0].events==EVENT_READ);
+	WaitChild(NOPROC, NULL);
+
+	/* Level-triggered: reported until the data is consumed */
+	ASSERT(EventSetWait(eset, ev, 2, 0)==1);
+	ASSERT(Read(pipe.read, &c, 1)==1);
+	ASSERT(EventSetWait(eset, ev, 2, 10)==0);
+
+	/* Edge-triggered: reported once per write */
+	ASSERT(EventSetCtl(eset, EVENTSET_MOD, pipe.read, EVENT_READ|EVENT_EDGE)==0);
+	ASSERT(Write(pipe.write, "x", 1)==1);
+	ASSERT(EventSetWait(eset, ev, 2, 0)==1);
+	ASSERT(EventSetWait(eset, ev, 2, 0)==0);
+	ASSERT(Write(pipe.write, "x", 1)==1);
+	ASSERT(EventSetWait(eset, ev, 2, 0)==1);
+
+	/* Closing the writer hangs up the reader */
+	ASSERT(Close(pipe.write)==0);
+	ASSERT(EventSetWait(eset, ev, 2, 0)==1);
+	ASSERT(ev[0].events==(EVENT_READ|EVENT_HANGUP));
+
+	/* Closing the reader removes it from the event set */
+	ASSERT(Close(pipe.read)==0);
+	ASSERT(EventSetWait(eset, ev, 2, 0)==0);
+	ASSERT(Close(eset)==0);
+	return 0;
+}
+
+
+/* Add a request to the submission queue of an aio ring */
+static void aio_push(aio_ring* ring, aio_sqe sqe)
+{
+	ring->sq[ring->sq_tail & (ring->entries-1)] = sqe;
+	__atomic_store_n(&ring->sq_tail, ring->sq_tail+1, __ATOMIC_RELEASE);
+}
+
+/* Reap up to n completions from an aio ring */
+static unsigned int aio_reap(aio_ring* ring, aio_cqe* cqe, unsigned int n)
+{
+	unsigned int count = 0;
+	unsigned int tail = __atomic_load_n(&ring->cq_tail, __ATOMIC_ACQUIRE);
+	while(ring->cq_head != tail && count < n) {
+		cqe[count++] = ring->cq[ring->cq_head & (ring->entries-1)];
+		__atomic_store_n(&ring->cq_head, ring->cq_head+1, __ATOMIC_RELEASE);
+	}
+	return count;
+}
+
+BOOT_TEST(test_aio_pipe,
+	"Test asynchronous I/O on a pipe, with many requests in flight."
+	)
+{
+	static aio_sqe sq[256];
+	static aio_cqe cq[256];
+	aio_cqe cqe[256];
+	aio_ring ring = { .entries = 100, .sq = sq, .cq = cq };
+
+	ASSERT(AioSubmit(0)==-1);
+	ASSERT(AioSetup(NULL)==-1);
+	ASSERT(AioSetup(&ring)==-1);
+	ring.entries = 256;
+	ASSERT(AioSetup(&ring)==0);
+	ASSERT(AioSetup(&ring)==-1);
+
+	pipe_t pipe;
+	ASSERT(Pipe(&pipe)==0);
+
+	/* All reads would block */
+	char in[200], out[200];
+	for(int i=0; i<200; i++) {
+		out[i] = (char) i;
+		aio_push(&ring, (aio_sqe){ .op=AIO_READ, .fid=pipe.read, .buf=&in[i], .len=1, .data=&in[i] });
+	}
+	ASSERT(AioSubmit(0)==200);
+	ASSERT(aio_reap(&ring, cqe, 256)==0);
+
+	/* Bad requests complete at once */
+	aio_push(&ring, (aio_sqe){ .op=AIO_READ, .fid=NOFILE, .buf=in, .len=1, .data=NULL });
+	ASSERT(AioSubmit(1)==1);
+	ASSERT(aio_reap(&ring, cqe, 256)==1);
+	ASSERT(cqe[0].data==NULL && cqe[0].result==-1);
+
+	/* A single write completes inline and feeds all the reads, in order */
+	aio_push(&ring, (aio_sqe){ .op=AIO_WRITE, .fid=pipe.write, .buf=out, .len=200, .data=out });
+	ASSERT(AioSubmit(201)==1);
+	ASSERT(aio_reap(&ring, cqe, 256)==201);
+	ASSERT(cqe[0].data==out && cqe[0].result==200);
+	for(int i=1; i<=200; i++) {
+		ASSERT(cqe[i].data==&in[i-1] && cqe[i].result==1);
+	}
+	ASSERT(memcmp(in, out, 200)==0);
+
+	/* A request still pending at exit is dropped */
+	aio_push(&ring, (aio_sqe){ .op=AIO_READ, .fid=pipe.read, .buf=in, .len=1, .data=in });
+	ASSERT(AioSubmit(0)==1);
+	return 0;
+}
+
+
+static int aio_exiting_child(int argl, void* args)
+{
+	aio_sqe sq[4];
+	aio_cqe cq[4];
+	aio_ring ring = { .entries = 4, .sq = sq, .cq = cq };
+	char c;
+	ASSERT(AioSetup(&ring)==0);
+	aio_push(&ring, (aio_sqe){ .op=AIO_READ, .fid=argl, .buf=&c, .len=1, .data=NULL });
+	ASSERT(AioSubmit(0)==1);
+	return 0;
+}
+
+static int stack_reporting_child(int argl, void* args)
+{
+	procinfo info = my_procinfo();
+	ASSERT(Write(argl, (char*)&info.usage.stack_memory, sizeof(info.usage.stack_memory))
+		== sizeof(info.usage.stack_memory));
+	return 0;
+}
+
+static unsigned long child_stack_memory(Fid_t wfid, Fid_t rfid)
+{
+	unsigned long mem;
+	Pid_t pid = Exec(stack_reporting_child, wfid, NULL);
+	ASSERT(pid!=NOPROC);
+	ASSERT(WaitChild(pid, NULL)==pid);
+	ASSERT(Read(rfid, (char*)&mem, sizeof(mem))==sizeof(mem));
+	return mem;
+}
+
+BOOT_TEST(test_aio_exit,
+	"Test that the asynchronous I/O worker is gone when its process is reaped."
+	)
+{
+	pipe_t p, r;
+	ASSERT(Pipe(&p)==0);
+	ASSERT(Pipe(&r)==0);
+	unsigned long mem = child_stack_memory(r.write, r.read);
+
+	for(int i=0; i<50; i++) {
+		Pid_t pid = Exec(aio_exiting_child, p.read, NULL);
+		ASSERT(pid!=NOPROC);
+		ASSERT(WaitChild(pid, NULL)==pid);
+
+		/* The PCB of the child is reused */
+		ASSERT(child_stack_memory(r.write, r.read)==mem);
+	}
+
+	/* The pending reads were dropped */
+	char c;
+	ASSERT(Write(p.write, "x", 1)==1);
+	ASSERT(Read(p.read, &c, 1)==1 && c=='x');
+	return 0;
+}
+
+
+/* Takes one integer argument, writes that many bytes to stdout.
+ */
+int data_producer(int argl, void* args)
+{
+	assert(argl == sizeof(int));
+	int nbytes = *(int*)args;
+
+	Close(0);
+
+	char buffer[32768];
+
+	while(nbytes>0) {
+		unsigned int n = (nbytes<32768) ? nbytes : 32768;
+		int rc = Write(1, buffer, n);
+		assert(rc>0);
+		nbytes -= rc;
+	}
+	Close(1);
+	return 0;
+}
+
+/* Takes one integer argument. Reads its standard input to exhaustion,
+   asserts it read that many bytes. */
+int data_consumer(int argl, void* args) 
+{
+	assert(argl == sizeof(int));
+	int nbytes = *(int*)args;
+	Close(1);
+
+	char buffer[16384];
+	int count = 0;
+
+	int rc = 1;
+	while(rc) {
+		rc = Read(0, buffer, 16384);
+		assert(rc>=0);
 		count += rc;
 	}
 	ASSERT(count == nbytes);
@@ -1641,6 +3026,13 @@ TEST_SUITE(pipe_tests,
 	&test_pipe_fails_on_exhausted_fid,
 	&test_pipe_close_reader,
 	&test_pipe_close_writer,
+	&test_pipe_close_while_reading,
+	&test_pipe_nonblocking,
+	&test_pipe_create_nonblocking,
+	&test_thread_flags,
+	&test_eventset_pipe,
+	&test_aio_pipe,
+	&test_aio_exit,
 	&test_pipe_single_producer,
 	&test_pipe_multi_producer,
 	NULL
@@ -1730,8 +3122,11 @@ BOOT_TEST(test_socket_constructor_illegal_port,
 	ASSERT(Socket(MAX_PORT)!=NOFILE);
 
 	ASSERT(Socket(NOPORT-1)==NOFILE);
-	ASSERT(Socket(MAX_PORT+1)==NOFILE);	
-	ASSERT(Socket(MAX_PORT+10)==NOFILE);
+	ASSERT(Socket(-10)==NOFILE);
+
+	/* Out of range values must not wrap around to a legal port */
+	ASSERT(Socket(MAX_PORT+1)==NOFILE);
+	ASSERT(Socket(65536+100)==NOFILE);
 	return 0;	
 }
 
@@ -1774,6 +3169,42 @@ BOOT_TEST(test_listen_fails_on_occupied_port,
 	return 0;
 }
 
+BOOT_TEST(test_listen_reuseport,
+	"Test that listeners with SOCKOPT_REUSEPORT share a port and its connections"
+	)
+{
+	Fid_t l1 = Socket(MAX_PORT), l2 = Socket(MAX_PORT);
+	ASSERT(SetSocketOption(l1, SOCKOPT_REUSEPORT, 1)==0);
+	ASSERT(SetSocketOption(l2, SOCKOPT_REUSEPORT, 1)==0);
+	ASSERT(Listen(l1)==0);
+	ASSERT(Listen(Socket(MAX_PORT))==-1);
+	ASSERT(Listen(l2)==0);
+	ASSERT(SetFlags(l1, FID_NONBLOCK)==0);
+	ASSERT(SetFlags(l2, FID_NONBLOCK)==0);
+
+	/* Requests are spread over the listeners */
+	Fid_t cli[4], srv[4];
+	for(int i=0; i<4; i++) {
+		cli[i] = Socket(NOPORT);
+		ASSERT(SetFlags(cli[i], FID_NONBLOCK)==0);
+		ASSERT(Connect(cli[i], MAX_PORT, 1000)==WOULDBLOCK);
+	}
+	ASSERT(AcceptMany(l1, srv, 4)==2);
+	ASSERT(AcceptMany(l2, srv+2, 4)==2);
+	for(int i=0; i<4; i++)
+		ASSERT(Connect(cli[i], MAX_PORT, 1000)==0);
+
+	/* The remaining listener serves the port */
+	ASSERT(Close(l1)==0);
+	ASSERT(Close(cli[0])==0);
+	cli[0] = Socket(NOPORT);
+	ASSERT(SetFlags(l2, 0)==FID_NONBLOCK);
+	connect_sockets(cli[0], l2, &srv[0], MAX_PORT);
+	check_transfer(cli[0], srv[0]);
+	return 0;
+}
+
+
 BOOT_TEST(test_listen_fails_on_initialized_socket,
 	"Test that Listen fails on a socket that has been previously initialized by Listen"
 	)
@@ -1932,6 +3363,373 @@ BOOT_TEST(test_accept_unblocks_on_close,
 }
 
 
+BOOT_TEST(test_socket_create_nonblocking,
+	"Test that Socket2 creates a socket with the given flags."
+	)
+{
+	ASSERT(Socket2(100, 1<<5)==NOFILE);
+	ASSERT(Socket2(-1, FID_NONBLOCK)==NOFILE);
+
+	Fid_t lsock = Socket2(100, FID_NONBLOCK);
+	ASSERT(lsock!=NOFILE);
+	ASSERT(GetFlags(lsock)==FID_NONBLOCK);
+	ASSERT(Listen(lsock)==0);
+	ASSERT(Accept(lsock)==WOULDBLOCK);
+
+	Fid_t cli = Socket2(NOPORT, FID_NONBLOCK);
+	ASSERT(cli!=NOFILE);
+	ASSERT(Connect(cli, 100, 1000)==WOULDBLOCK);
+	Fid_t srv = Accept(lsock);
+	ASSERT(srv!=NOFILE);
+	ASSERT(Connect(cli, 100, 1000)==0);
+	ASSERT(GetFlags(srv)==FID_NONBLOCK);
+
+	ASSERT(GetFlags(Socket2(NOPORT, 0))==0);
+	return 0;
+}
+
+BOOT_TEST(test_accept_nonblocking,
+	"Test that a non-blocking Accept returns WOULDBLOCK and its sockets inherit the flags."
+	)
+{
+	Fid_t lsock = Socket(100);
+	ASSERT(Listen(lsock)==0);
+	ASSERT(SetFlags(lsock, FID_NONBLOCK)==0);
+	ASSERT(Accept(lsock)==WOULDBLOCK);
+
+	/* Queue a request without blocking, so that Accept finds it */
+	Fid_t cli = Socket(NOPORT), srv;
+	ASSERT(SetFlags(cli, FID_NONBLOCK)==0);
+	ASSERT(Connect(cli, 100, 1000)==WOULDBLOCK);
+	srv = Accept(lsock);
+	ASSERT(srv!=NOFILE);
+	ASSERT(Connect(cli, 100, 1000)==0);
+	ASSERT(SetFlags(cli, 0)==FID_NONBLOCK);
+	ASSERT(GetFlags(srv)==FID_NONBLOCK);
+
+	char buffer[12];
+	ASSERT(Read(srv, buffer, 12)==WOULDBLOCK);
+	check_transfer(cli, srv);
+	return 0;
+}
+
+
+BOOT_TEST(test_accept_many_with_backlog,
+	"Test that a full backlog refuses connections and AcceptMany admits several."
+	)
+{
+	Fid_t lsock = Socket(100);
+	Fid_t fids[8];
+	ASSERT(SetSocketOption(lsock, SOCKOPT_BACKLOG, -1)==-1);
+	ASSERT(SetSocketOption(lsock, SOCKOPT_BACKLOG, 3)==0);
+	ASSERT(AcceptMany(lsock, fids, 8)==-1);
+	ASSERT(Listen(lsock)==0);
+	ASSERT(AcceptMany(lsock, NULL, 8)==-1);
+	ASSERT(AcceptMany(lsock, fids, 0)==-1);
+
+	Fid_t cli[4];
+	for(int i=0; i<4; i++) {
+		cli[i] = Socket(NOPORT);
+		ASSERT(SetFlags(cli[i], FID_NONBLOCK)==0);
+	}
+	for(int i=0; i<3; i++)
+		ASSERT(Connect(cli[i], 100, 1000)==WOULDBLOCK);
+	ASSERT(Connect(cli[3], 100, 1000)==-1);
+
+	ASSERT(AcceptMany(lsock, fids, 8)==3);
+	for(int i=0; i<3; i++) {
+		ASSERT(Connect(cli[i], 100, 1000)==0);
+		check_transfer(cli[i], fids[i]);
+		check_transfer(fids[i], cli[i]);
+	}
+
+	/* The backlog of a listener can be changed */
+	ASSERT(SetSocketOption(lsock, SOCKOPT_BACKLOG, 1)==0);
+	ASSERT(Connect(cli[3], 100, 1000)==WOULDBLOCK);
+	Fid_t cli4 = Socket(NOPORT);
+	ASSERT(Connect(cli4, 100, 1000)==-1);
+	ASSERT(AcceptMany(lsock, fids, 8)==1);
+	ASSERT(Connect(cli[3], 100, 1000)==0);
+
+	ASSERT(SetFlags(lsock, FID_NONBLOCK)==0);
+	ASSERT(AcceptMany(lsock, fids, 8)==WOULDBLOCK);
+	return 0;
+}
+
+
+/* The reservation of the listener on a port, from the socket information */
+static unsigned int listener_reserved(port_t port)
+{
+	Fid_t finfo = OpenSocketInfo();
+	ASSERT(finfo!=NOFILE);
+	sockinfo info;
+	unsigned int reserved = 0;
+	int found = 0;
+	while(Read(finfo, (char*)&info, sizeof(info))==sizeof(info))
+		if(info.state==SOCKINFO_LISTENER && info.port==port) {
+			reserved = info.reserved;
+			found++;
+		}
+	ASSERT(Close(finfo)==0);
+	ASSERT(found==1);
+	return reserved;
+}
+
+BOOT_TEST(test_listener_reservation,
+	"Test that each listener reserves connections for its own backlog."
+	)
+{
+	Fid_t la = Socket(100), lb = Socket(200);
+	ASSERT(SetSocketOption(la, SOCKOPT_BACKLOG, 4)==0);
+	ASSERT(SetSocketOption(lb, SOCKOPT_BACKLOG, MAX_BACKLOG+1)==-1);
+	ASSERT(SetSocketOption(lb, SOCKOPT_BACKLOG, 100)==0);
+	ASSERT(Listen(la)==0);
+	ASSERT(Listen(lb)==0);
+	ASSERT(listener_reserved(100)==4);
+	ASSERT(listener_reserved(200)==100);
+
+	/* Admissions at A take from the reservation of A only */
+	Fid_t cli[3];
+	for(int i=0; i<3; i++) {
+		cli[i] = Socket(NOPORT);
+		ASSERT(SetFlags(cli[i], FID_NONBLOCK)==0);
+		ASSERT(Connect(cli[i], 100, 1000)==WOULDBLOCK);
+	}
+	for(int i=0; i<3; i++) {
+		Fid_t srv = Accept(la);
+		ASSERT(srv!=NOFILE);
+		ASSERT(Connect(cli[i], 100, 1000)==0);
+		check_transfer(cli[i], srv);
+	}
+	ASSERT(listener_reserved(100)==1);
+	ASSERT(listener_reserved(200)==100);
+
+	/* Other sockets do not use the reservations */
+	Fid_t extra[4];
+	for(int i=0; i<4; i++) ASSERT((extra[i] = Socket(NOPORT))!=NOFILE);
+	ASSERT(listener_reserved(100)==1);
+	ASSERT(listener_reserved(200)==100);
+	for(int i=0; i<4; i++) ASSERT(Close(extra[i])==0);
+
+	/* Changing the backlog resizes the reservation */
+	ASSERT(SetSocketOption(la, SOCKOPT_BACKLOG, 2)==0);
+	ASSERT(listener_reserved(100)==2);
+	ASSERT(SetSocketOption(lb, SOCKOPT_BACKLOG, 0)==0);
+	ASSERT(listener_reserved(200)==0);
+
+	ASSERT(Close(lb)==0);
+	ASSERT(listener_reserved(100)==2);
+	return 0;
+}
+
+
+#define CONNECT_RATE_N 2000
+
+static int connect_rate_acceptor(int argl, void* args)
+{
+	Fid_t lsock = *(Fid_t*)args;
+	for(int i=0; i<argl; i++) {
+		Fid_t srv = Accept(lsock);
+		ASSERT(srv!=NOFILE);
+		ASSERT(Close(srv)==0);
+	}
+	return 0;
+}
+
+BOOT_TEST(test_socket_connect_rate,
+	"Test connections to a waiting acceptor and report the connections per second."
+	)
+{
+	Fid_t lsock = Socket(100);
+	ASSERT(Listen(lsock)==0);
+	Tid_t t = CreateThread(connect_rate_acceptor, CONNECT_RATE_N, &lsock);
+
+	struct timespec t1, t2;
+	clock_gettime(CLOCK_REALTIME, &t1);
+	for(int i=0; i<CONNECT_RATE_N; i++) {
+		Fid_t cli = Socket(NOPORT);
+		ASSERT(Connect(cli, 100, TIMEOUT_INFINITE)==0);
+		ASSERT(Close(cli)==0);
+	}
+	ASSERT(ThreadJoin(t, NULL)==0);
+	clock_gettime(CLOCK_REALTIME, &t2);
+
+	unsigned long Dt = tspec2msec(t2)-tspec2msec(t1);
+	MSG("%d connections in %lu msec: %.0f connections/sec\n", CONNECT_RATE_N, Dt,
+		1000.0*CONNECT_RATE_N/(Dt ? Dt : 1));
+	return 0;
+}
+
+
+BOOT_TEST(test_connect_nonblocking,
+	"Test that a non-blocking Connect reports its progress."
+	)
+{
+	Fid_t lsock = Socket(100);
+	ASSERT(Listen(lsock)==0);
+
+	Fid_t cli = Socket(NOPORT);
+	ASSERT(SetFlags(cli, FID_NONBLOCK)==0);
+	ASSERT(Connect(cli, 100, 1000)==WOULDBLOCK);
+	ASSERT(Connect(cli, 100, 1000)==WOULDBLOCK);
+
+	Fid_t srv = Accept(lsock);
+	ASSERT(srv!=NOFILE);
+	ASSERT(Connect(cli, 100, 1000)==0);
+	check_transfer(cli, srv);
+	check_transfer(srv, cli);
+
+	/* A pending request is refused when the listener goes away */
+	Fid_t cli2 = Socket(NOPORT);
+	ASSERT(SetFlags(cli2, FID_NONBLOCK)==0);
+	ASSERT(Connect(cli2, 100, 1000)==WOULDBLOCK);
+	Close(lsock);
+	ASSERT(Connect(cli2, 100, 1000)==-1);
+
+	/* Closing a socket with a queued request is legal */
+	lsock = Socket(100);
+	ASSERT(Listen(lsock)==0);
+	Fid_t cli3 = Socket(NOPORT);
+	ASSERT(SetFlags(cli3, FID_NONBLOCK)==0);
+	ASSERT(Connect(cli3, 100, 1000)==WOULDBLOCK);
+	ASSERT(Close(cli3)==0);
+	ASSERT(SetFlags(lsock, FID_NONBLOCK)==0);
+	ASSERT(Accept(lsock)==WOULDBLOCK);
+	return 0;
+}
+
+
+BOOT_TEST(test_eventset_sockets,
+	"Test event sets on listeners, connecting sockets and peers."
+	)
+{
+	Fid_t lsock = Socket(100);
+	ASSERT(Listen(lsock)==0);
+	Fid_t cli = Socket(NOPORT);
+	ASSERT(SetFlags(cli, FID_NONBLOCK)==0);
+
+	Fid_t eset = OpenEventSet();
+	fid_event ev[2];
+	ASSERT(EventSetCtl(eset, EVENTSET_ADD, lsock, EVENT_READ)==0);
+	ASSERT(EventSetCtl(eset, EVENTSET_ADD, cli, EVENT_READ|EVENT_WRITE)==0);
+	ASSERT(EventSetWait(eset, ev, 2, 0)==0);
+
+	/* A queued request makes the listener readable */
+	ASSERT(Connect(cli, 100, 1000)==WOULDBLOCK);
+	ASSERT(EventSetWait(eset, ev, 2, 0)==1);
+	ASSERT(ev[0].fid==lsock && ev[0].events==EVENT_READ);
+
+	/* Once accepted, the connecting socket becomes writable */
+	Fid_t srv = Accept(lsock);
+	ASSERT(srv!=NOFILE);
+	ASSERT(EventSetWait(eset, ev, 2, 0)==1);
+	ASSERT(ev[0].fid==cli && ev[0].events==EVENT_WRITE);
+	ASSERT(Connect(cli, 100, 1000)==0);
+
+	ASSERT(Write(srv, "Hello", 6)==6);
+	ASSERT(EventSetWait(eset, ev, 2, 0)==1);
+	ASSERT(ev[0].fid==cli && ev[0].events==(EVENT_READ|EVENT_WRITE));
+
+	/* A closed peer hangs up both directions */
+	ASSERT(Close(srv)==0);
+	ASSERT(EventSetWait(eset, ev, 2, 0)==1);
+	ASSERT(ev[0].events==(EVENT_READ|EVENT_WRITE|EVENT_HANGUP));
+
+	ASSERT(Close(eset)==0);
+	return 0;
+}
+
+
+BOOT_TEST(test_aio_sockets,
+	"Test asynchronous Accept, Connect and Read on sockets."
+	)
+{
+	static aio_sqe sq[8];
+	static aio_cqe cq[8];
+	aio_cqe cqe[8];
+	aio_ring ring = { .entries = 8, .sq = sq, .cq = cq };
+	ASSERT(AioSetup(&ring)==0);
+
+	Fid_t lsock = Socket(100);
+	ASSERT(Listen(lsock)==0);
+	Fid_t cli = Socket(NOPORT);
+
+	aio_push(&ring, (aio_sqe){ .op=AIO_ACCEPT, .fid=lsock, .data=&lsock });
+	ASSERT(AioSubmit(0)==1);
+	aio_push(&ring, (aio_sqe){ .op=AIO_CONNECT, .fid=cli, .port=100, .data=&cli });
+	ASSERT(AioSubmit(2)==1);
+	ASSERT(aio_reap(&ring, cqe, 8)==2);
+
+	Fid_t srv = NOFILE;
+	for(int i=0; i<2; i++) {
+		if(cqe[i].data==&lsock) srv = cqe[i].result;
+		else ASSERT(cqe[i].data==&cli && cqe[i].result==0);
+	}
+	ASSERT(srv!=NOFILE);
+
+	char buffer[12];
+	aio_push(&ring, (aio_sqe){ .op=AIO_READ, .fid=srv, .buf=buffer, .len=12, .data=buffer });
+	ASSERT(AioSubmit(0)==1);
+	ASSERT(Write(cli, "Hello world", 12)==12);
+	ASSERT(AioSubmit(1)==0);
+	ASSERT(aio_reap(&ring, cqe, 8)==1);
+	ASSERT(cqe[0].data==buffer && cqe[0].result==12);
+	ASSERT(strcmp(buffer, "Hello world")==0);
+	return 0;
+}
+
+
+BOOT_TEST(test_socket_message_mode,
+	"Test that message-mode sockets preserve message boundaries."
+	)
+{
+	Fid_t null = OpenNull();
+	ASSERT(SetSocketOption(null, SOCKOPT_MESSAGE, 1)==-1);
+
+	Fid_t lsock = Socket(100);
+	ASSERT(SetSocketOption(lsock, (socket_option)-1, 1)==-1);
+	ASSERT(SetSocketOption(lsock, SOCKOPT_MESSAGE, 1)==0);
+	ASSERT(Listen(lsock)==0);
+	ASSERT(SetSocketOption(lsock, SOCKOPT_MESSAGE, 0)==-1);
+
+	/* Modes must match */
+	Fid_t cli = Socket(NOPORT);
+	ASSERT(Connect(cli, 100, 1000)==-1);
+	ASSERT(SetSocketOption(cli, SOCKOPT_MESSAGE, 1)==0);
+
+	Fid_t srv;
+	connect_sockets(cli, lsock, &srv, 100);
+
+	static char buffer[MAX_MESSAGE_SIZE+1];
+	memset(buffer, 'x', sizeof(buffer));
+	ASSERT(Write(cli, "Hello", 5)==5);
+	ASSERT(Write(cli, buffer, 100)==100);
+	ASSERT(Write(cli, "Hello world", 12)==12);
+	ASSERT(Write(cli, buffer, MAX_MESSAGE_SIZE+1)==-1);
+	ASSERT(Write(cli, buffer, MAX_MESSAGE_SIZE)==MAX_MESSAGE_SIZE);
+
+	ASSERT(Read(srv, buffer, sizeof(buffer))==5);
+	ASSERT(Read(srv, buffer, sizeof(buffer))==100);
+
+	/* A short read truncates the message */
+	ASSERT(Read(srv, buffer, 5)==5);
+	ASSERT(memcmp(buffer, "Hello", 5)==0);
+	ASSERT(Read(srv, buffer, sizeof(buffer))==MAX_MESSAGE_SIZE);
+
+	/* Messages wrap around the buffer intact */
+	for(int i=0; i<100; i++) {
+		ASSERT(Write(srv, "Hello world", 12)==12);
+		ASSERT(Read(cli, buffer, sizeof(buffer))==12);
+		ASSERT(strcmp(buffer, "Hello world")==0);
+		ASSERT(Write(srv, buffer, 99)==99);
+		ASSERT(Read(cli, buffer, sizeof(buffer))==99);
+	}
+
+	Close(srv);
+	ASSERT(Read(cli, buffer, sizeof(buffer))==0);
+	return 0;
+}
+
 
 BOOT_TEST(test_connect_fails_on_bad_fid,
 	"Test that Connect will fail if given a bad fid."
@@ -1971,7 +3769,12 @@ BOOT_TEST(test_connect_fails_on_illegal_port,
 {
 	Fid_t cli = Socket(10);
 	ASSERT(Connect(cli, NOPORT, 100)==-1);
-	ASSERT(Connect(cli, MAX_PORT+1, 100)==-1);
+	ASSERT(Connect(cli, NOPORT-1, 100)==-1);
+
+	/* Out of range values must not wrap around to a legal port */
+	Fid_t lsock = Socket(100);
+	ASSERT(Listen(lsock)==0);
+	ASSERT(Connect(cli, 65536+100, 100)==-1);
 
 	return 0;
 }
@@ -2112,6 +3915,254 @@ BOOT_TEST(test_socket_multi_producer,
 
 
 
+#define SHM_MSG (1<<18)
+
+static int shm_sender(int argl, void* args)
+{
+	Fid_t sock = *(Fid_t*)args;
+	for(int i=0; i<argl; i++) {
+		void* buf;
+		ASSERT(ShmReserve(sock, SHM_MSG, &buf)==0);
+		memset(buf, i, SHM_MSG);
+		ASSERT(ShmSend(sock, SHM_MSG)==SHM_MSG);
+	}
+	ASSERT(ShutDown(sock, SHUTDOWN_WRITE)==0);
+	return 0;
+}
+
+BOOT_TEST(test_socket_shared_mode,
+	"Test that sockets in shared mode transfer messages in place."
+	)
+{
+	Fid_t lsock = Socket(100);
+	ASSERT(SetSocketOption(lsock, SOCKOPT_SHARED, -1)==-1);
+	ASSERT(SetSocketOption(lsock, SOCKOPT_SHARED, MAX_SHARED_SIZE+1)==-1);
+	ASSERT(SetSocketOption(lsock, SOCKOPT_SHARED, 1<<22)==0);
+	ASSERT(Listen(lsock)==0);
+
+	/* Both ends must be in shared mode */
+	Fid_t cli = Socket(NOPORT);
+	ASSERT(Connect(cli, 100, 1000)==-1);
+	ASSERT(SetSocketOption(cli, SOCKOPT_SHARED, 1<<20)==0);
+	ASSERT(SetFlags(cli, FID_NONBLOCK)==0);
+	ASSERT(Connect(cli, 100, 1000)==WOULDBLOCK);
+	Fid_t srv = Accept(lsock);
+	ASSERT(srv!=NOFILE);
+	ASSERT(Connect(cli, 100, 1000)==0);
+	ASSERT(SetFlags(cli, 0)==FID_NONBLOCK);
+
+	/* Read and Write do not work in shared mode */
+	char c;
+	ASSERT(Write(cli, "x", 1)==-1);
+	ASSERT(Read(srv, &c, 1)==-1);
+
+	/* Messages are received in place; the region has the smaller size */
+	void *wbuf, *rbuf;
+	ASSERT(ShmSend(cli, 1)==-1);
+	ASSERT(ShmReserve(cli, (1<<20)+1, &wbuf)==-1);
+	ASSERT(ShmReserve(cli, 1<<19, &wbuf)==0);
+	memcpy(wbuf, "Hello world", 12);
+	ASSERT(ShmSend(cli, 12)==12);
+	ASSERT(ShmReceive(srv, &rbuf)==12);
+	ASSERT(rbuf==wbuf);
+	ASSERT(strcmp(rbuf, "Hello world")==0);
+
+	/* The space of a message is returned by the next receive */
+	ASSERT(SetFlags(cli, FID_NONBLOCK)==0);
+	ASSERT(SetFlags(srv, FID_NONBLOCK)==0);
+	ASSERT(ShmReserve(cli, 1<<20, &wbuf)==WOULDBLOCK);
+	ASSERT(ShmReceive(srv, &rbuf)==WOULDBLOCK);
+	ASSERT(ShmReserve(cli, 1<<20, &wbuf)==0);
+	ASSERT(SetFlags(cli, 0)==FID_NONBLOCK);
+	ASSERT(SetFlags(srv, 0)==FID_NONBLOCK);
+
+	/* A bulk transfer from another process */
+	Pid_t pid = Exec(shm_sender, 16, &cli);
+	ASSERT(pid!=NOPROC);
+	ASSERT(Close(cli)==0);
+	for(int i=0; i<16; i++) {
+		char* msg;
+		ASSERT(ShmReceive(srv, (void**)&msg)==SHM_MSG);
+		for(int j=0; j<SHM_MSG; j++)
+			ASSERT(msg[j]==(char)i);
+	}
+	ASSERT(ShmReceive(srv, &rbuf)==0);
+	ASSERT(WaitChild(pid, NULL)==pid);
+	return 0;
+}
+
+
+static int info_acceptor(int argl, void* args)
+{
+	Fid_t srv = Accept(argl);
+	ASSERT(srv!=NOFILE);
+	return srv;
+}
+
+BOOT_TEST(test_socket_info,
+	"Test that socket information streams report the counters of all sockets."
+	)
+{
+	Fid_t lsock = Socket(100);
+	ASSERT(Listen(lsock)==0);
+
+	Fid_t cli[2];
+	for(int i=0; i<2; i++) {
+		cli[i] = Socket(NOPORT);
+		ASSERT(SetFlags(cli[i], FID_NONBLOCK)==0);
+		ASSERT(Connect(cli[i], 100, 1000)==WOULDBLOCK);
+	}
+	Fid_t srv = Accept(lsock);
+	ASSERT(srv!=NOFILE);
+	ASSERT(Connect(cli[0], 100, 1000)==0);
+	check_transfer(cli[0], srv);
+	ASSERT(Write(srv, "Hello", 5)==5);
+
+	/* A small buffer reads nothing */
+	Fid_t finfo = OpenSocketInfo();
+	ASSERT(finfo!=NOFILE);
+	sockinfo info[8];
+	ASSERT(Read(finfo, (char*)info, sizeof(sockinfo)-1)==0);
+	int n = Read(finfo, (char*)info, sizeof(info));
+	ASSERT(n==4*sizeof(sockinfo));
+	ASSERT(Read(finfo, (char*)info, sizeof(info))==0);
+	ASSERT(Close(finfo)==0);
+
+	int listeners=0, peers=0, unbound=0;
+	for(int i=0; i<4; i++) {
+		ASSERT(info[i].pid==GetPid());
+		switch(info[i].state) {
+		case SOCKINFO_LISTENER:
+			listeners++;
+			ASSERT(info[i].port==100);
+			ASSERT(info[i].queued==1);
+			ASSERT(info[i].peak_queued==2);
+			ASSERT(info[i].accepted==1);
+			break;
+		case SOCKINFO_PEER:
+			peers++;
+			if(info[i].bytes_out==12) {
+				/* The client */
+				ASSERT(info[i].bytes_in==0);
+				ASSERT(info[i].rx_queued==5);
+				ASSERT(info[i].rx_peak==5);
+				ASSERT(info[i].tx_peak==12);
+			} else {
+				ASSERT(info[i].bytes_out==5);
+				ASSERT(info[i].bytes_in==12);
+				ASSERT(info[i].tx_queued==5);
+			}
+			break;
+		case SOCKINFO_UNBOUND:
+			unbound++;
+			break;
+		}
+	}
+	ASSERT(listeners==1 && peers==2 && unbound==1);
+
+	/* Connection latency: a queued connection waits to be accepted */
+	Fid_t l2 = Socket(200);
+	ASSERT(Listen(l2)==0);
+	Fid_t qcli = Socket(NOPORT);
+	ASSERT(SetFlags(qcli, FID_NONBLOCK)==0);
+	ASSERT(Connect(qcli, 200, 1000)==WOULDBLOCK);
+	Mutex mx = MUTEX_INIT;
+	CondVar cv = COND_INIT;
+	Mutex_Lock(&mx);
+	Cond_TimedWait(&mx, &cv, 50);
+	Mutex_Unlock(&mx);
+	Fid_t qsrv = Accept(l2);
+	ASSERT(qsrv!=NOFILE);
+	ASSERT(Connect(qcli, 200, 1000)==0);
+	ASSERT(Write(qcli, "q", 1)==1);
+
+	/* ... while one handed over to a waiting acceptor does not */
+	Tid_t t = CreateThread(info_acceptor, l2, NULL);
+	threadinfo tinfo[2];
+	for(int rounds=0; ; rounds++) {
+		ASSERT(rounds < 10000);
+		ASSERT(read_threadinfo(NOPROC, tinfo, 2)==2);
+		if(tinfo[1].state==THREADINFO_STOPPED && tinfo[1].causes[0]==THREADINFO_PIPE)
+			break;
+		sleep_thread(0);
+	}
+	Fid_t hcli = Socket(NOPORT);
+	ASSERT(Connect(hcli, 200, 1000)==0);
+	int hsrv;
+	ASSERT(ThreadJoin(t, &hsrv)==0);
+	ASSERT(Write(hcli, "hh", 2)==2);
+
+	finfo = OpenSocketInfo();
+	ASSERT(finfo!=NOFILE);
+	unsigned long qlat[2] = {0, 0}, hlat[2] = {0, 0};
+	int found = 0;
+	while(Read(finfo, (char*)info, sizeof(sockinfo))==sizeof(sockinfo)) {
+		if(info[0].state!=SOCKINFO_PEER) continue;
+		unsigned long out = info[0].bytes_out, queued = info[0].rx_queued;
+		if(out==1) { qlat[0] = info[0].connect_latency; found++; }
+		else if(out==0 && queued==1) { qlat[1] = info[0].connect_latency; found++; }
+		else if(out==2) { hlat[0] = info[0].connect_latency; found++; }
+		else if(out==0 && queued==2) { hlat[1] = info[0].connect_latency; found++; }
+	}
+	ASSERT(Close(finfo)==0);
+	ASSERT(found==4);
+	ASSERT(qlat[0]==qlat[1] && qlat[0] >= 50000);
+	ASSERT(hlat[0]==hlat[1] && hlat[0] < qlat[0]);
+	return 0;
+}
+
+
+BOOT_TEST(test_transfer_file,
+	"Test that TransferFile copies between streams inside the kernel."
+	)
+{
+	pipe_t p, q;
+	ASSERT(Pipe(&p)==0);
+	ASSERT(Pipe(&q)==0);
+	ASSERT(TransferFile(NOFILE, p.read, 10)==-1);
+	ASSERT(TransferFile(p.read, q.read, 10)==-1);
+	ASSERT(TransferFile(q.write, p.write, 10)==-1);
+
+	/* From the null device, into a pipe */
+	Fid_t null = OpenNull();
+	char buf[6000];
+	ASSERT(TransferFile(q.write, null, 3000)==3000);
+	memset(buf, 1, sizeof(buf));
+	ASSERT(Read(q.read, buf, sizeof(buf))==3000);
+	for(int i=0; i<3000; i++)
+		ASSERT(buf[i]==0);
+
+	/* From a pipe, into a socket, to end of file */
+	Fid_t lsock = Socket(100);
+	ASSERT(Listen(lsock)==0);
+	Fid_t cli = Socket(NOPORT);
+	ASSERT(SetFlags(cli, FID_NONBLOCK)==0);
+	ASSERT(Connect(cli, 100, 1000)==WOULDBLOCK);
+	Fid_t srv = Accept(lsock);
+	ASSERT(Connect(cli, 100, 1000)==0);
+	ASSERT(SetFlags(cli, 0)==FID_NONBLOCK);
+
+	for(int i=0; i<sizeof(buf); i++)
+		buf[i] = i % 251;
+	ASSERT(Write(p.write, buf, sizeof(buf))==sizeof(buf));
+	ASSERT(Close(p.write)==0);
+	ASSERT(TransferFile(cli, p.read, 100000)==sizeof(buf));
+	ASSERT(TransferFile(cli, p.read, 100000)==0);
+
+	char rbuf[6000];
+	int n = 0, rc;
+	while(n < sizeof(rbuf) && (rc = Read(srv, rbuf+n, sizeof(rbuf)-n)) > 0)
+		n += rc;
+	ASSERT(n==sizeof(rbuf));
+	ASSERT(memcmp(buf, rbuf, sizeof(buf))==0);
+
+	/* A non-blocking input does not block */
+	ASSERT(SetFlags(q.read, FID_NONBLOCK)==0);
+	ASSERT(TransferFile(cli, q.read, 10)==WOULDBLOCK);
+	return 0;
+}
+
+
 BOOT_TEST(test_shudown_read,
 	"Test that ShutDown with SHUTDOWN_READ blocks Write"
 	)
@@ -2203,6 +4254,7 @@ TEST_SUITE(socket_tests,
 	&test_listen_fails_on_bad_fid,
 	&test_listen_fails_on_NOPORT,
 	&test_listen_fails_on_occupied_port,
+	&test_listen_reuseport,
 	&test_listen_fails_on_initialized_socket,
 
 	&test_accept_succeds,
@@ -2212,6 +4264,14 @@ TEST_SUITE(socket_tests,
 	&test_accept_reusable,
 	&test_accept_fails_on_exhausted_fid,
 	&test_accept_unblocks_on_close,
+	&test_socket_create_nonblocking,
+	&test_accept_nonblocking,
+	&test_connect_nonblocking,
+	&test_accept_many_with_backlog,
+	&test_listener_reservation,
+	&test_socket_connect_rate,
+	&test_eventset_sockets,
+	&test_aio_sockets,
 
 	&test_connect_fails_on_bad_fid,
 	&test_connect_fails_on_bad_socket,
@@ -2222,6 +4282,10 @@ TEST_SUITE(socket_tests,
 	&test_socket_small_transfer,
 	&test_socket_single_producer,
 	&test_socket_multi_producer,
+	&test_socket_message_mode,
+	&test_socket_shared_mode,
+	&test_socket_info,
+	&test_transfer_file,
 
 	&test_shudown_read,
 	&test_shudown_write,